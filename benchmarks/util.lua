@@ -14,7 +14,12 @@ return function(f)
         f()
     elseif arg[1] == '--lll-compile-only' then
         assert(lll.compile(f))
+    elseif arg[1] == '--lll-compile-time' then
+        assert(lll.compile(f))
+        local time = lll.stats().time
+        print(time.build, time.verify, time.optimize, time.codegen, time.total)
     elseif arg[1] == '--dump' then
+        lll.setRetainIREnable(true)
         assert(lll.compile(f))
         lll.dump(f)
     else
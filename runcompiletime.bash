@@ -0,0 +1,60 @@
+#!/bin/bash
+# LLL - Lua Low Level
+# September, 2015
+# Author: Gabriel de Quadros Ligneul
+# Copyright Notice for LLL: see lllcore.h
+#
+# runcompiletime.bash
+# Compiles each benchmark module and prints the time of each phase of the
+# compilation, measured by the compiler itself (lll.stats)
+
+n_tests=20
+
+modules_prefix='benchmarks/'
+modules=(
+    'floatarith.lua'
+    'heapsort.lua'
+    'increment.lua'
+    'loopsum.lua'
+    'mandelbrot.lua'
+    'matmul.lua'
+    'qt.lua'
+    'queen.lua'
+    'sieve.lua'
+    'sudoku.lua'
+)
+
+phases=('build' 'verify' 'optimize' 'codegen' 'total')
+
+function statistics {
+    awk -v n=$n_tests -v col=$1 '
+        { x[NR] = $col; sum += $col }
+        END {
+            avg = sum / n
+            for (i = 1; i <= n; i++) dev += (x[i] - avg) ^ 2
+            stddev = sqrt(dev / (n - 1))
+            printf "%.5f\t%.5f\t(%.5f%%)", avg, stddev, 100 * stddev / avg
+        }'
+}
+
+echo "Distro: "`cat /etc/*-release | head -1`
+echo "Kernel: "`uname -r`
+echo "CPU:    "`cat /proc/cpuinfo | grep 'model name' | tail -1 | \
+                sed 's/model name.*:.//'`
+for m in "${modules[@]}"; do
+    path="$modules_prefix""$m"
+    times=`for i in $(seq 1 $n_tests); do
+        ./src/lua $path --lll-compile-time
+    done`
+
+    echo "
+Module: $path
+              avg        stddev"
+    for i in "${!phases[@]}"; do
+        printf "%-10s    " "${phases[$i]}:"
+        echo "$times" | statistics $(($i + 1))
+        echo
+    done
+    echo "
+--------------------"
+done
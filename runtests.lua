@@ -14,15 +14,25 @@ local TEST_SUFFIX = '.lua'
 -- Declaraion of test modules
 local modules = {
     'api',
+    'array',
     'basic',
     'binop',
+    'ccall',
     'closure',
+    'escape',
+    'ffi',
     'for',
+    'forin',
+    'hoist',
     'optest',
+    'pow',
+    'readonly',
     'self',
+    'selfcall',
     'setlist',
     'table',
     'tabup',
+    'typedarray',
     'unop',
     'upval',
     'vararg',
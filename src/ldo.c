@@ -389,9 +389,10 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
         callhook(L, ci);
 
       /* LLL auto compilation and execution */
-      if (LLLIsAutoCompileEnable() && !LLLIsCompiled(p)
-          && ++p->ncalls >= LLLGetCallsToCompile())
-        LLLCompile(L, p, NULL);
+      if (G(L)->lllautocompile && !LLLIsCompiled(p)
+          && ++p->ncalls >= G(L)->lllcallstocompile)
+        LLLAutoCompile(L, p);
+      LLLCountEntry(L, p);
       if (p->lllfunction) {
         int n = p->lllfunction(L, clLvalue(func));
         if (n < 0) { /* tailcall */
@@ -522,6 +523,86 @@ void luaD_callnoyield (lua_State *L, StkId func, int nResults) {
 }
 
 
+/*
+** LLL: call of a compiled (non-vararg) function to itself. The compiled
+** code calls its own native function directly, between the frame setup
+** done by 'luaD_selfprecall' and the end done by 'luaD_selfposcall'; the
+** type dispatch, the compilation checks and the indirect call of
+** 'luaD_precall' are skipped.
+*/
+CallInfo *luaD_selfprecall (lua_State *L, StkId func, int nResults) {
+  CallInfo *ci;
+  Proto *p = clLvalue(func)->p;
+  int n = cast_int(L->top - func) - 1;  /* number of real arguments */
+  int fsize = p->maxstacksize;  /* frame size */
+  L->nny++;
+  if (++L->nCcalls >= LUAI_MAXCCALLS)
+    stackerror(L);
+  checkstackp(L, fsize, func);
+  for (; n < p->numparams; n++)
+    setnilvalue(L->top++);  /* complete missing arguments */
+  ci = next_ci(L);  /* now 'enter' new function */
+  ci->nresults = nResults;
+  ci->func = func;
+  ci->u.l.base = func + 1;
+  L->top = ci->top = func + 1 + fsize;
+  lua_assert(ci->top <= L->stack_last);
+  ci->u.l.savedpc = p->code;  /* starting point */
+  ci->callstatus = CIST_LUA;
+  if (L->hookmask & LUA_MASKCALL)
+    callhook(L, ci);
+  return ci;
+}
+
+
+void luaD_selfposcall (lua_State *L, CallInfo *ci, int n) {
+  if (n < 0) {  /* tailcall */
+    int nResults = ci->nresults;
+    n = -n;
+    ci->nresults = n;
+    luaD_poscall(L, ci, L->top - n, n);
+    if (!luaD_precall(L, L->top - n, nResults))  /* is a Lua function? */
+      luaV_execute(L);  /* call it */
+  }
+  else
+    luaD_poscall(L, ci, L->top - n, n);
+  L->nCcalls--;
+  L->nny--;
+}
+
+
+/*
+** LLL: call of a C function (light or closure) by compiled code. The
+** compiled code calls the function itself after 'luaD_cprecall'; the call
+** is finished by 'luaD_cposcall' or, when no hook is set and the number
+** of results is fixed, by the compiled code.
+*/
+CallInfo *luaD_cprecall (lua_State *L, StkId func, int nResults) {
+  CallInfo *ci;
+  L->nny++;
+  if (++L->nCcalls >= LUAI_MAXCCALLS)
+    stackerror(L);
+  checkstackp(L, LUA_MINSTACK, func);  /* ensure minimum stack size */
+  ci = next_ci(L);  /* now 'enter' new function */
+  ci->nresults = nResults;
+  ci->func = func;
+  ci->top = L->top + LUA_MINSTACK;
+  lua_assert(ci->top <= L->stack_last);
+  ci->callstatus = 0;
+  if (L->hookmask & LUA_MASKCALL)
+    luaD_hook(L, LUA_HOOKCALL, -1);
+  return ci;
+}
+
+
+void luaD_cposcall (lua_State *L, CallInfo *ci, int n) {
+  api_checknelems(L, n);
+  luaD_poscall(L, ci, L->top - n, n);
+  L->nCcalls--;
+  L->nny--;
+}
+
+
 /*
 ** Completes the execution of an interrupted C function, calling its
 ** continuation function.
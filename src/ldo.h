@@ -42,6 +42,11 @@ LUAI_FUNC void luaD_hook (lua_State *L, int event, int line);
 LUAI_FUNC int luaD_precall (lua_State *L, StkId func, int nresults);
 LUAI_FUNC void luaD_call (lua_State *L, StkId func, int nResults);
 LUAI_FUNC void luaD_callnoyield (lua_State *L, StkId func, int nResults);
+LUAI_FUNC CallInfo *luaD_selfprecall (lua_State *L, StkId func,
+                                      int nResults);
+LUAI_FUNC void luaD_selfposcall (lua_State *L, CallInfo *ci, int n);
+LUAI_FUNC CallInfo *luaD_cprecall (lua_State *L, StkId func, int nResults);
+LUAI_FUNC void luaD_cposcall (lua_State *L, CallInfo *ci, int n);
 LUAI_FUNC int luaD_pcall (lua_State *L, Pfunc func, void *u,
                                         ptrdiff_t oldtop, ptrdiff_t ef);
 LUAI_FUNC int luaD_poscall (lua_State *L, CallInfo *ci, StkId firstResult,
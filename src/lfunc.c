@@ -122,6 +122,7 @@ Proto *luaF_newproto (lua_State *L) {
   f->ncalls = 0;
   f->lllfunction = NULL;
   f->llldata = NULL;
+  f->lllcache = NULL;
   return f;
 }
 
@@ -19,6 +19,13 @@ extern "C" {
 #include "lvm.h"
 }
 
+// Integral exponents up to this value are expanded into multiplications.
+// Only x^2 is exact (a single rounding, as luai_numpow in Lua 5.4); raising
+// it trades bit-identical results with pow for speed.
+#ifndef LLL_MAX_POW_CHAIN
+#define LLL_MAX_POW_CHAIN 2
+#endif
+
 namespace lll {
 
 Arith::Arith(CompilerState& cs, Stack& stack) :
@@ -31,7 +38,7 @@ Arith::Arith(CompilerState& cs, Stack& stack) :
     check_y_(cs.CreateSubBlock("check_y")),
     intop_(cs.CreateSubBlock("intop", check_y_)),
     floatop_(cs.CreateSubBlock("floatop", intop_)),
-    tmop_(cs.CreateSubBlock("tmop", floatop_)),
+    tmop_(cs.CreateColdBlock("tmop", floatop_)),
     x_int_(nullptr),
     x_float_(nullptr) {
 }
@@ -47,7 +54,7 @@ void Arith::Compile() {
 void Arith::CheckXTag() {
     auto check_y_int = cs_.CreateSubBlock("is_y_int");
     auto check_x_float = cs_.CreateSubBlock("is_x_float", check_y_int);
-    auto tonumber_x = cs_.CreateSubBlock("tonumber_x", check_x_float);
+    auto tonumber_x = cs_.CreateColdBlock("tonumber_x", check_x_float);
 
     cs_.B_.SetInsertPoint(entry_);
     auto xtag = x_.GetTag();
@@ -77,7 +84,7 @@ void Arith::CheckXTag() {
 }
 
 void Arith::CheckYTag() {
-    auto tonumber_y = cs_.CreateSubBlock("tonumber_y", check_y_);
+    auto tonumber_y = cs_.CreateColdBlock("tonumber_y", check_y_);
 
     cs_.B_.SetInsertPoint(check_y_);
     auto floatt = cs_.rt_.GetType("lua_Number");
@@ -176,7 +183,7 @@ llvm::Value* Arith::PerformFloatOp(llvm::Value* lhs, llvm::Value* rhs) {
         case OP_MOD:
             return cs_.CreateCall("LLLNumMod", {lhs, rhs}, name);
         case OP_POW:
-            return cs_.CreateCall(STRINGFY2(l_mathop(pow)), {lhs, rhs}, name);
+            return PerformPow(lhs, rhs);
         case OP_DIV:
             return cs_.B_.CreateFDiv(lhs, rhs, name);
         case OP_IDIV:
@@ -189,6 +196,77 @@ llvm::Value* Arith::PerformFloatOp(llvm::Value* lhs, llvm::Value* rhs) {
     return nullptr;
 }
 
+llvm::Value* Arith::PerformPow(llvm::Value* lhs, llvm::Value* rhs) {
+    auto floatt = cs_.rt_.GetType("lua_Number");
+    lua_Number exponent;
+    if (GetConstantExponent(&exponent)) {
+        if (exponent == 0)
+            return llvm::ConstantFP::get(floatt, 1.0);
+        if (exponent >= 1 && exponent <= LLL_MAX_POW_CHAIN &&
+            exponent == static_cast<int>(exponent))
+            return PerformPowChain(lhs, static_cast<int>(exponent));
+        if (exponent == -1)
+            return cs_.B_.CreateFDiv(llvm::ConstantFP::get(floatt, 1.0), lhs,
+                    "result");
+        if (exponent == 0.5) {
+            // pow(-0, 0.5) is +0 and pow(-inf, 0.5) is +inf
+            auto root = cs_.CreateCall(STRINGFY2(l_mathop(sqrt)), {lhs}, "sqrt");
+            auto zero = llvm::ConstantFP::get(floatt, 0.0);
+            auto positive = cs_.B_.CreateFAdd(root, zero, "sqrt.positive");
+            auto inf = llvm::ConstantFP::getInfinity(floatt);
+            auto minusinf = llvm::ConstantFP::getInfinity(floatt, true);
+            auto isminusinf = cs_.B_.CreateFCmpOEQ(lhs, minusinf);
+            return cs_.B_.CreateSelect(isminusinf, inf, positive, "result");
+        }
+        return cs_.CreateCall(STRINGFY2(l_mathop(pow)), {lhs, rhs}, "result");
+    }
+
+    // Exponent only known at runtime, square it without calling pow
+    auto block = cs_.B_.GetInsertBlock();
+    auto square = cs_.CreateSubBlock("powsquare", block);
+    auto callpow = cs_.CreateSubBlock("callpow", square);
+    auto result = cs_.CreateSubBlock("powresult", callpow);
+
+    auto two = llvm::ConstantFP::get(floatt, 2.0);
+    auto istwo = cs_.B_.CreateFCmpOEQ(rhs, two, "is.two");
+    cs_.B_.CreateCondBr(istwo, square, callpow);
+
+    cs_.B_.SetInsertPoint(square);
+    auto squareresult = cs_.B_.CreateFMul(lhs, lhs, "square");
+    cs_.B_.CreateBr(result);
+
+    cs_.B_.SetInsertPoint(callpow);
+    auto powresult = cs_.CreateCall(STRINGFY2(l_mathop(pow)), {lhs, rhs},
+            "pow");
+    cs_.B_.CreateBr(result);
+
+    cs_.B_.SetInsertPoint(result);
+    return CreatePHI(floatt, {{squareresult, square}, {powresult, callpow}},
+            "result");
+}
+
+llvm::Value* Arith::PerformPowChain(llvm::Value* x, int n) {
+    llvm::Value* result = nullptr;
+    for (auto power = x; n > 0; n >>= 1) {
+        if (n & 1)
+            result = result ? cs_.B_.CreateFMul(result, power, "chain") : power;
+        if (n > 1)
+            power = cs_.B_.CreateFMul(power, power, "power");
+    }
+    return result;
+}
+
+bool Arith::GetConstantExponent(lua_Number* exponent) {
+    int c = GETARG_C(cs_.instr_);
+    if (!ISK(c))
+        return false;
+    TValue* k = cs_.proto_->k + INDEXK(c);
+    if (!ttisnumber(k))
+        return false;
+    *exponent = nvalue(k);
+    return true;
+}
+
 int Arith::GetMethodTag() {
     switch (GET_OPCODE(cs_.instr_)) {
         case OP_ADD:    return TM_ADD;
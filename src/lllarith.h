@@ -13,6 +13,10 @@
 
 #include "lllopcode.h"
 
+extern "C" {
+#include "lua.h"
+}
+
 namespace lll {
 
 class Register;
@@ -40,7 +44,16 @@ private:
     // Performs the integer/float binary operation
     llvm::Value* PerformIntOp(llvm::Value* lhs, llvm::Value* rhs);
     llvm::Value* PerformFloatOp(llvm::Value* lhs, llvm::Value* rhs);
-    
+
+    // Performs the exponentiation, specializing cheap exponents
+    llvm::Value* PerformPow(llvm::Value* lhs, llvm::Value* rhs);
+
+    // Expands x^n into a chain of multiplications (n > 0)
+    llvm::Value* PerformPowChain(llvm::Value* x, int n);
+
+    // Returns whether the exponent is a numeric constant and obtains it
+    bool GetConstantExponent(lua_Number* exponent);
+
     // Obtains the corresponding tag for the opcode
     int GetMethodTag();
 
@@ -0,0 +1,130 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllarray.c
+** Typed numeric arrays; the compiled code accesses the elements directly
+** and uses these metamethods only as fallback
+*/
+
+#define lllarray_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lllarray.h"
+#include "lstate.h"
+
+static const char *const typenames[] =
+    {"float64", "int64", "int32", "uint8", NULL};
+
+static const size_t typesizes[] =
+    {sizeof(double), sizeof(int64_t), sizeof(int32_t), sizeof(uint8_t)};
+
+
+static LLLArray *checkarray (lua_State *L) {
+  return (LLLArray *)luaL_checkudata(L, 1, LLL_ARRAY_MT);
+}
+
+
+int lllarray_new (lua_State *L) {
+  int type = luaL_checkoption(L, 1, NULL, typenames);
+  lua_Integer size = luaL_checkinteger(L, 2);
+  size_t nbytes;
+  LLLArray *a;
+  luaL_argcheck(L, size >= 0 &&
+      (size_t)size <= (MAX_SIZET - sizeof(LLLArray)) / typesizes[type], 2,
+      "invalid size");
+  nbytes = sizeof(LLLArray) + (size_t)size * typesizes[type];
+  a = (LLLArray *)lua_newuserdata(L, nbytes);
+  memset(a, 0, nbytes);
+  a->size = size;
+  a->type = type;
+  luaL_setmetatable(L, LLL_ARRAY_MT);
+  return 1;
+}
+
+
+static int array_index (lua_State *L) {
+  LLLArray *a = checkarray(L);
+  int isnum;
+  lua_Integer i = lua_tointegerx(L, 2, &isnum);
+  char *data = lllarray_data(a);
+  if (!isnum || i < 1 || i > a->size) {
+    lua_pushnil(L);  /* out of bounds (or not an index) */
+    return 1;
+  }
+  i--;
+  switch (a->type) {
+    case LLL_ARRAY_FLOAT64:
+      lua_pushnumber(L, cast_num(((double *)data)[i])); break;
+    case LLL_ARRAY_INT64:
+      lua_pushinteger(L, ((int64_t *)data)[i]); break;
+    case LLL_ARRAY_INT32:
+      lua_pushinteger(L, ((int32_t *)data)[i]); break;
+    default:
+      lua_pushinteger(L, ((uint8_t *)data)[i]); break;
+  }
+  return 1;
+}
+
+
+/* integer elements are truncated to the size of the type */
+static int array_newindex (lua_State *L) {
+  LLLArray *a = checkarray(L);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  char *data = lllarray_data(a);
+  luaL_argcheck(L, 1 <= i && i <= a->size, 2, "index out of bounds");
+  i--;
+  switch (a->type) {
+    case LLL_ARRAY_FLOAT64:
+      ((double *)data)[i] = (double)luaL_checknumber(L, 3); break;
+    case LLL_ARRAY_INT64:
+      ((int64_t *)data)[i] = (int64_t)luaL_checkinteger(L, 3); break;
+    case LLL_ARRAY_INT32:
+      ((int32_t *)data)[i] = (int32_t)luaL_checkinteger(L, 3); break;
+    default:
+      ((uint8_t *)data)[i] = (uint8_t)luaL_checkinteger(L, 3); break;
+  }
+  return 0;
+}
+
+
+static int array_len (lua_State *L) {
+  lua_pushinteger(L, checkarray(L)->size);
+  return 1;
+}
+
+
+static const luaL_Reg array_m[] = {
+  {"__index", array_index},
+  {"__newindex", array_newindex},
+  {"__len", array_len},
+  {NULL, NULL}
+};
+
+
+void lllarray_init (lua_State *L) {
+  if (luaL_newmetatable(L, LLL_ARRAY_MT)) {
+    luaL_setfuncs(L, array_m, 0);
+    /* locked: the compiled code doesn't call the metamethods */
+    lua_pushliteral(L, LLL_ARRAY_MT);
+    lua_setfield(L, -2, "__metatable");
+  }
+  G(L)->lllarraymt = hvalue(L->top - 1);  /* read by the compiled code */
+  lua_pop(L, 1);
+}
+
+
+Table *lllarray_metatable (lua_State *L) {
+  return G(L)->lllarraymt;
+}
+
@@ -0,0 +1,43 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllarray.h
+** Typed numeric arrays (full userdata with unboxed elements)
+*/
+
+#ifndef LLLARRAY_H
+#define LLLARRAY_H
+
+#include "lobject.h"
+
+/* registry key of the metatable shared by all arrays */
+#define LLL_ARRAY_MT "lll.array"
+
+/* element types */
+#define LLL_ARRAY_FLOAT64 0
+#define LLL_ARRAY_INT64   1
+#define LLL_ARRAY_INT32   2
+#define LLL_ARRAY_UINT8   3
+
+/* header of the userdata memory, the elements follow it */
+typedef struct LLLArray {
+  lua_Integer size;
+  lua_Integer type;
+} LLLArray;
+
+#define lllarray_data(a)  (cast(char *, (a)) + sizeof(LLLArray))
+
+/* creates the metatable of the arrays */
+LUAI_FUNC void lllarray_init (lua_State *L);
+
+/* lll.array(type, size): creates an array of zeros */
+LUAI_FUNC int lllarray_new (lua_State *L);
+
+/* returns the metatable of the arrays (NULL if it wasn't created) */
+LUAI_FUNC Table *lllarray_metatable (lua_State *L);
+
+#endif
+
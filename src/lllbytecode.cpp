@@ -0,0 +1,202 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllbytecode.cpp
+*/
+
+#include "lllbytecode.h"
+
+extern "C" {
+#include "lprefix.h"
+#include "lobject.h"
+#include "lopcodes.h"
+}
+
+namespace lll {
+
+bool Bytecode::GetWrittenRegisters(Proto* proto, int pc, int* first,
+        int* last) {
+    Instruction i = proto->code[pc];
+    int a = GETARG_A(i);
+    int top = proto->maxstacksize;
+    *first = a;
+    *last = a;
+    switch (GET_OPCODE(i)) {
+        case OP_MOVE: case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL:
+        case OP_GETUPVAL: case OP_GETTABUP: case OP_GETTABLE:
+        case OP_NEWTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+        case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+        case OP_BXOR: case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT:
+        case OP_NOT: case OP_LEN: case OP_CONCAT: case OP_TESTSET:
+        case OP_TFORLOOP: case OP_CLOSURE:
+            return true;
+        case OP_LOADNIL:
+            *last = a + GETARG_B(i);
+            return true;
+        case OP_SELF:
+            *last = a + 1;
+            return true;
+        case OP_FORLOOP:
+            *last = a + 3;
+            return true;
+        case OP_FORPREP:
+            *last = a + 2;
+            return true;
+        case OP_TFORCALL:
+            // The call is performed at R(A+3) and may clobber the stack above
+            *first = a + 3;
+            *last = top;
+            return true;
+        case OP_CALL: case OP_TAILCALL: case OP_VARARG:
+            *last = top;
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+bool Bytecode::WritesRegister(Proto* proto, int pc, int reg) {
+    int first, last;
+    return GetWrittenRegisters(proto, pc, &first, &last) &&
+           first <= reg && reg <= last;
+}
+
+bool Bytecode::GetKilledRegisters(Proto* proto, int pc, int* first,
+        int* last) {
+    Instruction i = proto->code[pc];
+    int a = GETARG_A(i);
+    *first = a;
+    *last = a;
+    switch (GET_OPCODE(i)) {
+        case OP_MOVE: case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL:
+        case OP_GETUPVAL: case OP_GETTABUP: case OP_GETTABLE:
+        case OP_NEWTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+        case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+        case OP_BXOR: case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT:
+        case OP_NOT: case OP_LEN: case OP_CONCAT: case OP_CLOSURE:
+        case OP_FORPREP:
+            return true;
+        case OP_LOADNIL:
+            *last = a + GETARG_B(i);
+            return true;
+        case OP_SELF:
+            *last = a + 1;
+            return true;
+        case OP_CALL:
+            *last = a + GETARG_C(i) - 2;
+            return GETARG_C(i) > 1;
+        case OP_VARARG:
+            *last = a + GETARG_B(i) - 2;
+            return GETARG_B(i) > 1;
+        case OP_TFORCALL:
+            *first = a + 3;
+            *last = a + 2 + GETARG_C(i);
+            return GETARG_C(i) > 0;
+        default:
+            break;
+    }
+    return false;
+}
+
+std::vector<int> Bytecode::GetReadRegisters(Proto* proto, int pc) {
+    std::vector<int> regs;
+    Instruction i = proto->code[pc];
+    int a = GETARG_A(i);
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    auto AddRange = [&](int first, int last) {
+        for (int r = first; r <= last; ++r)
+            regs.push_back(r);
+    };
+    auto AddRK = [&](int arg) {
+        if (!ISK(arg))
+            regs.push_back(arg);
+    };
+    int top = proto->maxstacksize - 1;
+    switch (GET_OPCODE(i)) {
+        case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+        case OP_TESTSET:
+            regs.push_back(b);
+            break;
+        case OP_GETTABUP:
+            AddRK(c);
+            break;
+        case OP_GETTABLE: case OP_SELF:
+            regs.push_back(b);
+            AddRK(c);
+            break;
+        case OP_SETTABUP: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+        case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+        case OP_BXOR: case OP_SHL: case OP_SHR: case OP_EQ: case OP_LT:
+        case OP_LE:
+            AddRK(b);
+            AddRK(c);
+            break;
+        case OP_SETUPVAL: case OP_TEST:
+            regs.push_back(a);
+            break;
+        case OP_SETTABLE:
+            regs.push_back(a);
+            AddRK(b);
+            AddRK(c);
+            break;
+        case OP_CONCAT:
+            AddRange(b, c);
+            break;
+        case OP_JMP:
+            // Closes the upvalues >= R(A - 1)
+            if (a > 0)
+                AddRange(a - 1, top);
+            break;
+        case OP_CALL: case OP_TAILCALL:
+            AddRange(a, b != 0 ? a + b - 1 : top);
+            break;
+        case OP_RETURN:
+            AddRange(a, b != 0 ? a + b - 2 : top);
+            break;
+        case OP_FORLOOP: case OP_FORPREP: case OP_TFORCALL:
+            AddRange(a, a + 2);
+            break;
+        case OP_TFORLOOP:
+            regs.push_back(a + 1);
+            break;
+        case OP_SETLIST:
+            AddRange(a, b != 0 ? a + b : top);
+            break;
+        case OP_CLOSURE: {
+            Proto* p = proto->p[GETARG_Bx(i)];
+            for (int u = 0; u < p->sizeupvalues; ++u)
+                if (p->upvalues[u].instack)
+                    regs.push_back(p->upvalues[u].idx);
+            break;
+        }
+        default:
+            break;
+    }
+    return regs;
+}
+
+std::vector<int> Bytecode::GetSuccessors(Proto* proto, int pc) {
+    Instruction i = proto->code[pc];
+    switch (GET_OPCODE(i)) {
+        case OP_LOADBOOL:
+            return {GETARG_C(i) ? pc + 2 : pc + 1};
+        case OP_JMP: case OP_FORPREP:
+            return {pc + 1 + GETARG_sBx(i)};
+        case OP_EQ: case OP_LT: case OP_LE: case OP_TEST: case OP_TESTSET:
+            return {pc + 1, pc + 2};
+        case OP_FORLOOP: case OP_TFORLOOP:
+            return {pc + 1, pc + 1 + GETARG_sBx(i)};
+        case OP_RETURN: case OP_TAILCALL:
+            return {};
+        default:
+            break;
+    }
+    return {pc + 1};
+}
+
+}
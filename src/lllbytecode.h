@@ -0,0 +1,50 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllbytecode.h
+** Auxiliary functions for inspecting the Lua bytecode
+*/
+
+#ifndef LLLBYTECODE_H
+#define LLLBYTECODE_H
+
+#include <vector>
+
+extern "C" {
+struct Proto;
+}
+
+namespace lll {
+
+class Bytecode {
+public:
+    // Obtains the range of registers [first, last] written by the instruction
+    // at $pc. Open ranges (calls, varargs) go up to the last register.
+    // Returns false if the instruction doesn't write any register.
+    static bool GetWrittenRegisters(Proto* proto, int pc, int* first,
+            int* last);
+
+    // Returns whether the instruction at $pc writes the register $reg
+    static bool WritesRegister(Proto* proto, int pc, int reg);
+
+    // Obtains the range of registers [first, last] that are always written by
+    // the instruction at $pc (registers that may not be written are left out)
+    // Returns false if there is no such register.
+    static bool GetKilledRegisters(Proto* proto, int pc, int* first,
+            int* last);
+
+    // Obtains the registers read by the instruction at $pc. Instructions that
+    // use the stack up to the top read every register above the base one.
+    static std::vector<int> GetReadRegisters(Proto* proto, int pc);
+
+    // Obtains the instructions that can be executed after the one at $pc
+    static std::vector<int> GetSuccessors(Proto* proto, int pc);
+};
+
+}
+
+#endif
+
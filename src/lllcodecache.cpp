@@ -0,0 +1,119 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllcodecache.cpp
+*/
+
+#include <mutex>
+#include <unordered_map>
+
+#include "lllcodecache.h"
+#include "lllengine.h"
+
+extern "C" {
+#include "lprefix.h"
+}
+
+namespace {
+
+// The cache doesn't keep the code alive, it is freed with the last proto
+struct Shared {
+    std::weak_ptr<lll::Engine> engine;
+    int selfcaches;
+};
+
+// Code indexed by the key of the protos (shared by the states of all threads)
+std::unordered_map<std::string, Shared> code_;
+
+// Guards the code
+std::mutex mutex_;
+
+template<typename T>
+void Append(std::string& key, const T& value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendProto(std::string& key, Proto* proto) {
+    Append(key, proto->numparams);
+    Append(key, proto->is_vararg);
+    Append(key, proto->maxstacksize);
+    Append(key, proto->sizecode);
+    key.append(reinterpret_cast<const char*>(proto->code),
+            proto->sizecode * sizeof(Instruction));
+    Append(key, proto->sizek);
+    for (int i = 0; i < proto->sizek; ++i) {
+        TValue* k = &proto->k[i];
+        Append(key, rttype(k));
+        if (ttisboolean(k)) {
+            Append(key, bvalue(k));
+        } else if (ttisinteger(k)) {
+            Append(key, ivalue(k));
+        } else if (ttisfloat(k)) {
+            Append(key, fltvalue(k));
+        } else if (ttisstring(k)) {
+            size_t len = tsslen(tsvalue(k));
+            Append(key, len);
+            key.append(getstr(tsvalue(k)), len);
+        }
+    }
+    Append(key, proto->sizeupvalues);
+    for (int i = 0; i < proto->sizeupvalues; ++i) {
+        Append(key, proto->upvalues[i].instack);
+        Append(key, proto->upvalues[i].idx);
+        Append(key, proto->upvalues[i].readonly);
+    }
+    Append(key, proto->sizep);
+    for (int i = 0; i < proto->sizep; ++i)
+        AppendProto(key, proto->p[i]);
+}
+
+}
+
+namespace lll {
+
+std::string CodeCache::MakeKey(Proto* proto, bool vectorize, bool arrays) {
+    std::string key;
+    Append(key, vectorize);
+    Append(key, arrays);
+    AppendProto(key, proto);
+    return key;
+}
+
+bool CodeCache::Find(const std::string& key, Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto shared = code_.find(key);
+    if (shared == code_.end())
+        return false;
+    entry.engine = shared->second.engine.lock();
+    entry.selfcaches = shared->second.selfcaches;
+    if (!entry.engine) {
+        code_.erase(shared);
+        return false;
+    }
+    return true;
+}
+
+void CodeCache::Add(const std::string& key, const Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // The keys of the freed code are removed before the cache grows
+    for (auto i = code_.begin(); i != code_.end();) {
+        if (i->second.engine.expired())
+            i = code_.erase(i);
+        else
+            ++i;
+    }
+
+    // Another state may have compiled the same proto at the same time
+    auto& shared = code_[key];
+    if (shared.engine.expired()) {
+        shared.engine = entry.engine;
+        shared.selfcaches = entry.selfcaches;
+    }
+}
+
+}
+
@@ -0,0 +1,76 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllcodecache.h
+** Native code shared by the Lua states of the process
+** The compiled code reaches the constants, the tag method names and the
+** caches through its arguments, so the function compiled for a proto can be
+** used by any proto with the same bytecode; the states that load the same
+** chunk compile each function only once
+*/
+
+#ifndef LLLCODECACHE_H
+#define LLLCODECACHE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lllruntime.h"
+
+extern "C" {
+#include "lobject.h"
+}
+
+namespace lll {
+
+class Engine;
+
+// Code specialized to the tags of the parameters (see Compiler)
+struct Clone {
+    std::vector<int> signature;
+    std::shared_ptr<Engine> engine;
+    LLLFunction function;
+};
+
+// Compiled code installed in a proto
+// The clones belong to the proto, they aren't shared with other states; the
+// calls of each signature without a clone are counted in $signatures
+struct Code {
+    std::shared_ptr<Engine> engine;
+    std::vector<SelfCacheEntry> selfcache;
+    uint64_t lastuse = 0;
+    LLLFunction generic = nullptr;
+    std::vector<Clone> clones;
+    std::map<std::vector<int>, int> signatures;
+};
+
+class CodeCache {
+public:
+    // Compiled function and the number of self caches used by it
+    struct Entry {
+        std::shared_ptr<Engine> engine;
+        int selfcaches = 0;
+    };
+
+    // Makes the key of $proto: its bytecode, constants and upvalues (and the
+    // ones of the nested functions) and the settings that change the code
+    static std::string MakeKey(Proto* proto, bool vectorize, bool arrays);
+
+    // Finds the code of $key, returns false if no proto uses it anymore
+    static bool Find(const std::string& key, Entry& entry);
+
+    // Adds the code of $key (it must not retain the IR, since the context
+    // belongs to the state that compiled it)
+    static void Add(const std::string& key, const Entry& entry);
+};
+
+}
+
+#endif
+
@@ -8,11 +8,15 @@
 */
 
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/Passes.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/PassManager.h>
+#include <llvm/Support/Dwarf.h>
 #include <llvm/Support/raw_ostream.h>
-#include <llvm/Support/TargetSelect.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Vectorize.h>
 
 #define LLL_USE_MCJIT
 #ifdef LLL_USE_MCJIT
@@ -22,10 +26,15 @@
 #endif
 
 #include "lllarith.h"
+#include "lllbytecode.h"
 #include "lllcompiler.h"
 #include "lllengine.h"
+#include "lllffi.h"
 #include "llllogical.h"
+#include "lllperf.h"
 #include "lllruntime.h"
+#include "lllstate.h"
+#include "lllstats.h"
 #include "llltableget.h"
 #include "llltableset.h"
 #include "lllvararg.h"
@@ -34,6 +43,7 @@ extern "C" {
 #include "lprefix.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "lllcore.h"
 #include "lopcodes.h"
 #include "ltable.h"
 #include "luaconf.h"
@@ -45,26 +55,34 @@ static const llvm::CodeGenOpt::Level OPT_LEVEL =
         //llvm::CodeGenOpt::Default;
         llvm::CodeGenOpt::Aggressive;
 
+// Static branch weights of the hot and the cold (slow path) successors
+static const uint32_t HOT_WEIGHT = 2000;
+static const uint32_t COLD_WEIGHT = 1;
+
 namespace lll {
 
-Compiler::Compiler(lua_State* L, Proto* proto) :
+Compiler::Compiler(lua_State* L, Proto* proto,
+        const std::vector<int>& signature) :
+    signature_(signature),
     cs_(L, proto),
+    loops_(proto),
+    escape_(proto),
     stack_(cs_),
-    engine_(nullptr) {
-    static bool init = true;
-    if (init) {
-        llvm::InitializeNativeTarget();
-        llvm::InitializeNativeTargetAsmPrinter();
-        llvm::InitializeNativeTargetAsmParser();
-        init = false;
-    }
+    engine_(nullptr),
+    debugscope_(nullptr),
+    state_(State::Get(L)) {
+    Runtime::InitializeTarget();
 }
 
 bool Compiler::Compile() {
-    return CompileInstructions() &&
-           VerifyModule() &&
-           OptimizeModule() &&
-           CreateEngine();
+    bool ok = RunPhase(Stats::BUILD, &Compiler::CompileInstructions) &&
+              RunPhase(Stats::BUILD, &Compiler::PlaceColdBlocks) &&
+              RunPhase(Stats::VERIFY, &Compiler::VerifyModule) &&
+              RunPhase(Stats::OPTIMIZE, &Compiler::OptimizeModule) &&
+              RunPhase(Stats::CODEGEN, &Compiler::CreateEngine);
+    if (!ok)
+        state_.stats_.AddFailure(cs_.proto_);
+    return ok;
 }
 
 const std::string& Compiler::GetErrorMessage() {
@@ -75,14 +93,39 @@ Engine* Compiler::GetEngine() {
     return engine_.release();
 }
 
+int Compiler::GetSelfCaches() {
+    return cs_.selfcaches_;
+}
+
+int Compiler::CountSelfCaches(Proto* proto) {
+    int n = 0;
+    for (int pc = 0; pc < proto->sizecode; ++pc)
+        n += HasSelfCache(proto, proto->code[pc]);
+    return n;
+}
+
+bool Compiler::RunPhase(Stats::Phase phase, bool (Compiler::*step)()) {
+    Stats::Timer timer(state_.stats_, cs_.proto_, phase);
+    return (this->*step)();
+}
+
 bool Compiler::CompileInstructions() {
+    InitDebugInfo();
     cs_.InitEntryBlock();
     stack_.InitValues();
+    InitHoistedLoads();
+    InitArrayLoops();
+    InitVirtualTables();
+    InitIterators();
+    InitSignature();
     cs_.B_.CreateBr(cs_.blocks_[0]);
 
     for (cs_.curr_ = 0; cs_.curr_ < cs_.proto_->sizecode; ++cs_.curr_) {
         cs_.B_.SetInsertPoint(cs_.blocks_[cs_.curr_]);
         cs_.instr_ = cs_.proto_->code[cs_.curr_];
+        SetDebugLocation();
+        EscapeVirtualTables();
+        CompileVirtualAccess();
         //cs_.DebugPrint(luaP_opnames[GET_OPCODE(cs_.instr_)]);
         switch (GET_OPCODE(cs_.instr_)) {
             case OP_MOVE:     CompileMove(); break;
@@ -132,6 +175,309 @@ bool Compiler::CompileInstructions() {
         if (!cs_.blocks_[cs_.curr_]->getTerminator())
             cs_.B_.CreateBr(cs_.blocks_[cs_.curr_ + 1]);
     }
+    if (dibuilder_)
+        dibuilder_->finalize();
+    return true;
+}
+
+void Compiler::InitDebugInfo() {
+    if (!state_.settings_.debuginfo)
+        return;
+
+    // Chunks loaded from files are named @file, the others are strings
+    const char* source = cs_.proto_->source ? getstr(cs_.proto_->source) : "?";
+    std::string filename = (*source == '@' || *source == '=') ?
+            source + 1 : "[string]";
+    cs_.module_->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+            llvm::DEBUG_METADATA_VERSION);
+
+    dibuilder_.reset(new llvm::DIBuilder(*cs_.module_));
+    auto unit = dibuilder_->createCompileUnit(llvm::dwarf::DW_LANG_C,
+            filename, ".", "LLL", true, "", 0);
+    auto file = dibuilder_->createFile(filename, ".");
+    auto type = dibuilder_->createSubroutineType(file,
+            dibuilder_->getOrCreateArray(llvm::ArrayRef<llvm::Value*>()));
+    int line = cs_.proto_->linedefined;
+    auto subprogram = dibuilder_->createFunction(unit,
+            PerfListener::GetName(cs_.proto_), cs_.function_->getName(), file,
+            line, type, false, true, line, 0, true, cs_.function_);
+    debugscope_ = subprogram;
+    cs_.B_.SetCurrentDebugLocation(llvm::DebugLoc::get(line, 0, debugscope_));
+}
+
+void Compiler::SetDebugLocation() {
+    if (!dibuilder_ || !cs_.proto_->lineinfo)
+        return;
+    int line = cs_.proto_->lineinfo[cs_.curr_];
+    cs_.B_.SetCurrentDebugLocation(llvm::DebugLoc::get(line, 0, debugscope_));
+}
+
+void Compiler::InitHoistedLoads() {
+    auto ttvalue = cs_.rt_.GetType("TValue");
+    auto tvaluet = static_cast<llvm::PointerType*>(ttvalue)->getElementType();
+    auto flagt = cs_.rt_.MakeIntT(1);
+    for (int pc = 0; pc < cs_.proto_->sizecode; ++pc) {
+        switch (GET_OPCODE(cs_.proto_->code[pc])) {
+            case OP_GETTABLE: case OP_GETTABUP: {
+                int loop = loops_.GetHoistingLoop(pc);
+                if (loop == -1)
+                    break;
+                CompilerState::HoistedLoad h;
+                h.prep = loops_.Get(loop).prep;
+                h.valid = cs_.B_.CreateAlloca(flagt, nullptr, "hoisted.valid");
+                h.tvalue = cs_.B_.CreateAlloca(tvaluet, nullptr, "hoisted");
+                cs_.B_.CreateStore(cs_.MakeInt(0, flagt), h.valid);
+                cs_.hoisted_[pc] = h;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+CompilerState::HoistedLoad* Compiler::GetHoistedLoad() {
+    auto h = cs_.hoisted_.find(cs_.curr_);
+    return h != cs_.hoisted_.end() ? &h->second : nullptr;
+}
+
+void Compiler::InitArrayLoops() {
+    if (!state_.settings_.vectorize)
+        return;
+    auto flagt = cs_.rt_.MakeIntT(1);
+    for (int pc = 0; pc < cs_.proto_->sizecode; ++pc) {
+        int loop = loops_.GetArrayLoop(pc);
+        if (loop == -1 || cs_.arrayloops_.count(loops_.Get(loop).prep))
+            continue;
+        CompilerState::ArrayLoop l;
+        l.tables = loops_.GetArrayTables(loop);
+        l.inrange = cs_.B_.CreateAlloca(flagt, nullptr, "inrange");
+        cs_.B_.CreateStore(cs_.MakeInt(0, flagt), l.inrange);
+        cs_.arrayloops_[loops_.Get(loop).prep] = l;
+    }
+}
+
+llvm::Value* Compiler::GetArrayInRange() {
+    int loop = loops_.GetArrayLoop(cs_.curr_);
+    if (loop == -1)
+        return nullptr;
+    auto l = cs_.arrayloops_.find(loops_.Get(loop).prep);
+    return l != cs_.arrayloops_.end() ? l->second.inrange : nullptr;
+}
+
+void Compiler::InitVirtualTables() {
+    auto ttvalue = cs_.rt_.GetType("TValue");
+    auto tvaluet = static_cast<llvm::PointerType*>(ttvalue)->getElementType();
+    auto flagt = cs_.rt_.MakeIntT(1);
+    for (int pc = 0; pc < cs_.proto_->sizecode; ++pc) {
+        auto vt = escape_.GetVirtualTable(pc);
+        if (!vt)
+            continue;
+        CompilerState::VirtualTable v;
+        v.materialized = cs_.B_.CreateAlloca(flagt, nullptr, "materialized");
+        for (size_t f = 0; f < vt->keys.size(); ++f)
+            v.fields.push_back(cs_.B_.CreateAlloca(tvaluet, nullptr, "field"));
+        cs_.virtualtables_[pc] = v;
+    }
+}
+
+void Compiler::InitSignature() {
+    if (signature_.empty())
+        return;
+
+    // A clone may be the entry of the proto, so the calls with other tags go
+    // to the dispatch of the clones
+    auto tagged = cs_.CreateSubBlock("tagged", cs_.entry_);
+    auto dispatch = cs_.CreateColdBlock("dispatch", tagged);
+    llvm::Value* match = cs_.B_.getTrue();
+    for (size_t i = 0; i < signature_.size(); ++i)
+        match = cs_.B_.CreateAnd(match, stack_.GetR(i).HasTag(signature_[i]));
+    cs_.B_.CreateCondBr(match, tagged, dispatch);
+
+    cs_.B_.SetInsertPoint(dispatch);
+    auto ftype = llvm::PointerType::get(cs_.function_->getFunctionType(), 0);
+    auto f = cs_.InjectPointer(ftype,
+            reinterpret_cast<void*>(LLLDispatchClone));
+    cs_.B_.CreateRet(cs_.B_.CreateCall(f,
+            {cs_.values_.state, cs_.values_.closure}));
+
+    cs_.B_.SetInsertPoint(tagged);
+    for (size_t i = 0; i < signature_.size(); ++i)
+        stack_.GetR(i).SetTagK(signature_[i]);
+}
+
+void Compiler::InitIterators() {
+    auto tint = cs_.rt_.MakeIntT(sizeof(int));
+    for (int pc = 0; pc < cs_.proto_->sizecode; ++pc) {
+        if (GET_OPCODE(cs_.proto_->code[pc]) != OP_TFORCALL)
+            continue;
+        auto cursor = cs_.B_.CreateAlloca(tint, nullptr, "cursor");
+        cs_.B_.CreateStore(cs_.MakeInt(0), cursor);
+        cs_.cursors_[pc] = cursor;
+    }
+}
+
+void Compiler::EscapeVirtualTables() {
+    for (auto vt : escape_.GetEscapes(cs_.curr_)) {
+        auto& v = cs_.virtualtables_[vt->newtable];
+        auto entry = cs_.blocks_[cs_.curr_];
+        auto materialize = cs_.CreateSubBlock("materialize", entry);
+        auto escaped = cs_.CreateSubBlock("escaped", materialize);
+
+        cs_.B_.SetInsertPoint(entry);
+        auto materialized = cs_.B_.CreateLoad(v.materialized);
+        cs_.B_.CreateCondBr(cs_.ToBool(materialized), escaped, materialize);
+
+        cs_.B_.SetInsertPoint(materialize);
+        MaterializeTable(*vt);
+        cs_.B_.CreateBr(escaped);
+
+        // The instruction is compiled after the table creation
+        cs_.blocks_[cs_.curr_] = escaped;
+        cs_.B_.SetInsertPoint(escaped);
+    }
+}
+
+void Compiler::CompileVirtualAccess() {
+    const Escape::Use* use = nullptr;
+    auto vt = escape_.GetVirtualTableUse(cs_.curr_, &use);
+    if (!vt)
+        return;
+    auto& v = cs_.virtualtables_[vt->newtable];
+    auto entry = cs_.blocks_[cs_.curr_];
+    auto virtualaccess = cs_.CreateSubBlock("virtual", entry);
+    auto realaccess = cs_.CreateSubBlock("real", virtualaccess);
+    auto exit = cs_.blocks_[cs_.curr_ + 1];
+
+    cs_.B_.SetInsertPoint(entry);
+    auto materialized = cs_.B_.CreateLoad(v.materialized);
+    cs_.B_.CreateCondBr(cs_.ToBool(materialized), realaccess, virtualaccess);
+
+    cs_.B_.SetInsertPoint(virtualaccess);
+    if (GET_OPCODE(cs_.instr_) == OP_GETTABLE) {
+        RTRegister field(cs_, v.fields[use->fields[0]]);
+        stack_.GetR(GETARG_A(cs_.instr_)).Assign(field);
+        cs_.B_.CreateBr(exit);
+    } else {
+        // The fields can't hold collectable values from registers because
+        // they aren't traversed by the gc, so the real table is created
+        // (constants are kept alive by the proto)
+        std::vector<Value*> values;
+        std::vector<Value*> checkvalues;
+        if (GET_OPCODE(cs_.instr_) == OP_SETTABLE) {
+            int c = GETARG_C(cs_.instr_);
+            values.push_back(&stack_.GetRK(c));
+            if (!ISK(c))
+                checkvalues.push_back(values.back());
+        } else {
+            for (size_t j = 1; j <= use->fields.size(); ++j)
+                values.push_back(&stack_.GetR(GETARG_A(cs_.instr_) + j));
+            checkvalues = values;
+        }
+        auto setfields = cs_.CreateSubBlock("setfields", virtualaccess);
+        if (checkvalues.empty()) {
+            cs_.B_.CreateBr(setfields);
+        } else {
+            auto materialize = cs_.CreateColdBlock("materialize", setfields);
+            auto collectablebit = cs_.MakeInt(BIT_ISCOLLECTABLE);
+            llvm::Value* iscoll = nullptr;
+            for (auto value : checkvalues) {
+                auto c = cs_.B_.CreateAnd(value->GetTag(), collectablebit);
+                iscoll = iscoll ? cs_.B_.CreateOr(iscoll, c) : c;
+            }
+            cs_.B_.CreateCondBr(cs_.ToBool(iscoll), materialize, setfields);
+
+            cs_.B_.SetInsertPoint(materialize);
+            MaterializeTable(*vt);
+            cs_.B_.CreateBr(realaccess);
+        }
+
+        cs_.B_.SetInsertPoint(setfields);
+        for (size_t j = 0; j < values.size(); ++j) {
+            RTRegister field(cs_, v.fields[use->fields[j]]);
+            field.Assign(*values[j]);
+        }
+        cs_.B_.CreateBr(exit);
+    }
+
+    // The instruction is compiled as usual for the real table
+    cs_.blocks_[cs_.curr_] = realaccess;
+    cs_.B_.SetInsertPoint(realaccess);
+}
+
+void Compiler::MaterializeTable(const Escape::VirtualTable& vt) {
+    auto& v = cs_.virtualtables_[vt.newtable];
+    auto newtable = cs_.proto_->code[vt.newtable];
+    auto& ra = stack_.GetR(vt.reg);
+    auto table = CreateTable(ra, GETARG_B(newtable), GETARG_C(newtable));
+
+    // Nil fields aren't stored in the table
+    for (size_t f = 0; f < vt.keys.size(); ++f) {
+        auto& key = vt.keys[f];
+        auto setfield = cs_.CreateSubBlock("setfield",
+                cs_.B_.GetInsertBlock());
+        auto nextfield = cs_.CreateSubBlock("nextfield", setfield);
+        RTRegister field(cs_, v.fields[f]);
+        cs_.B_.CreateCondBr(field.HasTag(LUA_TNIL), nextfield, setfield);
+
+        cs_.B_.SetInsertPoint(setfield);
+        if (key.isint) {
+            auto tluainteger = cs_.rt_.GetType("lua_Integer");
+            auto args = {
+                cs_.values_.state,
+                table,
+                cs_.MakeInt(key.i, tluainteger),
+                field.GetTValue()
+            };
+            cs_.CreateCall("luaH_setint", args);
+        } else {
+            auto args = {
+                cs_.values_.state,
+                table,
+                stack_.GetK(key.k).GetTValue()
+            };
+            RTRegister slot(cs_, cs_.CreateCall("luaH_set", args, "slot"));
+            slot.Assign(field);
+        }
+        cs_.B_.CreateBr(nextfield);
+        cs_.B_.SetInsertPoint(nextfield);
+    }
+
+    // The gc step is left to the next check, since the registers above the
+    // table may still be alive
+    cs_.B_.CreateStore(cs_.MakeInt(1, cs_.rt_.MakeIntT(1)), v.materialized);
+}
+
+bool Compiler::PlaceColdBlocks() {
+    auto IsCold = [&](llvm::BasicBlock* block) {
+        return cs_.coldblocks_.count(block) != 0;
+    };
+
+    llvm::MDBuilder mdbuilder(cs_.context_);
+    std::vector<llvm::BasicBlock*> coldblocks;
+    for (auto& block : *cs_.function_) {
+        if (IsCold(&block))
+            coldblocks.push_back(&block);
+
+        auto terminator = block.getTerminator();
+        if (!terminator)
+            continue;
+        std::vector<uint32_t> weights;
+        bool hascold = false;
+        for (unsigned i = 0; i < terminator->getNumSuccessors(); ++i) {
+            bool cold = IsCold(terminator->getSuccessor(i));
+            weights.push_back(cold ? COLD_WEIGHT : HOT_WEIGHT);
+            hascold = hascold || cold;
+        }
+        if (hascold && weights.size() > 1 &&
+            (llvm::isa<llvm::BranchInst>(terminator) ||
+             llvm::isa<llvm::SwitchInst>(terminator)))
+            terminator->setMetadata(llvm::LLVMContext::MD_prof,
+                    mdbuilder.createBranchWeights(weights));
+    }
+
+    for (auto block : coldblocks)
+        block->moveAfter(&cs_.function_->back());
     return true;
 }
 
@@ -146,9 +492,28 @@ bool Compiler::VerifyModule() {
 
 bool Compiler::OptimizeModule() {
     llvm::FunctionPassManager fpm(cs_.module_.get());
-    fpm.add(llvm::createGVNPass()); // required by SCCP Pass
+    if (!signature_.empty())
+        fpm.add(llvm::createBasicAliasAnalysisPass());
+
+    // The empty blocks (one per instruction and sub-block) are removed and
+    // the allocas are promoted first, so GVN works on a smaller SSA function
+    fpm.add(llvm::createCFGSimplificationPass());
     fpm.add(llvm::createPromoteMemoryToRegisterPass());
+    fpm.add(llvm::createGVNPass()); // required by SCCP Pass
     fpm.add(llvm::createSCCPPass());
+    if (!signature_.empty())
+        fpm.add(llvm::createCFGSimplificationPass());
+    if (state_.settings_.vectorize) {
+        // The bound checks of the array loops are unswitched out of the loops
+        fpm.add(llvm::createCFGSimplificationPass());
+        fpm.add(llvm::createLoopRotatePass());
+        fpm.add(llvm::createLICMPass());
+        fpm.add(llvm::createLoopUnswitchPass());
+        fpm.add(llvm::createIndVarSimplifyPass());
+        fpm.add(llvm::createLoopVectorizePass());
+        fpm.add(llvm::createSLPVectorizerPass());
+        fpm.add(llvm::createInstructionCombiningPass());
+    }
     fpm.add(llvm::createAggressiveDCEPass());
     fpm.run(*cs_.function_);
     return true;
@@ -156,20 +521,53 @@ bool Compiler::OptimizeModule() {
 
 bool Compiler::CreateEngine() {
     auto module = cs_.module_.get();
+    auto irsize = Stats::CountInstructions(module);
+#ifdef LLL_USE_MCJIT
+    // The native code is kept by the Engine, so it outlives the MCJIT engine
+    std::unique_ptr<llvm::SectionMemoryManager> memory(
+            new llvm::SectionMemoryManager());
+#else
+    std::unique_ptr<llvm::SectionMemoryManager> memory;
+#endif
     auto engine = llvm::EngineBuilder(cs_.module_.release())
             .setErrorStr(&error_)
             .setOptLevel(OPT_LEVEL)
             .setEngineKind(llvm::EngineKind::JIT)
 #ifdef LLL_USE_MCJIT
             .setUseMCJIT(true)
+            .setMCJITMemoryManager(Engine::CreateMemoryManager(*memory))
 #else
             .setUseMCJIT(false)
 #endif
             .create();
 
     if (engine) {
+        // The object is emitted (and announced to perf) by finalizeObject
+        // The lines are published for the profiler only with debug info
+        auto& settings = state_.settings_;
+        PerfListener perf(PerfListener::GetName(cs_.proto_),
+                settings.debuginfo ? cs_.proto_ : nullptr);
+        Stats::Listener stats;
+        bool announce = PerfListener::IsEnabled() || settings.debuginfo;
+        if (announce)
+            engine->RegisterJITEventListener(&perf);
+        engine->RegisterJITEventListener(&stats);
         engine->finalizeObject();
-        engine_.reset(new Engine(engine, module, cs_.function_));
+        engine->UnregisterJITEventListener(&stats);
+        if (announce)
+            engine->UnregisterJITEventListener(&perf);
+        engine_.reset(new Engine(engine, module, cs_.function_,
+                memory.release()));
+        engine_->SetCodeSize(stats.GetCodeSize());
+
+        // The debug info registered with GDB is freed with the engine
+        if (!settings.retainir && !settings.debuginfo)
+            engine_->ReleaseIR();
+        if (signature_.empty())
+            state_.stats_.AddCompiled(cs_.proto_, stats.GetCodeSize(),
+                    engine_->HasIR() ? irsize : 0);
+        else
+            state_.stats_.AddClone(cs_.proto_, stats.GetCodeSize());
         return true;
     } else {
         return false;
@@ -216,14 +614,15 @@ void Compiler::CompileGettabup() {
     auto& table = stack_.GetUp(GETARG_B(cs_.instr_));
     auto& key = stack_.GetRK(GETARG_C(cs_.instr_));
     auto& dest = stack_.GetR(GETARG_A(cs_.instr_));
-    TableGet(cs_, stack_, table, key, dest).Compile();
+    TableGet(cs_, stack_, table, key, dest, GetHoistedLoad()).Compile();
 }
 
 void Compiler::CompileGettable() {
     auto& table = stack_.GetR(GETARG_B(cs_.instr_));
     auto& key = stack_.GetRK(GETARG_C(cs_.instr_));
     auto& dest = stack_.GetR(GETARG_A(cs_.instr_));
-    TableGet(cs_, stack_, table, key, dest).Compile();
+    TableGet(cs_, stack_, table, key, dest, GetHoistedLoad(),
+            GetArrayInRange()).Compile();
 }
 
 void Compiler::CompileSettabup() {
@@ -244,14 +643,33 @@ void Compiler::CompileSettable() {
     auto& table = stack_.GetR(GETARG_A(cs_.instr_));
     auto& key = stack_.GetRK(GETARG_B(cs_.instr_));
     auto& value = stack_.GetRK(GETARG_C(cs_.instr_));
-    TableSet(cs_, stack_, table, key, value).Compile();
+    TableSet(cs_, stack_, table, key, value, GetArrayInRange()).Compile();
 }
 
 void Compiler::CompileNewtable() {
     int a = GETARG_A(cs_.instr_);
-    int b = GETARG_B(cs_.instr_);
-    int c = GETARG_C(cs_.instr_);
+
+    // Tables that are never used aren't created
+    if (!escape_.IsLive(cs_.curr_ + 1, a))
+        return;
+
+    // Virtual tables start with nil fields
+    auto v = cs_.virtualtables_.find(cs_.curr_);
+    if (v != cs_.virtualtables_.end()) {
+        auto flagt = cs_.rt_.MakeIntT(1);
+        cs_.B_.CreateStore(cs_.MakeInt(0, flagt), v->second.materialized);
+        for (auto field : v->second.fields)
+            RTRegister(cs_, field).SetTagK(LUA_TNIL);
+        return;
+    }
+
     auto& ra = stack_.GetR(a);
+    CreateTable(ra, GETARG_B(cs_.instr_), GETARG_C(cs_.instr_));
+    auto& ra1 = stack_.GetR(a + 1);
+    CompileCheckcg(ra1.GetTValue());
+}
+
+llvm::Value* Compiler::CreateTable(Register& ra, int b, int c) {
     auto args = {cs_.values_.state, ra.GetTValue()};
     auto table = cs_.CreateCall("lll_newtable", args);
     if (b != 0 || c != 0) {
@@ -263,8 +681,7 @@ void Compiler::CompileNewtable() {
         };
         cs_.CreateCall("luaH_resize", args);
     }
-    auto& ra1 = stack_.GetR(a + 1);
-    CompileCheckcg(ra1.GetTValue());
+    return table;
 }
 
 void Compiler::CompileSelf() {
@@ -273,16 +690,29 @@ void Compiler::CompileSelf() {
     auto& methodslot = stack_.GetR(GETARG_A(cs_.instr_));
     auto& selfslot = stack_.GetR(GETARG_A(cs_.instr_) + 1);
     selfslot.Assign(table);
-    TableGet(cs_, stack_, table, key, methodslot).Compile();
+    TableGet(cs_, stack_, table, key, methodslot, nullptr, nullptr,
+            CreateSelfCache()).Compile();
+}
+
+llvm::Value* Compiler::CreateSelfCache() {
+    if (!HasSelfCache(cs_.proto_, cs_.instr_))
+        return nullptr;
+    return cs_.NewSelfCache();
+}
+
+bool Compiler::HasSelfCache(Proto* proto, Instruction i) {
+    int c = GETARG_C(i);
+    return GET_OPCODE(i) == OP_SELF && ISK(c) &&
+           ttisshrstring(&proto->k[INDEXK(c)]);
 }
 
 void Compiler::CompileUnm() {
     auto entry = cs_.blocks_[cs_.curr_];
     auto checkfloat = cs_.CreateSubBlock("isfloat", entry);
-    auto convert = cs_.CreateSubBlock("convert", checkfloat);
+    auto convert = cs_.CreateColdBlock("convert", checkfloat);
     auto intop = cs_.CreateSubBlock("intop", convert);
     auto floatop = cs_.CreateSubBlock("floatop", intop);
-    auto tmop = cs_.CreateSubBlock("tmop", floatop);
+    auto tmop = cs_.CreateColdBlock("tmop", floatop);
     auto exit = cs_.blocks_[cs_.curr_ + 1];
 
     cs_.B_.SetInsertPoint(entry);
@@ -333,9 +763,9 @@ void Compiler::CompileUnm() {
 
 void Compiler::CompileBNot() {
     auto entry = cs_.blocks_[cs_.curr_];
-    auto convert = cs_.CreateSubBlock("convert", entry);
+    auto convert = cs_.CreateColdBlock("convert", entry);
     auto intop = cs_.CreateSubBlock("intop", convert);
-    auto tmop = cs_.CreateSubBlock("tmtop", intop);
+    auto tmop = cs_.CreateColdBlock("tmtop", intop);
     auto exit = cs_.blocks_[cs_.curr_ + 1];
 
     cs_.B_.SetInsertPoint(entry);
@@ -543,24 +973,418 @@ void Compiler::CompileTestset() {
 void Compiler::CompileCall() {
     int a = GETARG_A(cs_.instr_);
     int b = GETARG_B(cs_.instr_);
+    int c = GETARG_C(cs_.instr_);
+    auto function = GetUpvalueFunction(a);
+    if (b == 2 && c == 2 &&
+        (function == math_floor || function == math_sqrt)) {
+        CompileMathCall(function);
+        return;
+    }
+    auto ffi = function ? FFI::Find(function) : nullptr;
+    if (ffi && b - 1 == static_cast<int>(ffi->args.size()) &&
+        (c == 1 || c == 2) && ffi->ret != FFI::STRING) {
+        CompileFFICall(*ffi);
+        return;
+    }
     if (b != 0)
         cs_.SetTop(a + b);
     auto& ra = stack_.GetR(a);
-    auto args = {
-        cs_.values_.state,
-        ra.GetTValue(),
-        cs_.MakeInt(GETARG_C(cs_.instr_) - 1)
-    };
+    auto nresults = cs_.MakeInt(c - 1);
+    auto entry = cs_.blocks_[cs_.curr_];
+    auto checkc = cs_.CreateSubBlock("checkc", entry);
+    auto lcf = cs_.CreateSubBlock("lcf", checkc);
+    auto ccl = cs_.CreateSubBlock("ccl", lcf);
+    auto ccall = cs_.CreateSubBlock("ccall", ccl);
+    auto call = cs_.CreateSubBlock("call", ccall);
+    auto done = cs_.CreateSubBlock("done", call);
+
+    // A call to the running closure calls this function directly (a clone
+    // goes through the dispatch, since the arguments may have other tags)
+    cs_.B_.SetInsertPoint(entry);
+    if (cs_.proto_->is_vararg || !signature_.empty()) {
+        cs_.B_.CreateBr(checkc);
+    } else {
+        auto selfcall = cs_.CreateSubBlock("selfcall", entry);
+        cs_.B_.CreateCondBr(IsSelfCall(ra), selfcall, checkc);
+
+        cs_.B_.SetInsertPoint(selfcall);
+        auto ci = cs_.CreateCall("luaD_selfprecall",
+                {cs_.values_.state, ra.GetTValue(), nresults}, "ci");
+        auto n = cs_.B_.CreateCall(cs_.function_,
+                {cs_.values_.state, cs_.values_.closure}, "n");
+        cs_.CreateCall("luaD_selfposcall", {cs_.values_.state, ci, n});
+        cs_.B_.CreateBr(done);
+    }
+
+    // C functions are called directly
+    cs_.B_.SetInsertPoint(checkc);
+    auto s = cs_.B_.CreateSwitch(ra.GetTag(), call, 2);
+    s->addCase(static_cast<llvm::ConstantInt*>(cs_.MakeInt(LUA_TLCF)), lcf);
+    s->addCase(static_cast<llvm::ConstantInt*>(cs_.MakeInt(ctb(LUA_TCCL))),
+            ccl);
+
+    auto tcfunction = llvm::PointerType::get(llvm::FunctionType::get(
+            cs_.rt_.MakeIntT(sizeof(int)), {cs_.rt_.GetType("lua_State")},
+            false), 0);
+    cs_.B_.SetInsertPoint(lcf);
+    auto lcfunction = cs_.LoadField(ra.GetTValue(), tcfunction,
+            offsetof(TValue, value_), "lcfunction");
+    cs_.B_.CreateBr(ccall);
+
+    cs_.B_.SetInsertPoint(ccl);
+    auto cclosure = cs_.LoadField(ra.GetTValue(), cs_.rt_.GetType("GCObject"),
+            offsetof(TValue, value_), "cclosure");
+    auto cclfunction = cs_.LoadField(cclosure, tcfunction,
+            offsetof(CClosure, f), "cclfunction");
+    cs_.B_.CreateBr(ccall);
+
+    cs_.B_.SetInsertPoint(ccall);
+    auto cfunction = cs_.B_.CreatePHI(tcfunction, 2, "cfunction");
+    cfunction->addIncoming(lcfunction, lcf);
+    cfunction->addIncoming(cclfunction, ccl);
+    CompileCCall(cfunction);
+    cs_.B_.CreateBr(done);
+
+    cs_.B_.SetInsertPoint(call);
+    auto args = {cs_.values_.state, ra.GetTValue(), nresults};
+    cs_.CreateCall("luaD_callnoyield", args);
+    cs_.B_.CreateBr(done);
+
+    cs_.B_.SetInsertPoint(done);
+    stack_.Update();
+    cs_.B_.CreateBr(cs_.blocks_[cs_.curr_ + 1]);
+}
+
+void Compiler::CompileCCall(llvm::Value* cfunction) {
+    int a = GETARG_A(cs_.instr_);
+    int c = GETARG_C(cs_.instr_);
+    auto& ra = stack_.GetR(a);
+    auto ci = cs_.CreateCall("luaD_cprecall",
+            {cs_.values_.state, ra.GetTValue(), cs_.MakeInt(c - 1)}, "ci");
+    auto n = cs_.B_.CreateCall(cfunction, {cs_.values_.state}, "n");
+    if (c == 0) {
+        cs_.CreateCall("luaD_cposcall", {cs_.values_.state, ci, n});
+        return;
+    }
+
+    // The hooks are called by luaD_poscall
+    auto poscall = cs_.CreateColdBlock("poscall");
+    auto moveresults = cs_.CreateSubBlock("moveresults", poscall);
+    auto end = cs_.CreateSubBlock("ccallend", moveresults);
+    auto hookmask = cs_.LoadField(cs_.values_.state,
+            cs_.rt_.MakeIntT(sizeof(lu_byte)), offsetof(lua_State, hookmask),
+            "hookmask");
+    auto hooks = cs_.B_.CreateAnd(hookmask, cs_.MakeInt(
+            LUA_MASKRET | LUA_MASKLINE, hookmask->getType()));
+    cs_.B_.CreateCondBr(cs_.ToBool(hooks), poscall, moveresults);
+
+    cs_.B_.SetInsertPoint(poscall);
+    cs_.CreateCall("luaD_cposcall", {cs_.values_.state, ci, n});
+    cs_.B_.CreateBr(end);
+
+    // Moves the results to R(A)..R(A+C-2), missing ones are nil
+    cs_.B_.SetInsertPoint(moveresults);
+    stack_.Update();
+    auto ttvalue = cs_.rt_.GetType("TValue");
+    auto top = cs_.LoadField(cs_.values_.state, ttvalue,
+            offsetof(lua_State, top), "top");
+    auto first = cs_.B_.CreateGEP(top, cs_.B_.CreateNeg(n), "first");
+    auto nilobject = cs_.GetNilObject();
+    for (int i = 0; i < c - 1; ++i) {
+        auto hasresult = cs_.B_.CreateICmpSLT(cs_.MakeInt(i), n);
+        auto result = cs_.B_.CreateGEP(first, cs_.MakeInt(i));
+        RTRegister src(cs_, cs_.B_.CreateSelect(hasresult, result, nilobject));
+        stack_.GetR(a + i).Assign(src);
+    }
+    cs_.SetField(cs_.values_.state, cs_.values_.ci, offsetof(lua_State, ci),
+            "ci");
+    cs_.SetTop(a + c - 1);
+    auto tcount = cs_.rt_.MakeIntT(sizeof(unsigned short));
+    for (auto offset : {offsetof(lua_State, nCcalls), offsetof(lua_State, nny)}) {
+        auto count = cs_.LoadField(cs_.values_.state, tcount, offset, "count");
+        auto decremented = cs_.B_.CreateSub(count, cs_.MakeInt(1, tcount));
+        cs_.SetField(cs_.values_.state, decremented, offset, "count");
+    }
+    cs_.B_.CreateBr(end);
+
+    cs_.B_.SetInsertPoint(end);
+}
+
+llvm::Value* Compiler::IsSelfCall(Register& ra) {
+    auto entry = cs_.B_.GetInsertBlock();
+    auto checkclosure = cs_.CreateSubBlock("checkclosure", entry);
+    auto result = cs_.CreateSubBlock("isself", checkclosure);
+    auto isclosure = ra.HasTag(ctb(LUA_TLCL));
+    cs_.B_.CreateCondBr(isclosure, checkclosure, result);
+
+    cs_.B_.SetInsertPoint(checkclosure);
+    auto closure = cs_.B_.CreateBitCast(ra.GetGCValue(),
+            cs_.values_.closure->getType());
+    auto issame = cs_.B_.CreateICmpEQ(closure, cs_.values_.closure);
+    cs_.B_.CreateBr(result);
+
+    cs_.B_.SetInsertPoint(result);
+    auto phi = cs_.B_.CreatePHI(issame->getType(), 2, "is.self");
+    phi->addIncoming(cs_.B_.getFalse(), entry);
+    phi->addIncoming(issame, checkclosure);
+    return phi;
+}
+
+lua_CFunction Compiler::GetUpvalueFunction(int reg) {
+    // The values are taken from the last closure created for the proto, the
+    // call site must still guard the callee
+    LClosure* cl = cs_.proto_->cache;
+    if (!cl)
+        return nullptr;
+    for (int pc = cs_.curr_ - 1; pc >= 0; --pc) {
+        auto successors = Bytecode::GetSuccessors(cs_.proto_, pc);
+        if (successors.size() != 1 || successors[0] != pc + 1)
+            return nullptr;
+        if (!Bytecode::WritesRegister(cs_.proto_, pc, reg))
+            continue;
+        Instruction i = cs_.proto_->code[pc];
+        int u = GETARG_B(i);
+        if (GET_OPCODE(i) != OP_GETUPVAL || !cs_.proto_->upvalues[u].readonly)
+            return nullptr;
+        TValue* v = cl->upvals[u]->v;
+        return ttislcf(v) ? fvalue(v) : nullptr;
+    }
+    return nullptr;
+}
+
+void Compiler::CompileMathCall(lua_CFunction function) {
+    int a = GETARG_A(cs_.instr_);
+    auto& ra = stack_.GetR(a);
+    auto& arg = stack_.GetR(a + 1);
+    auto entry = cs_.blocks_[cs_.curr_];
+    auto checkfunction = cs_.CreateSubBlock("checkfunction", entry);
+    auto checkint = cs_.CreateSubBlock("checkint", checkfunction);
+    auto intarg = cs_.CreateSubBlock("intarg", checkint);
+    auto floatarg = cs_.CreateSubBlock("floatarg", intarg);
+    auto call = cs_.CreateColdBlock("call", floatarg);
+    auto exit = cs_.blocks_[cs_.curr_ + 1];
+    auto tluanumber = cs_.rt_.GetType("lua_Number");
+
+    // The callee must still be the builtin function
+    cs_.B_.SetInsertPoint(entry);
+    cs_.B_.CreateCondBr(ra.HasTag(LUA_TLCF), checkfunction, call);
+
+    cs_.B_.SetInsertPoint(checkfunction);
+    auto tfunction = cs_.rt_.MakeIntT(sizeof(lua_CFunction));
+    auto callee = cs_.LoadField(ra.GetTValue(), tfunction,
+            offsetof(TValue, value_), "callee");
+    auto expected = cs_.MakeInt(reinterpret_cast<uintptr_t>(function),
+            tfunction);
+    auto isexpected = cs_.B_.CreateICmpEQ(callee, expected, "is.expected");
+    cs_.B_.CreateCondBr(isexpected, checkint, call);
+
+    cs_.B_.SetInsertPoint(checkint);
+    auto isfloat = cs_.CreateSubBlock("isfloat", checkint);
+    cs_.B_.CreateCondBr(arg.HasTag(LUA_TNUMINT), intarg, isfloat);
+    cs_.B_.SetInsertPoint(isfloat);
+    cs_.B_.CreateCondBr(arg.HasTag(LUA_TNUMFLT), floatarg, call);
+
+    // An integer is its own floor
+    cs_.B_.SetInsertPoint(intarg);
+    if (function == math_floor) {
+        ra.SetInteger(arg.GetInteger());
+    } else {
+        auto x = cs_.B_.CreateSIToFP(arg.GetInteger(), tluanumber);
+        ra.SetFloat(cs_.CreateCall(STRINGFY2(l_mathop(sqrt)), {x}, "sqrt"));
+    }
+    cs_.B_.CreateBr(exit);
+
+    cs_.B_.SetInsertPoint(floatarg);
+    if (function == math_floor) {
+        // The result is an integer when it fits (lua_numbertointeger)
+        auto tointeger = cs_.CreateSubBlock("tointeger", floatarg);
+        auto keepfloat = cs_.CreateSubBlock("keepfloat", tointeger);
+        auto floor = cs_.CreateCall(STRINGFY2(l_mathop(floor)),
+                {arg.GetFloat()}, "floor");
+        auto min = llvm::ConstantFP::get(tluanumber,
+                cast_num(LUA_MININTEGER));
+        auto max = llvm::ConstantFP::get(tluanumber,
+                -cast_num(LUA_MININTEGER));
+        auto fits = cs_.B_.CreateAnd(cs_.B_.CreateFCmpOGE(floor, min),
+                cs_.B_.CreateFCmpOLT(floor, max), "fits");
+        cs_.B_.CreateCondBr(fits, tointeger, keepfloat);
+
+        cs_.B_.SetInsertPoint(tointeger);
+        auto tluainteger = cs_.rt_.GetType("lua_Integer");
+        ra.SetInteger(cs_.B_.CreateFPToSI(floor, tluainteger));
+        cs_.B_.CreateBr(exit);
+
+        cs_.B_.SetInsertPoint(keepfloat);
+        ra.SetFloat(floor);
+    } else {
+        ra.SetFloat(cs_.CreateCall(STRINGFY2(l_mathop(sqrt)),
+                {arg.GetFloat()}, "sqrt"));
+    }
+    cs_.B_.CreateBr(exit);
+
+    // Regular call
+    cs_.B_.SetInsertPoint(call);
+    cs_.SetTop(a + 2);
+    auto args = {cs_.values_.state, ra.GetTValue(), cs_.MakeInt(1)};
     cs_.CreateCall("luaD_callnoyield", args);
     stack_.Update();
+    cs_.B_.CreateBr(exit);
+}
+
+void Compiler::CompileFFICall(const FFI::Function& ffi) {
+    int a = GETARG_A(cs_.instr_);
+    int c = GETARG_C(cs_.instr_);
+    auto& ra = stack_.GetR(a);
+    auto entry = cs_.blocks_[cs_.curr_];
+    auto checkfunction = cs_.CreateSubBlock("checkfunction", entry);
+    auto unbox = cs_.CreateSubBlock("unbox", checkfunction);
+    auto call = cs_.CreateColdBlock("call", unbox);
+    auto exit = cs_.blocks_[cs_.curr_ + 1];
+
+    // The callee must still be the thunk of the declaration
+    cs_.B_.SetInsertPoint(entry);
+    cs_.B_.CreateCondBr(ra.HasTag(LUA_TLCF), checkfunction, call);
+
+    cs_.B_.SetInsertPoint(checkfunction);
+    auto tfunction = cs_.rt_.MakeIntT(sizeof(lua_CFunction));
+    auto callee = cs_.LoadField(ra.GetTValue(), tfunction,
+            offsetof(TValue, value_), "callee");
+    auto expected = cs_.MakeInt(reinterpret_cast<uintptr_t>(ffi.thunk),
+            tfunction);
+    auto isexpected = cs_.B_.CreateICmpEQ(callee, expected, "is.expected");
+    cs_.B_.CreateCondBr(isexpected, unbox, call);
+
+    // Arguments of unexpected types are converted (or rejected) by the thunk
+    cs_.B_.SetInsertPoint(unbox);
+    std::vector<llvm::Value*> args;
+    for (size_t i = 0; i < ffi.args.size(); ++i) {
+        auto& arg = stack_.GetR(a + 1 + i);
+        args.push_back(UnboxFFIArgument(arg, ffi.args[i], call));
+    }
+
+    auto function = cs_.InjectPointer(
+            llvm::PointerType::get(FFI::GetLLVMFunctionType(cs_.rt_, ffi), 0),
+            ffi.address);
+    auto result = cs_.B_.CreateCall(function, args);
+    if (c == 2) {
+        switch (ffi.ret) {
+            case FFI::VOID:
+                ra.SetTagK(LUA_TNIL);
+                break;
+            case FFI::INT: case FFI::UINT: case FFI::LONG:
+                ra.SetInteger(cs_.B_.CreateIntCast(result,
+                        cs_.rt_.GetType("lua_Integer"), ffi.ret != FFI::UINT));
+                break;
+            case FFI::ULONG: {
+                // Values above the maximum integer become floats
+                auto current = cs_.B_.GetInsertBlock();
+                auto intresult = cs_.CreateSubBlock("intresult", current);
+                auto floatresult = cs_.CreateSubBlock("floatresult",
+                        intresult);
+                auto isint = cs_.B_.CreateICmpSGE(result,
+                        cs_.MakeInt(0, result->getType()), "is.int");
+                cs_.B_.CreateCondBr(isint, intresult, floatresult);
+                cs_.B_.SetInsertPoint(intresult);
+                ra.SetInteger(result);
+                cs_.B_.CreateBr(exit);
+                cs_.B_.SetInsertPoint(floatresult);
+                ra.SetFloat(cs_.B_.CreateUIToFP(result,
+                        cs_.rt_.GetType("lua_Number")));
+                break;
+            }
+            case FFI::FLOAT: case FFI::DOUBLE:
+                ra.SetFloat(cs_.B_.CreateFPCast(result,
+                        cs_.rt_.GetType("lua_Number")));
+                break;
+            case FFI::POINTER:
+                ra.SetTagK(LUA_TLIGHTUSERDATA);
+                ra.SetValue(result);
+                break;
+            case FFI::STRING:
+                assert(false);
+                break;
+        }
+    }
+    cs_.B_.CreateBr(exit);
+
+    // Regular call (through the thunk)
+    cs_.B_.SetInsertPoint(call);
+    cs_.SetTop(a + GETARG_B(cs_.instr_));
+    cs_.CreateCall("luaD_callnoyield",
+            {cs_.values_.state, ra.GetTValue(), cs_.MakeInt(c - 1)});
+    stack_.Update();
+    cs_.B_.CreateBr(exit);
+}
+
+llvm::Value* Compiler::UnboxFFIArgument(Register& arg, FFI::Type type,
+        llvm::BasicBlock* fallback) {
+    auto argtype = FFI::GetLLVMType(cs_.rt_, type);
+    auto current = cs_.B_.GetInsertBlock();
+    switch (type) {
+        case FFI::INT: case FFI::UINT: case FFI::LONG: case FFI::ULONG: {
+            auto intarg = cs_.CreateSubBlock("intarg", current);
+            cs_.B_.CreateCondBr(arg.HasTag(LUA_TNUMINT), intarg, fallback);
+            cs_.B_.SetInsertPoint(intarg);
+            return cs_.B_.CreateIntCast(arg.GetInteger(), argtype,
+                    !FFI::IsUnsigned(type));
+        }
+        case FFI::FLOAT: case FFI::DOUBLE: {
+            auto floatarg = cs_.CreateSubBlock("floatarg", current);
+            auto checkint = cs_.CreateSubBlock("checkint", floatarg);
+            auto intarg = cs_.CreateSubBlock("intarg", checkint);
+            auto numberarg = cs_.CreateSubBlock("numberarg", intarg);
+            auto tluanumber = cs_.rt_.GetType("lua_Number");
+            cs_.B_.CreateCondBr(arg.HasTag(LUA_TNUMFLT), floatarg, checkint);
+
+            cs_.B_.SetInsertPoint(floatarg);
+            auto f = arg.GetFloat();
+            cs_.B_.CreateBr(numberarg);
+
+            cs_.B_.SetInsertPoint(checkint);
+            cs_.B_.CreateCondBr(arg.HasTag(LUA_TNUMINT), intarg, fallback);
+
+            cs_.B_.SetInsertPoint(intarg);
+            auto i = cs_.B_.CreateSIToFP(arg.GetInteger(), tluanumber);
+            cs_.B_.CreateBr(numberarg);
+
+            cs_.B_.SetInsertPoint(numberarg);
+            auto n = cs_.B_.CreatePHI(tluanumber, 2, "n");
+            n->addIncoming(f, floatarg);
+            n->addIncoming(i, intarg);
+            return cs_.B_.CreateFPCast(n, argtype);
+        }
+        case FFI::STRING: {
+            auto strarg = cs_.CreateSubBlock("strarg", current);
+            auto isstr = cs_.B_.CreateOr(arg.HasTag(ctb(LUA_TSHRSTR)),
+                    arg.HasTag(ctb(LUA_TLNGSTR)), "is.str");
+            cs_.B_.CreateCondBr(isstr, strarg, fallback);
+            cs_.B_.SetInsertPoint(strarg);
+            return cs_.GetFieldPtr(arg.GetTString(),
+                    cs_.rt_.MakeIntT(sizeof(char)), sizeof(UTString), "str");
+        }
+        case FFI::POINTER: {
+            auto ptrarg = cs_.CreateSubBlock("ptrarg", current);
+            cs_.B_.CreateCondBr(arg.HasTag(LUA_TLIGHTUSERDATA), ptrarg,
+                    fallback);
+            cs_.B_.SetInsertPoint(ptrarg);
+            return cs_.LoadField(arg.GetTValue(), argtype,
+                    offsetof(TValue, value_), "ptr");
+        }
+        case FFI::VOID:
+            break;
+    }
+    return nullptr;
 }
 
 void Compiler::CompileTailcall() {
+    int a = GETARG_A(cs_.instr_);
+    int b = GETARG_B(cs_.instr_);
+    if (b != 0 && !cs_.proto_->is_vararg && signature_.empty())
+        CompileSelfTailcall();
+
     // Tailcall returns a negative value that signals the call must be performed
     if (cs_.proto_->sizep > 0)
         cs_.CreateCall("luaF_close", {cs_.values_.state, cs_.GetBase()});
-    int a = GETARG_A(cs_.instr_);
-    int b = GETARG_B(cs_.instr_);
     if (b != 0)
         cs_.SetTop(a + b);
     auto diff = cs_.TopDiff(a);
@@ -568,6 +1392,35 @@ void Compiler::CompileTailcall() {
     cs_.B_.CreateRet(ret);
 }
 
+void Compiler::CompileSelfTailcall() {
+    int a = GETARG_A(cs_.instr_);
+    int nargs = GETARG_B(cs_.instr_) - 1;
+    auto& ra = stack_.GetR(a);
+    auto entry = cs_.blocks_[cs_.curr_];
+    auto selftail = cs_.CreateSubBlock("selftail", entry);
+    auto tailcall = cs_.CreateSubBlock("tailcall", selftail);
+    cs_.B_.SetInsertPoint(entry);
+    cs_.B_.CreateCondBr(IsSelfCall(ra), selftail, tailcall);
+
+    // The frame is reused: the arguments become the parameters and the
+    // execution restarts at the first instruction
+    cs_.B_.SetInsertPoint(selftail);
+    if (cs_.proto_->sizep > 0)
+        cs_.CreateCall("luaF_close", {cs_.values_.state, cs_.GetBase()});
+    for (int i = 0; i < cs_.proto_->numparams; ++i) {
+        if (i < nargs)
+            stack_.GetR(i).Assign(stack_.GetR(a + 1 + i));
+        else
+            stack_.GetR(i).SetTagK(LUA_TNIL);
+    }
+    cs_.ReloadTop();
+    // The entry block always jumps to the original block of the first
+    // instruction (blocks_[0] may have been replaced)
+    cs_.B_.CreateBr(cs_.entry_->getTerminator()->getSuccessor(0));
+
+    cs_.B_.SetInsertPoint(tailcall);
+}
+
 void Compiler::CompileReturn() {
     if (cs_.proto_->sizep > 0)
         cs_.CreateCall("luaF_close", {cs_.values_.state, cs_.GetBase()});
@@ -641,25 +1494,206 @@ void Compiler::CompileForprep() {
     auto& ra = stack_.GetR(GETARG_A(cs_.instr_));
     auto args = {cs_.values_.state, ra.GetTValue()};
     cs_.CreateCall("lll_forprep", args);
+
+    // Loop preheader, the hoisted loads must be performed again
+    for (auto& h : cs_.hoisted_)
+        if (h.second.prep == cs_.curr_)
+            cs_.B_.CreateStore(cs_.MakeInt(0, cs_.rt_.MakeIntT(1)),
+                    h.second.valid);
+
+    auto arrayloop = cs_.arrayloops_.find(cs_.curr_);
+    if (arrayloop != cs_.arrayloops_.end())
+        CheckArrayLoop(arrayloop->second);
+
     cs_.B_.CreateBr(cs_.blocks_[cs_.curr_ + 1 + GETARG_sBx(cs_.instr_)]);
 }
 
+void Compiler::CheckArrayLoop(CompilerState::ArrayLoop& arrayloop) {
+    auto flagt = cs_.rt_.MakeIntT(1);
+    cs_.B_.CreateStore(cs_.MakeInt(0, flagt), arrayloop.inrange);
+
+    auto checkbounds = cs_.CreateSubBlock("checkbounds",
+            cs_.B_.GetInsertBlock());
+    auto last = checkbounds;
+    std::vector<llvm::BasicBlock*> checktables, checksizes;
+    for (size_t i = 0; i < arrayloop.tables.size(); ++i) {
+        checktables.push_back(last = cs_.CreateSubBlock("checktable", last));
+        checksizes.push_back(last = cs_.CreateSubBlock("checksize", last));
+    }
+    auto setinrange = cs_.CreateSubBlock("setinrange", last);
+    auto done = cs_.CreateSubBlock("checkdone", setinrange);
+
+    // After lll_forprep the values are either all integers or all floats
+    auto& ra = stack_.GetR(GETARG_A(cs_.instr_));
+    auto& ra1 = stack_.GetR(GETARG_A(cs_.instr_) + 1);
+    auto& ra2 = stack_.GetR(GETARG_A(cs_.instr_) + 2);
+    cs_.B_.CreateCondBr(ra.HasTag(LUA_TNUMINT), checkbounds, done);
+
+    // The index goes from init (ra + step) to limit
+    cs_.B_.SetInsertPoint(checkbounds);
+    auto step = ra2.GetInteger();
+    auto first = cs_.B_.CreateAdd(ra.GetInteger(), step, "first");
+    auto limit = ra1.GetInteger();
+    auto zero = cs_.MakeInt(0, step->getType());
+    auto step_gtz = cs_.B_.CreateICmpSGT(step, zero);
+    auto lowest = cs_.B_.CreateSelect(step_gtz, first, limit, "lowest");
+    auto highest = cs_.B_.CreateSelect(step_gtz, limit, first, "highest");
+    auto next = checktables.empty() ? setinrange : checktables[0];
+    cs_.B_.CreateBr(next);
+
+    // Every table must have the keys (index + offset) inside the array part:
+    // lowest + minoffset >= 1 and highest + maxoffset <= sizearray
+    for (size_t i = 0; i < arrayloop.tables.size(); ++i) {
+        auto& access = arrayloop.tables[i];
+        auto& table = stack_.GetR(access.table);
+        cs_.B_.SetInsertPoint(checktables[i]);
+        cs_.B_.CreateCondBr(table.HasTag(ctb(LUA_TTABLE)), checksizes[i],
+                done);
+
+        cs_.B_.SetInsertPoint(checksizes[i]);
+        auto sizearray = cs_.LoadField(table.GetTable(),
+                cs_.rt_.MakeIntT(sizeof(unsigned int)),
+                offsetof(Table, sizearray), "sizearray");
+        auto size = cs_.B_.CreateZExt(sizearray, highest->getType());
+        auto min = cs_.MakeInt(1 - access.minoffset, step->getType());
+        auto max = cs_.B_.CreateSub(size,
+                cs_.MakeInt(access.maxoffset, step->getType()));
+        auto inrange = cs_.B_.CreateAnd(
+                cs_.B_.CreateICmpSGE(lowest, min),
+                cs_.B_.CreateICmpSLE(highest, max));
+        next = i + 1 < checktables.size() ? checktables[i + 1] : setinrange;
+        cs_.B_.CreateCondBr(inrange, next, done);
+    }
+
+    cs_.B_.SetInsertPoint(setinrange);
+    cs_.B_.CreateStore(cs_.MakeInt(1, flagt), arrayloop.inrange);
+    cs_.B_.CreateBr(done);
+
+    cs_.B_.SetInsertPoint(done);
+}
+
 void Compiler::CompileTforcall() {
     int a = GETARG_A(cs_.instr_);
+    int c = GETARG_C(cs_.instr_);
     int cb = a + 3;
+    auto& rgenerator = stack_.GetR(a);
+    auto& rstate = stack_.GetR(a + 1);
     auto& rcb = stack_.GetR(cb);
-    rcb.Assign(stack_.GetR(a));
-    stack_.GetR(cb + 1).Assign(stack_.GetR(a + 1));
+    auto entry = cs_.blocks_[cs_.curr_];
+    auto checkgenerator = cs_.CreateSubBlock("checkgenerator", entry);
+    auto fastnext = cs_.CreateSubBlock("fastnext", checkgenerator);
+    auto checkipairs = cs_.CreateSubBlock("checkipairs", fastnext);
+    auto call = cs_.CreateSubBlock("call", checkipairs);
+    auto exit = cs_.blocks_[cs_.curr_ + 1];
+
+    // The builtin iterators over a table are performed without the call
+    cs_.B_.SetInsertPoint(entry);
+    auto islcf = rgenerator.HasTag(LUA_TLCF);
+    auto istable = rstate.HasTag(ctb(LUA_TTABLE));
+    cs_.B_.CreateCondBr(cs_.B_.CreateAnd(islcf, istable), checkgenerator,
+            call);
+
+    cs_.B_.SetInsertPoint(checkgenerator);
+    auto tfunction = cs_.rt_.MakeIntT(sizeof(lua_CFunction));
+    auto generator = cs_.LoadField(rgenerator.GetTValue(), tfunction,
+            offsetof(TValue, value_), "generator");
+    auto nextf = cs_.MakeInt(reinterpret_cast<uintptr_t>(luaB_next),
+            tfunction);
+    auto isnext = cs_.B_.CreateICmpEQ(generator, nextf, "is.next");
+    cs_.B_.CreateCondBr(isnext, fastnext, checkipairs);
+
+    // next: continues the traversal at the cursor
+    cs_.B_.SetInsertPoint(fastnext);
+    auto args = {
+        cs_.values_.state,
+        rstate.GetTable(),
+        rcb.GetTValue(),
+        cs_.cursors_[cs_.curr_]
+    };
+    cs_.CreateCall("lll_tfornext", args);
+    for (int i = 2; i < c; ++i)
+        stack_.GetR(cb + i).SetTagK(LUA_TNIL);
+    cs_.B_.CreateBr(exit);
+
+    // ipairs
+    cs_.B_.SetInsertPoint(checkipairs);
+    auto ipairsf = cs_.MakeInt(reinterpret_cast<uintptr_t>(luaB_ipairsaux),
+            tfunction);
+    auto isipairs = cs_.B_.CreateICmpEQ(generator, ipairsf, "is.ipairs");
+    auto fastipairs = cs_.CreateSubBlock("fastipairs", checkipairs);
+    cs_.B_.CreateCondBr(isipairs, fastipairs, call);
+    cs_.B_.SetInsertPoint(fastipairs);
+    CompileTforcallIpairs(call);
+
+    // Generic call
+    cs_.B_.SetInsertPoint(call);
+    rcb.Assign(rgenerator);
+    stack_.GetR(cb + 1).Assign(rstate);
     stack_.GetR(cb + 2).Assign(stack_.GetR(a + 2));
     cs_.SetTop(cb + 3);
-    auto args = {
+    auto callargs = {
         cs_.values_.state,
         rcb.GetTValue(),
-        cs_.MakeInt(GETARG_C(cs_.instr_))
+        cs_.MakeInt(c)
     };
-    cs_.CreateCall("luaD_callnoyield", args);
+    cs_.CreateCall("luaD_callnoyield", callargs);
     stack_.Update();
     cs_.ReloadTop();
+    cs_.B_.CreateBr(exit);
+}
+
+void Compiler::CompileTforcallIpairs(llvm::BasicBlock* fallback) {
+    int a = GETARG_A(cs_.instr_);
+    int c = GETARG_C(cs_.instr_);
+    int cb = a + 3;
+    auto& rcontrol = stack_.GetR(a + 2);
+    auto& rcb = stack_.GetR(cb);
+    auto checkmt = cs_.CreateSubBlock("checkmt", cs_.B_.GetInsertBlock());
+    auto checksize = cs_.CreateSubBlock("checksize", checkmt);
+    auto getarray = cs_.CreateSubBlock("getarray", checksize);
+    auto nextvalue = cs_.CreateSubBlock("nextvalue", getarray);
+    auto endarray = cs_.CreateSubBlock("endarray", nextvalue);
+    auto exit = cs_.blocks_[cs_.curr_ + 1];
+
+    // Without a metatable lua_geti is a raw access, the keys outside the
+    // array part are left to the call
+    cs_.B_.CreateCondBr(rcontrol.HasTag(LUA_TNUMINT), checkmt, fallback);
+
+    cs_.B_.SetInsertPoint(checkmt);
+    auto table = stack_.GetR(a + 1).GetTable();
+    auto metatable = cs_.LoadField(table, cs_.rt_.GetType("Table"),
+            offsetof(Table, metatable), "metatable");
+    auto ismtnull = cs_.B_.CreateIsNull(metatable, "is.mt.null");
+    cs_.B_.CreateCondBr(ismtnull, checksize, fallback);
+
+    // The array index of the key i + 1 is i
+    cs_.B_.SetInsertPoint(checksize);
+    auto idx = rcontrol.GetInteger();
+    auto sizearray = cs_.LoadField(table,
+            cs_.rt_.MakeIntT(sizeof(unsigned int)), offsetof(Table, sizearray),
+            "sizearray");
+    auto size = cs_.B_.CreateZExt(sizearray, idx->getType());
+    auto inarray = cs_.B_.CreateICmpULT(idx, size, "inarray");
+    cs_.B_.CreateCondBr(inarray, getarray, fallback);
+
+    cs_.B_.SetInsertPoint(getarray);
+    auto array = cs_.LoadField(table, cs_.rt_.GetType("TValue"),
+            offsetof(Table, array), "array");
+    RTRegister value(cs_, cs_.B_.CreateGEP(array, idx, "value"));
+    cs_.B_.CreateCondBr(value.HasTag(LUA_TNIL), endarray, nextvalue);
+
+    cs_.B_.SetInsertPoint(nextvalue);
+    rcb.SetInteger(cs_.B_.CreateAdd(idx, cs_.MakeInt(1, idx->getType())));
+    if (c >= 2)
+        stack_.GetR(cb + 1).Assign(value);
+    for (int i = 2; i < c; ++i)
+        stack_.GetR(cb + i).SetTagK(LUA_TNIL);
+    cs_.B_.CreateBr(exit);
+
+    cs_.B_.SetInsertPoint(endarray);
+    for (int i = 0; i < c; ++i)
+        stack_.GetR(cb + i).SetTagK(LUA_TNIL);
+    cs_.B_.CreateBr(exit);
 }
 
 void Compiler::CompileTforloop() {
@@ -694,6 +1728,11 @@ void Compiler::CompileSetlist() {
 
 void Compiler::CompileClosure() {
     int a = GETARG_A(cs_.instr_);
+
+    // Closures that are never used aren't created
+    if (!escape_.IsLive(cs_.curr_ + 1, a))
+        return;
+
     auto& ra = stack_.GetR(a);
     auto args = {
         cs_.values_.state,
@@ -710,6 +1749,8 @@ void Compiler::CompileClosure() {
 void Compiler::CompileCheckcg(llvm::Value* reg) {
     auto args = {cs_.values_.state, cs_.values_.ci, reg};
     cs_.CreateCall("lll_checkcg", args);
+    // Finalizers may run during the collection
+    cs_.InvalidateLoopCaches();
 }
 
 }
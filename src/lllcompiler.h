@@ -12,18 +12,29 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+
+#include <llvm/IR/DIBuilder.h>
 
 #include "lllcompilerstate.h"
+#include "lllescape.h"
+#include "lllffi.h"
+#include "lllloops.h"
+#include "lllstats.h"
 #include "lllvalue.h"
 
 namespace lll {
 
 class Engine;
+class State;
 
 class Compiler {
 public:
     // Constructor, receiver the proto that will be compiled
-    Compiler(lua_State* L, Proto* proto);
+    // If $signature isn't empty, the function is a clone specialized to the
+    // tags of its parameters; calls with other tags go to LLLDispatchClone
+    Compiler(lua_State* L, Proto* proto,
+            const std::vector<int>& signature = std::vector<int>());
 
     // Starts the function compilation
     // Returns false if it fails
@@ -35,10 +46,64 @@ public:
     // Gets the engine (only if compilation succeeds)
     Engine* GetEngine();
 
+    // Gets the number of self caches that must be allocated in the proto
+    int GetSelfCaches();
+
+    // Obtains the number of self caches of the code of $proto (the same for
+    // the generic code and the clones)
+    static int CountSelfCaches(Proto* proto);
+
 private:
+    // Runs a step of the compilation, its time is added to $phase
+    bool RunPhase(Stats::Phase phase, bool (Compiler::*step)());
+
     // Compiles the Lua proto instructions
     bool CompileInstructions();
 
+    // Creates the debug info of the function (only if enabled); the
+    // instructions of each bytecode are mapped to its line in the source
+    void InitDebugInfo();
+    void SetDebugLocation();
+
+    // Creates the storage for the table loads that can be hoisted out of loops
+    void InitHoistedLoads();
+
+    // Obtains the hoisted load of the current instruction (if there is one)
+    CompilerState::HoistedLoad* GetHoistedLoad();
+
+    // Creates the bound check flags of the loops over array parts (only in
+    // vectorization mode)
+    void InitArrayLoops();
+
+    // Obtains the bound check flag of the current instruction (if there is
+    // one)
+    llvm::Value* GetArrayInRange();
+
+    // Creates the storage for the fields of the virtual tables
+    void InitVirtualTables();
+
+    // Creates the virtual tables that escape at the current instruction
+    void EscapeVirtualTables();
+
+    // Creates the traversal cursors of the generic for loops
+    void InitIterators();
+
+    // Checks the tags of the parameters and stores the ones of the signature
+    // (only in clones); the stores don't change the values, but the optimizer
+    // propagates the constant tags to the type checks of the function
+    void InitSignature();
+
+    // Compiles the access to the fields of a virtual table; the instruction
+    // block is replaced by the one that performs the access to the real table
+    void CompileVirtualAccess();
+
+    // Creates the real table of a virtual table (at the current block)
+    void MaterializeTable(const Escape::VirtualTable& vt);
+
+    // Adds the branch weights of the slow paths and moves them to the end of
+    // the function
+    bool PlaceColdBlocks();
+
     // Returns true if the module doesn't have any error
     bool VerifyModule();
 
@@ -60,7 +125,10 @@ private:
     void CompileSetupval();
     void CompileSettable();
     void CompileNewtable();
+    llvm::Value* CreateTable(Register& ra, int b, int c);
     void CompileSelf();
+    llvm::Value* CreateSelfCache();
+    static bool HasSelfCache(Proto* proto, Instruction i);
     void CompileUnm();
     void CompileBNot();
     void CompileNot();
@@ -71,20 +139,36 @@ private:
     void CompileTest();
     void CompileTestset();
     void CompileCall();
+    void CompileCCall(llvm::Value* cfunction);
+    llvm::Value* IsSelfCall(Register& ra);
+    lua_CFunction GetUpvalueFunction(int reg);
+    void CompileMathCall(lua_CFunction function);
+    void CompileFFICall(const FFI::Function& ffi);
+    llvm::Value* UnboxFFIArgument(Register& arg, FFI::Type type,
+            llvm::BasicBlock* fallback);
     void CompileTailcall();
+    void CompileSelfTailcall();
     void CompileReturn();
     void CompileForloop();
     void CompileForprep();
+    void CheckArrayLoop(CompilerState::ArrayLoop& arrayloop);
     void CompileTforcall();
+    void CompileTforcallIpairs(llvm::BasicBlock* fallback);
     void CompileTforloop();
     void CompileSetlist();
     void CompileClosure();
     void CompileCheckcg(llvm::Value* reg);
 
     std::string error_;
+    std::vector<int> signature_;
     CompilerState cs_;
+    Loops loops_;
+    Escape escape_;
     Stack stack_;
     std::unique_ptr<Engine> engine_;
+    std::unique_ptr<llvm::DIBuilder> dibuilder_;
+    llvm::MDNode* debugscope_;
+    State& state_;
 };
 
 }
@@ -13,6 +13,7 @@
 #include <llvm/Support/Host.h>
 
 #include "lllcompilerstate.h"
+#include "lllstate.h"
 
 extern "C" {
 #include "lprefix.h"
@@ -26,20 +27,25 @@ namespace lll {
 CompilerState::CompilerState(lua_State* L, Proto* proto) :
     L_(L),
     proto_(proto),
-    context_(llvm::getGlobalContext()),
-    rt_(*Runtime::Instance()),
+    context_(State::Get(L).runtime_.GetContext()),
+    rt_(State::Get(L).runtime_),
     module_(new llvm::Module("lll_module", context_)),
     function_(CreateMainFunction()),
     B_(context_),
     entry_(llvm::BasicBlock::Create(context_, "entry", function_)),
     blocks_(proto_->sizecode, nullptr),
-    curr_(0) {
+    curr_(0),
+    selfcaches_(0) {
     module_->setTargetTriple(llvm::sys::getDefaultTargetTriple());
     for (size_t i = 0; i < blocks_.size(); ++i) {
+#ifdef LLL_IR_NAMES
         auto instruction = luaP_opnames[GET_OPCODE(proto_->code[i])];
         std::stringstream name;
         name << "block." << i << "." << instruction;
         blocks_[i] = llvm::BasicBlock::Create(context_, name.str(), function_);
+#else
+        blocks_[i] = llvm::BasicBlock::Create(context_, "", function_);
+#endif
     }
 }
 
@@ -69,6 +75,15 @@ void CompilerState::InitEntryBlock() {
     values_.upvals = GetFieldPtr(values_.closure, rt_.GetType("UpVal"),
             offsetof(LClosure, upvals), "closure.upvals");
 
+    // The constants are taken from the proto of the running closure, so the
+    // code doesn't depend on the addresses of this state
+    auto proto = LoadField(values_.closure, rt_.GetType("Proto"),
+            offsetof(LClosure, p), "proto");
+    values_.k = LoadField(proto, rt_.GetType("TValue"), offsetof(Proto, k),
+            "k");
+    values_.cache = LoadField(proto, llvm::PointerType::get(rt_.MakeIntT(1), 0),
+            offsetof(Proto, lllcache), "cache");
+
     auto tluanumber = rt_.GetType("lua_Number");
     values_.xnumber = B_.CreateAlloca(tluanumber, nullptr, "xnumber");
     values_.ynumber = B_.CreateAlloca(tluanumber, nullptr, "ynumber");
@@ -98,6 +113,34 @@ llvm::Value* CompilerState::InjectPointer(llvm::Type* type, void* ptr) {
     return B_.CreateIntToPtr(intptr, type);
 }
 
+llvm::Value* CompilerState::GetGlobalState() {
+    return LoadField(values_.state, rt_.GetType("global_State"),
+            offsetof(lua_State, l_G), "g");
+}
+
+llvm::Value* CompilerState::GetTMName(int event) {
+    return LoadField(GetGlobalState(), rt_.GetType("TString"),
+            offsetof(global_State, tmname) + event * sizeof(TString*),
+            "tmname");
+}
+
+llvm::Value* CompilerState::GetNilObject() {
+    auto ttvalue = rt_.GetType("TValue");
+    auto tvaluet = static_cast<llvm::PointerType*>(ttvalue)->getElementType();
+    return GetFieldPtr(GetGlobalState(), tvaluet,
+            offsetof(global_State, lllnilvalue), "nilobject");
+}
+
+llvm::Value* CompilerState::GetArrayMetatable() {
+    return LoadField(GetGlobalState(), rt_.GetType("Table"),
+            offsetof(global_State, lllarraymt), "arraymt");
+}
+
+llvm::Value* CompilerState::NewSelfCache() {
+    auto offset = selfcaches_++ * SELFCACHE_SIZE * sizeof(SelfCacheEntry);
+    return B_.CreateGEP(values_.cache, MakeInt(offset), "selfcache");
+}
+
 llvm::Value* CompilerState::GetFieldPtr(llvm::Value* strukt,
         llvm::Type* fieldtype, size_t offset, const std::string& name) {
     auto memt = llvm::PointerType::get(rt_.MakeIntT(1), 0);
@@ -157,15 +200,34 @@ llvm::Value* CompilerState::TopDiff(int n) {
     return B_.CreateIntCast(diff, inttype, false, "idiff");
 }
 
+void CompilerState::InvalidateLoopCaches() {
+    for (auto& h : hoisted_)
+        B_.CreateStore(MakeInt(0, rt_.MakeIntT(1)), h.second.valid);
+    for (auto& l : arrayloops_)
+        B_.CreateStore(MakeInt(0, rt_.MakeIntT(1)), l.second.inrange);
+}
+
 llvm::BasicBlock* CompilerState::CreateSubBlock(const std::string& suffix,
             llvm::BasicBlock* preview) {
     if (!preview)
         preview = blocks_[curr_];
-    auto name = blocks_[curr_]->getName() + "." +  suffix;
-    auto block = llvm::BasicBlock::Create(context_, name, function_, preview);
+#ifdef LLL_IR_NAMES
+    auto block = llvm::BasicBlock::Create(context_,
+            blocks_[curr_]->getName() + "." + suffix, function_, preview);
+#else
+    (void)suffix;
+    auto block = llvm::BasicBlock::Create(context_, "", function_, preview);
+#endif
     block->moveAfter(preview);
     return block;
 }
 
+llvm::BasicBlock* CompilerState::CreateColdBlock(const std::string& suffix,
+            llvm::BasicBlock* preview) {
+    auto block = CreateSubBlock(suffix, preview);
+    coldblocks_.insert(block);
+    return block;
+}
+
 }
 
@@ -11,6 +11,8 @@
 #ifndef LLLCOMPILERSTATE_H
 #define LLLCOMPILERSTATE_H
 
+#include <map>
+#include <set>
 #include <vector>
 
 #include <llvm/IR/Function.h>
@@ -18,6 +20,7 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 
+#include "lllloops.h"
 #include "lllruntime.h"
 
 extern "C" {
@@ -27,6 +30,15 @@ struct Proto;
 struct lua_State;
 }
 
+// The names of the IR values and blocks are only kept if LLL_IR_NAMES is
+// defined (debug builds); creating the names is a large part of the IR
+// construction time
+#ifdef LLL_IR_NAMES
+#define LLL_PRESERVE_NAMES true
+#else
+#define LLL_PRESERVE_NAMES false
+#endif
+
 namespace lll {
 
 class CompilerState {
@@ -39,9 +51,23 @@ public:
     // Converts an int to boolean (value != 0)
     llvm::Value* ToBool(llvm::Value* value);
 
-    // Injects a pointer from host to jit
+    // Injects a pointer from host to jit; the compiled code can be shared
+    // by many states, so it must only be used for the process data
     llvm::Value* InjectPointer(llvm::Type* type, void* ptr);
 
+    // Obtains the name of the tag method $event (G(L)->tmname[event])
+    llvm::Value* GetTMName(int event);
+
+    // Obtains a nil TValue that can't be written
+    llvm::Value* GetNilObject();
+
+    // Obtains the metatable of the arrays (G(L)->lllarraymt)
+    llvm::Value* GetArrayMetatable();
+
+    // Reserves the cache of an OP_SELF (see SelfCacheEntry); the caches are
+    // allocated in the proto, so each state has its own
+    llvm::Value* NewSelfCache();
+
     // Obtains the pointer to the field at $offset
     llvm::Value* GetFieldPtr(llvm::Value* strukt, llvm::Type* fieldtype,
             size_t offset, const std::string& name);
@@ -77,10 +103,20 @@ public:
     // Creates the entry block
     void InitEntryBlock();
 
+    // Invalidates the hoisted table loads and the array bound checks, must be
+    // called whenever the code might have changed a table (function calls,
+    // metamethods, gc)
+    void InvalidateLoopCaches();
+
     // Creates a sub-block with $suffix
     llvm::BasicBlock* CreateSubBlock(const std::string& suffix,
             llvm::BasicBlock* preview = nullptr);
 
+    // Creates a sub-block for a slow path; cold blocks are moved to the end
+    // of the function and the branches to them are weighted as unlikely
+    llvm::BasicBlock* CreateColdBlock(const std::string& suffix,
+            llvm::BasicBlock* preview = nullptr);
+
     // Prints a message inside the jitted function (DEBUG)
     template<typename... Arguments>
     void DebugPrint(const std::string& format, Arguments... args) {
@@ -102,13 +138,16 @@ public:
     Runtime& rt_;
     std::unique_ptr<llvm::Module> module_;
     llvm::Function* function_;
-    llvm::IRBuilder<> B_;
+    llvm::IRBuilder<LLL_PRESERVE_NAMES> B_;
     llvm::BasicBlock* entry_;
     std::vector<llvm::BasicBlock*> blocks_;
+    std::set<llvm::BasicBlock*> coldblocks_;
     struct {
         llvm::Value* state;
         llvm::Value* closure;
         llvm::Value* ci;
+        llvm::Value* k;
+        llvm::Value* cache;
         llvm::Value* upvals;
         llvm::Value* base;
         llvm::Value* xnumber;
@@ -118,9 +157,44 @@ public:
     int curr_;
     Instruction instr_;
 
+    // Number of self caches used by the function
+    int selfcaches_;
+
+    // Table load that is performed once per loop execution; the result is
+    // kept in $tvalue while $valid is set
+    struct HoistedLoad {
+        int prep;
+        llvm::Value* valid;
+        llvm::Value* tvalue;
+    };
+    std::map<int, HoistedLoad> hoisted_;
+
+    // Loop that indexes the array part of invariant tables with its control
+    // variable; $inrange is set while every index is inside the arrays
+    struct ArrayLoop {
+        std::vector<Loops::ArrayAccess> tables;
+        llvm::Value* inrange;
+    };
+    std::map<int, ArrayLoop> arrayloops_;
+
+    // Table kept in scalar values, $fields holds the value of each constant
+    // key and $materialized is set once the real table is created
+    struct VirtualTable {
+        llvm::Value* materialized;
+        std::vector<llvm::Value*> fields;
+    };
+    std::map<int, VirtualTable> virtualtables_;
+
+    // Position of the last key returned by the builtin 'next' in each
+    // TFORCALL, avoids the key search at each iteration
+    std::map<int, llvm::Value*> cursors_;
+
 private:
     // Creates the main function
     llvm::Function* CreateMainFunction();
+
+    // Obtains the global state of the running thread
+    llvm::Value* GetGlobalState();
 };
 
 }
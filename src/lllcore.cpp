@@ -8,28 +8,43 @@
 ** This is the Lua lib for LLL API
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <unordered_set>
+#include <vector>
 
+#include "lllcodecache.h"
 #include "lllcompiler.h"
 #include "lllengine.h"
+#include "lllffi.h"
+#include "lllperf.h"
+#include "lllstate.h"
+#include "lllstats.h"
+#include "llltrace.h"
 
 extern "C" {
 #include "lprefix.h"
 #include "lapi.h"
 #include "lauxlib.h"
+#include "ldebug.h"
 #include "lmem.h"
+#include "lllarray.h"
 #include "lllcore.h"
 }
 
-#define GETENGINE(p) static_cast<lll::Engine *>(p->llldata)
-#define SETENGINE(p, e) { \
-    auto engine = e; \
-    p->llldata = engine; \
-    p->lllfunction = reinterpret_cast<LLLFunction>(engine->GetFunction()); }
+#define GETCODE(p) static_cast<lll::Code *>(p->llldata)
+#define GETENGINE(p) (GETCODE(p) ? GETCODE(p)->engine.get() : NULL)
+#define SETTINGS(L) lll::State::Get(L).settings_
 
-static int autocompile_ = 1;
-static int callstocompile_ = 50;
+/* The perf outputs are files of the process, so they are shared by all
+** states */
+static std::atomic<int> perfmap_(getenv("LLL_PERFMAP") != NULL);
+static std::atomic<int> jitdump_(getenv("LLL_JITDUMP") != NULL);
 
 void writeerror (lua_State *L, char **outerr, const char *err) {
     if (outerr) {
@@ -38,22 +53,279 @@ void writeerror (lua_State *L, char **outerr, const char *err) {
     }
 }
 
+/*
+** Code memory
+** The compiled functions are uncompiled in least recently used order when the
+** size of the native code exceeds the limit; the functions that have frames
+** in the stack of any thread can't be freed
+*/
+static void addengine (lll::State& state, Proto *p,
+                       const lll::CodeCache::Entry& entry) {
+    auto code = new lll::Code();
+    code->engine = entry.engine;
+    code->selfcache.resize(entry.selfcaches * lll::SELFCACHE_SIZE);
+    code->lastuse = ++state.clock_;
+    code->generic = reinterpret_cast<LLLFunction>(
+            entry.engine->GetFunction());
+    p->llldata = code;
+    p->lllcache = code->selfcache.data();
+    p->lllfunction = code->generic;
+    if (state.settings_.maxclones > 0 && p->numparams > 0)
+        p->lllfunction = LLLDispatchClone;
+    state.engines_.insert(p);
+    state.codememory_ += entry.engine->GetCodeSize();
+}
+
+static void freeengine (lll::State& state, Proto *p) {
+    auto code = GETCODE(p);
+    if (!code)
+        return;
+    state.engines_.erase(p);
+    state.codememory_ -= code->engine->GetCodeSize();
+    for (auto& clone : code->clones)
+        state.codememory_ -= clone.engine->GetCodeSize();
+    lll::PerfListener::Unpublish(p);
+    delete code;
+    p->llldata = NULL;
+    p->lllcache = NULL;
+    p->lllfunction = NULL;
+}
+
+static void addactive (lua_State *L, std::unordered_set<Proto*>& active) {
+    for (CallInfo *ci = L->ci; ci != &L->base_ci; ci = ci->previous)
+        if (isLua(ci))
+            active.insert(clLvalue(ci->func)->p);
+}
+
+static void evictcode (lua_State *L, Proto *keep) {
+    global_State *g = G(L);
+    auto& state = lll::State::Get(L);
+    std::unordered_set<Proto*> active;
+    addactive(g->mainthread, active);
+    for (GCObject *o = g->allgc; o != NULL; o = o->next)
+        if (o->tt == LUA_TTHREAD)
+            addactive(gco2th(o), active);
+
+    std::vector<Proto*> candidates;
+    for (auto p : state.engines_)
+        if (p != keep && !active.count(p))
+            candidates.push_back(p);
+    std::sort(candidates.begin(), candidates.end(), [](Proto* a, Proto* b) {
+        return GETCODE(a)->lastuse < GETCODE(b)->lastuse;
+    });
+
+    // The evicted functions can be auto compiled again if they get hot
+    for (auto p : candidates) {
+        if (state.codememory_ <= state.settings_.codememorylimit)
+            break;
+        freeengine(state, p);
+        p->ncalls = 0;
+        state.stats_.AddEviction(p);
+    }
+}
+
+/*
+** Shared code
+** The code that doesn't retain the IR is added to the process cache, so the
+** other states that load the same chunk don't compile it again
+*/
 int LLLCompile (lua_State *L, Proto *p, char **errmsg) {
-    if (GETENGINE(p) != NULL) {
+    if (GETCODE(p) != NULL) {
         writeerror(L, errmsg, "Function already compiled");
         return 1;
     }
 
-    lll::Compiler compiler(L, p);
-    if (!compiler.Compile()) {
-        writeerror(L, errmsg, compiler.GetErrorMessage().c_str());
-        return 1;
+    auto& state = lll::State::Get(L);
+    auto& settings = state.settings_;
+    bool share = !settings.retainir && !settings.debuginfo;
+    std::string key;
+    lll::CodeCache::Entry entry;
+    if (share) {
+        key = lll::CodeCache::MakeKey(p, settings.vectorize,
+                lllarray_metatable(L) != NULL);
+        if (lll::CodeCache::Find(key, entry))
+            state.stats_.AddShared(p, entry.engine->GetCodeSize());
     }
 
-    SETENGINE(p, compiler.GetEngine());
+    if (!entry.engine) {
+        lll::Compiler compiler(L, p);
+        if (!compiler.Compile()) {
+            writeerror(L, errmsg, compiler.GetErrorMessage().c_str());
+            return 1;
+        }
+        entry.engine.reset(compiler.GetEngine());
+        entry.selfcaches = compiler.GetSelfCaches();
+        if (share && !entry.engine->HasIR())
+            lll::CodeCache::Add(key, entry);
+    }
+
+    addengine(state, p, entry);
+    auto limit = state.settings_.codememorylimit;
+    if (limit > 0 && state.codememory_ > limit)
+        evictcode(L, p);
     return 0;
 }
 
+/*
+** Auto compilation policy
+** The counter of calls (p->ncalls) is set below the threshold to delay the
+** next attempt; the state of the functions that reached the threshold is kept
+** until they are collected
+*/
+static void delaycompile (lll::State& state, Proto *p, long long calls) {
+    p->ncalls = static_cast<int>(std::max<long long>(INT_MIN,
+            state.settings_.callstocompile - calls));
+}
+
+static bool hasbudget (lll::State& state) {
+    if (state.settings_.compilebudget <= 0)
+        return true;
+    auto now = std::chrono::steady_clock::now();
+    if (now - state.budgetwindow_ >= std::chrono::seconds(1)) {
+        state.budgetwindow_ = now;
+        state.budgetspent_ = 0;
+    }
+    return state.budgetspent_ * 1000 < state.settings_.compilebudget;
+}
+
+void LLLAutoCompile (lua_State *L, Proto *p) {
+    auto& state = lll::State::Get(L);
+    auto& settings = state.settings_;
+    auto& policy = state.policies_[p];
+    if (policy.blacklisted) {
+        p->ncalls = INT_MIN;
+        return;
+    }
+
+    if (settings.maxcompilesize > 0 && p->sizecode > settings.maxcompilesize) {
+        policy.blacklisted = true;
+        p->ncalls = INT_MIN;
+        return;
+    }
+
+    // Bigger functions are more expensive to compile, so they must be called
+    // more times
+    if (!policy.scaled) {
+        policy.scaled = true;
+        auto scale = settings.compilesizescale;
+        if (scale > 0 && p->sizecode >= scale) {
+            delaycompile(state, p, static_cast<long long>(
+                    settings.callstocompile) * (p->sizecode / scale));
+            return;
+        }
+    }
+
+    if (!hasbudget(state)) {
+        delaycompile(state, p, settings.callstocompile);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int err = LLLCompile(L, p, NULL);
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+    state.budgetspent_ += elapsed.count();
+
+    // Each failure doubles the calls to the next attempt
+    if (err) {
+        policy.failures++;
+        if (policy.failures >= settings.maxcompilefailures) {
+            policy.blacklisted = true;
+            p->ncalls = INT_MIN;
+        } else {
+            delaycompile(state, p, static_cast<long long>(
+                    settings.callstocompile) << std::min(policy.failures, 16));
+        }
+    }
+}
+
+/*
+** Function cloning
+** The functions compiled while the clones are enabled are entered through
+** 'LLLDispatchClone', that calls the clone of the tags of the arguments or
+** the generic code. A signature gets its clone once it is seen in the number
+** of calls to compile, until the function has the maximum number of clones.
+** A single clone is the entry of the function, since it checks the tags
+*/
+static bool compileclone (lua_State *L, Proto *p,
+                          const std::vector<int>& signature) {
+    auto& state = lll::State::Get(L);
+    auto code = GETCODE(p);
+
+    // The clone uses the self caches allocated for the generic code
+    if (lll::Compiler::CountSelfCaches(p) * lll::SELFCACHE_SIZE >
+            static_cast<int>(code->selfcache.size()))
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    lll::Compiler compiler(L, p, signature);
+    bool ok = compiler.Compile();
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+    state.budgetspent_ += elapsed.count();
+    if (!ok)
+        return false;
+
+    std::shared_ptr<lll::Engine> engine(compiler.GetEngine());
+    lll::Clone clone;
+    clone.signature = signature;
+    clone.engine = engine;
+    clone.function = reinterpret_cast<LLLFunction>(engine->GetFunction());
+    code->clones.push_back(clone);
+    p->lllfunction = code->clones.size() == 1 ? clone.function :
+            LLLDispatchClone;
+    state.codememory_ += engine->GetCodeSize();
+    auto limit = state.settings_.codememorylimit;
+    if (limit > 0 && state.codememory_ > limit)
+        evictcode(L, p);
+    return true;
+}
+
+int LLLDispatchClone (lua_State *L, LClosure *cl) {
+    Proto *p = cl->p;
+    auto code = GETCODE(p);
+    StkId base = L->ci->u.l.base;
+    for (auto& clone : code->clones) {
+        int i = 0;
+        while (i < p->numparams && rttype(base + i) == clone.signature[i])
+            ++i;
+        if (i == p->numparams)
+            return clone.function(L, cl);
+    }
+
+    auto& state = lll::State::Get(L);
+    auto& settings = state.settings_;
+    if (static_cast<int>(code->clones.size()) < settings.maxclones) {
+        std::vector<int> signature(p->numparams);
+        for (int i = 0; i < p->numparams; ++i)
+            signature[i] = rttype(base + i);
+        auto& calls = code->signatures[signature];
+        if (++calls >= settings.callstocompile) {
+            if (!hasbudget(state))
+                calls = 0;
+            else if (compileclone(L, p, signature))
+                return code->clones.back().function(L, cl);
+            else
+                calls = INT_MIN;
+        }
+    }
+    return code->generic(L, cl);
+}
+
+void LLLSetMaxClones (lua_State *L, int clones) {
+    SETTINGS(L).maxclones = clones;
+}
+
+int LLLGetMaxClones (lua_State *L) {
+    return SETTINGS(L).maxclones;
+}
+
+int LLLIsBlacklisted (lua_State *L, Proto *p) {
+    auto& policies = lll::State::Get(L).policies_;
+    auto policy = policies.find(p);
+    return policy != policies.end() && policy->second.blacklisted;
+}
+
 int LLLCompileAll (lua_State *L, Proto *p, char **errmsg) {
     if (LLLCompile(L, p, errmsg))
         return 1;
@@ -63,29 +335,237 @@ int LLLCompileAll (lua_State *L, Proto *p, char **errmsg) {
     return 0;
 }
 
-void LLLSetAutoCompileEnable (int enable) {
-    autocompile_ = enable;
+void LLLSetAutoCompileEnable (lua_State *L, int enable) {
+    SETTINGS(L).autocompile = enable;
+    G(L)->lllautocompile = enable != 0;
+}
+
+int LLLIsAutoCompileEnable (lua_State *L) {
+    return SETTINGS(L).autocompile;
+}
+
+void LLLSetCallsToCompile (lua_State *L, int calls) {
+    SETTINGS(L).callstocompile = calls;
+    G(L)->lllcallstocompile = calls;
+}
+
+int LLLGetCallsToCompile (lua_State *L) {
+    return SETTINGS(L).callstocompile;
+}
+
+void LLLSetCompileSizeScale (lua_State *L, int instructions) {
+    SETTINGS(L).compilesizescale = instructions;
+}
+
+int LLLGetCompileSizeScale (lua_State *L) {
+    return SETTINGS(L).compilesizescale;
 }
 
-int LLLIsAutoCompileEnable() {
-    return autocompile_;
+void LLLSetMaxCompileSize (lua_State *L, int instructions) {
+    SETTINGS(L).maxcompilesize = instructions;
 }
 
-void LLLSetCallsToCompile (int calls) {
-    callstocompile_ = calls;
+int LLLGetMaxCompileSize (lua_State *L) {
+    return SETTINGS(L).maxcompilesize;
 }
 
-int LLLGetCallsToCompile() {
-    return callstocompile_;
+void LLLSetMaxCompileFailures (lua_State *L, int failures) {
+    SETTINGS(L).maxcompilefailures = failures;
+}
+
+int LLLGetMaxCompileFailures (lua_State *L) {
+    return SETTINGS(L).maxcompilefailures;
+}
+
+void LLLSetCompileBudget (lua_State *L, int milliseconds) {
+    SETTINGS(L).compilebudget = milliseconds;
+}
+
+int LLLGetCompileBudget (lua_State *L) {
+    return SETTINGS(L).compilebudget;
+}
+
+void LLLSetCodeMemoryLimit (lua_State *L, size_t bytes) {
+    SETTINGS(L).codememorylimit = bytes;
+}
+
+size_t LLLGetCodeMemoryLimit (lua_State *L) {
+    return SETTINGS(L).codememorylimit;
+}
+
+size_t LLLGetCodeMemory (lua_State *L) {
+    return lll::State::Get(L).codememory_;
+}
+
+void LLLSetVectorizeEnable (lua_State *L, int enable) {
+    SETTINGS(L).vectorize = enable;
+}
+
+int LLLIsVectorizeEnable (lua_State *L) {
+    return SETTINGS(L).vectorize;
+}
+
+void LLLSetTraceEnable (lua_State *L, int enable) {
+    G(L)->llltrace = enable != 0;
+}
+
+int LLLIsTraceEnable (lua_State *L) {
+    return G(L)->llltrace;
+}
+
+void LLLSetIterationsToTrace (lua_State *L, int iterations) {
+    SETTINGS(L).iterationstotrace = iterations;
+}
+
+int LLLGetIterationsToTrace (lua_State *L) {
+    return SETTINGS(L).iterationstotrace;
+}
+
+/*
+** Trace mode
+** A single trace is recorded at a time, by the thread that started it; the
+** other threads clear the record bit of their hook masks when they see it
+** (it is inherited by new threads), so the recorder is never accessed by
+** another thread. The loops whose trace is aborted or can't be compiled are
+** left to the interpreter
+*/
+static void stoprecording (lll::State& state, lua_State *L) {
+    if (L == state.recorder_)
+        L->hookmask &= ~LLL_MASKRECORD;
+    state.recorder_ = nullptr;
+    state.recording_ = lll::Trace();
+}
+
+void LLLTraceLoop (lua_State *L, CallInfo *ci) {
+    auto& state = lll::State::Get(L);
+    auto& loop = state.loops_[ci->u.l.savedpc];
+    Proto *p = clLvalue(ci->func)->p;
+    if (loop.engine) {
+        auto f = reinterpret_cast<int (*)(lua_State*, LClosure*)>(
+                loop.engine->GetFunction());
+        ci->u.l.savedpc = p->code + f(L, clLvalue(ci->func));
+        return;
+    }
+    if (loop.failed)
+        return;
+    if (state.recording_.IsActive()) {
+        /* a hook set by the debug library clears the record bit */
+        if (L == state.recorder_ && (L->hookmask & LLL_MASKRECORD))
+            return;
+        stoprecording(state, L);
+    }
+    if (++loop.iterations >= state.settings_.iterationstotrace) {
+        state.recording_ = lll::Trace(p, pcRel(ci->u.l.savedpc, p) + 1);
+        state.recorder_ = L;
+        L->hookmask |= LLL_MASKRECORD;
+    }
+}
+
+void LLLRecordTrace (lua_State *L, CallInfo *ci) {
+    auto& state = lll::State::Get(L);
+    if (L != state.recorder_) {
+        L->hookmask &= ~LLL_MASKRECORD;
+        return;
+    }
+    auto& trace = state.recording_;
+    auto status = trace.Record(ci);
+    if (status == lll::Trace::CONTINUE)
+        return;
+    auto& loop = state.loops_[trace.proto_->code + trace.start_];
+    if (status == lll::Trace::CLOSED) {
+        lll::TraceCompiler compiler(L, trace);
+        if (compiler.Compile())
+            loop.engine.reset(compiler.GetEngine());
+        else
+            loop.failed = true;
+    } else {
+        loop.failed = true;
+    }
+    stoprecording(state, L);
+}
+
+void LLLSetDebugInfoEnable (lua_State *L, int enable) {
+    SETTINGS(L).debuginfo = enable;
+}
+
+int LLLIsDebugInfoEnable (lua_State *L) {
+    return SETTINGS(L).debuginfo;
+}
+
+void LLLSetRetainIREnable (lua_State *L, int enable) {
+    SETTINGS(L).retainir = enable;
+}
+
+int LLLIsRetainIREnable (lua_State *L) {
+    return SETTINGS(L).retainir;
+}
+
+int LLLGetJitLine (Proto *p, const void *address) {
+    return lll::PerfListener::GetLine(p, reinterpret_cast<uintptr_t>(address));
+}
+
+void LLLSetPerfMapEnable (int enable) {
+    perfmap_ = enable;
+}
+
+int LLLIsPerfMapEnable() {
+    return perfmap_;
+}
+
+void LLLSetJitDumpEnable (int enable) {
+    jitdump_ = enable;
+}
+
+int LLLIsJitDumpEnable() {
+    return jitdump_;
+}
+
+lua_CFunction LLLDeclareFFI (lua_State *L, const char *decl, const char *lib,
+                             char **errmsg) {
+    std::string error;
+    auto function = lll::FFI::Declare(lll::State::Get(L).runtime_, decl, lib,
+            error);
+    if (!function)
+        writeerror(L, errmsg, error.c_str());
+    return function;
+}
+
+void LLLCountEntry (lua_State *L, Proto *p) {
+    auto& state = lll::State::Get(L);
+    auto code = GETCODE(p);
+    state.stats_.AddEntry(code != NULL);
+    if (code)
+        code->lastuse = ++state.clock_;
+}
+
+void LLLPushStats (lua_State *L) {
+    lll::State::Get(L).stats_.Push(L);
 }
 
 int LLLIsCompiled (Proto *p) {
-    return GETENGINE(p) != NULL;
+    return GETCODE(p) != NULL;
 }
 
 void LLLFreeEngine (lua_State *L, Proto *p) {
-    (void)L;
-    delete GETENGINE(p);
+    auto statep = lll::State::Find(L);
+    if (!statep)
+        return;
+    auto& state = *statep;
+    freeengine(state, p);
+    state.loops_.erase(state.loops_.lower_bound(p->code),
+            state.loops_.lower_bound(p->code + p->sizecode));
+    if (state.recording_.proto_ == p)
+        stoprecording(state, L);
+    state.stats_.Remove(p);
+    state.policies_.erase(p);
+}
+
+int LLLOpenState (lua_State *L) {
+    return !lll::State::Open(L);
+}
+
+void LLLCloseState (lua_State *L) {
+    lll::State::Close(L);
 }
 
 void LLLDump (Proto *p) {
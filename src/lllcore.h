@@ -27,6 +27,8 @@
 **
 ** lllcore.h
 ** LLL C interface
+** The settings and the compiled functions belong to each Lua state (states of
+** different threads compile independently), except the perf outputs
 */
 
 #ifndef LLLCORE_H
@@ -43,17 +45,149 @@ int LLLCompile (lua_State *L, Proto *p, char **errmsg);
 /* Also compiles all children functions */
 int LLLCompileAll (lua_State *L, Proto *p, char **errmsg);
 
+/* Compiles a function that reached the number of calls to compile, if the
+** compilation policy allows it; the functions that fail are retried after
+** an exponential number of calls and are blacklisted after some failures */
+void LLLAutoCompile (lua_State *L, Proto *p);
+
+/* Sets the maximum number of clones of a compiled function, specialized to
+** the tags of its arguments; only the functions compiled while it is greater
+** than 0 are cloned (0 disables the cloning) */
+void LLLSetMaxClones (lua_State *L, int clones);
+
+/* Obtains the maximum number of clones of a compiled function */
+int LLLGetMaxClones (lua_State *L);
+
+/* Calls the clone of the tags of the arguments or the generic code of a
+** cloned function; it is the entry of the function while it has no clones or
+** more than one, and a clone calls it when the tags don't match */
+int LLLDispatchClone (lua_State *L, LClosure *cl);
+
+/* Returns whether the auto compilation of the function was given up */
+int LLLIsBlacklisted (lua_State *L, Proto *p);
+
 /* Enables or disables the auto compilation */
-void LLLSetAutoCompileEnable (int enable);
+void LLLSetAutoCompileEnable (lua_State *L, int enable);
 
 /* Returns whether the auto compilation is enable */
-int LLLIsAutoCompileEnable();
+int LLLIsAutoCompileEnable (lua_State *L);
 
 /* Sets the number of calls required to auto-compile a function */
-void LLLSetCallsToCompile (int calls);
+void LLLSetCallsToCompile (lua_State *L, int calls);
 
 /* Obtains the number of calls required to auto-compile a function */
-int LLLGetCallsToCompile();
+int LLLGetCallsToCompile (lua_State *L);
+
+/* Sets the number of instructions that add the number of calls to compile
+** to the threshold of a function (0 disables the scaling) */
+void LLLSetCompileSizeScale (lua_State *L, int instructions);
+
+/* Obtains the number of instructions of the threshold scaling */
+int LLLGetCompileSizeScale (lua_State *L);
+
+/* Sets the maximum number of instructions of an auto-compiled function
+** (0 disables the limit) */
+void LLLSetMaxCompileSize (lua_State *L, int instructions);
+
+/* Obtains the maximum number of instructions of an auto-compiled function */
+int LLLGetMaxCompileSize (lua_State *L);
+
+/* Sets the number of failures that blacklists a function */
+void LLLSetMaxCompileFailures (lua_State *L, int failures);
+
+/* Obtains the number of failures that blacklists a function */
+int LLLGetMaxCompileFailures (lua_State *L);
+
+/* Sets the milliseconds of auto compilation per second (0 disables the
+** budget) */
+void LLLSetCompileBudget (lua_State *L, int milliseconds);
+
+/* Obtains the milliseconds of auto compilation per second */
+int LLLGetCompileBudget (lua_State *L);
+
+/* Sets the maximum size in bytes of the native code; the least recently
+** used compiled functions are uncompiled when it is exceeded (0 disables the
+** limit) */
+void LLLSetCodeMemoryLimit (lua_State *L, size_t bytes);
+
+/* Obtains the maximum size of the native code */
+size_t LLLGetCodeMemoryLimit (lua_State *L);
+
+/* Obtains the size of the native code of the compiled functions */
+size_t LLLGetCodeMemory (lua_State *L);
+
+/* Enables or disables the vectorization of loops over array parts */
+void LLLSetVectorizeEnable (lua_State *L, int enable);
+
+/* Returns whether the vectorization is enable */
+int LLLIsVectorizeEnable (lua_State *L);
+
+/* Hook mask bit set while the interpreter records a trace (see llltrace.h) */
+#define LLL_MASKRECORD (1 << 4)
+
+/* Enables or disables the trace mode: the path of an iteration of the hot
+** numeric for loops is recorded and compiled */
+void LLLSetTraceEnable (lua_State *L, int enable);
+
+/* Returns whether the trace mode is enable */
+int LLLIsTraceEnable (lua_State *L);
+
+/* Sets the number of iterations required to trace a loop */
+void LLLSetIterationsToTrace (lua_State *L, int iterations);
+
+/* Obtains the number of iterations required to trace a loop */
+int LLLGetIterationsToTrace (lua_State *L);
+
+/* Called by the interpreter when a FORLOOP jumps back; runs the compiled
+** trace of the loop or counts the iteration (ci->u.l.savedpc may change) */
+void LLLTraceLoop (lua_State *L, CallInfo *ci);
+
+/* Records the instruction fetched by the interpreter (LLL_MASKRECORD) */
+void LLLRecordTrace (lua_State *L, CallInfo *ci);
+
+/* Enables or disables the DWARF line info of the compiled functions; the
+** initial value is set by the LLL_DEBUGINFO env variable */
+void LLLSetDebugInfoEnable (lua_State *L, int enable);
+
+/* Returns whether the debug info is enable */
+int LLLIsDebugInfoEnable (lua_State *L);
+
+/* Enables or disables the retention of the IR of the compiled functions,
+** required by LLLDump and LLLWrite (the IR is also retained with debug info) */
+void LLLSetRetainIREnable (lua_State *L, int enable);
+
+/* Returns whether the IR is retained */
+int LLLIsRetainIREnable (lua_State *L);
+
+/* Returns the line of the native $address inside the compiled function of $p
+** or -1 if it is unknown (the lines are known only with debug info) */
+int LLLGetJitLine (Proto *p, const void *address);
+
+/* Enables or disables the perf map (/tmp/perf-<pid>.map) of the compiled
+** functions; the initial value is set by the LLL_PERFMAP env variable */
+void LLLSetPerfMapEnable (int enable);
+
+/* Returns whether the perf map is enable */
+int LLLIsPerfMapEnable();
+
+/* Enables or disables the jitdump file (/tmp/jit-<pid>.dump) of the compiled
+** functions; the initial value is set by the LLL_JITDUMP env variable */
+void LLLSetJitDumpEnable (int enable);
+
+/* Returns whether the jitdump is enable */
+int LLLIsJitDumpEnable();
+
+/* Declares a native function with the C prototype $decl (e.g. "double
+** f(double, int)") found in the library $lib (or in the process if NULL);
+** returns NULL if it fails */
+lua_CFunction LLLDeclareFFI (lua_State *L, const char *decl, const char *lib,
+                             char **errmsg);
+
+/* Counts a call of a Lua function, compiled or interpreted */
+void LLLCountEntry (lua_State *L, Proto *p);
+
+/* Pushes the table with the statistics of the compiler */
+void LLLPushStats (lua_State *L);
 
 /* Returns whether the function is compiled */
 int LLLIsCompiled (Proto *p);
@@ -61,6 +195,21 @@ int LLLIsCompiled (Proto *p);
 /* Destroys the engine */
 void LLLFreeEngine (lua_State *L, Proto *p);
 
+/* Creates the LLL data of the state (lua_newstate)
+** Returns 1 if it fails */
+int LLLOpenState (lua_State *L);
+
+/* Destroys the LLL data of the state (lua_close) */
+void LLLCloseState (lua_State *L);
+
+/* Builtin iterators, the generic for over them is specialized */
+LUAI_FUNC int luaB_next (lua_State *L);
+LUAI_FUNC int luaB_ipairsaux (lua_State *L);
+
+/* Math functions compiled inline */
+LUAI_FUNC int math_floor (lua_State *L);
+LUAI_FUNC int math_sqrt (lua_State *L);
+
 /* Dumps the LLMV function (debug) */
 void LLLDump (Proto *p);
 
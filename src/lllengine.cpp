@@ -15,24 +15,87 @@
 
 #include "lllengine.h"
 
+namespace {
+
+// Memory manager of an ExecutionEngine that doesn't own the memory
+class ForwardingMemoryManager : public llvm::RTDyldMemoryManager {
+public:
+    ForwardingMemoryManager(llvm::SectionMemoryManager& memory) :
+        memory_(memory) {
+    }
+
+    virtual uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment,
+            unsigned id, llvm::StringRef name) {
+        return memory_.allocateCodeSection(size, alignment, id, name);
+    }
+
+    virtual uint8_t* allocateDataSection(uintptr_t size, unsigned alignment,
+            unsigned id, llvm::StringRef name, bool readonly) {
+        return memory_.allocateDataSection(size, alignment, id, name,
+                readonly);
+    }
+
+    virtual bool finalizeMemory(std::string* error) {
+        return memory_.finalizeMemory(error);
+    }
+
+private:
+    llvm::SectionMemoryManager& memory_;
+};
+
+}
+
 namespace lll {
 
 Engine::Engine(llvm::ExecutionEngine* ee, llvm::Module* module,
-        llvm::Function* function) :
+        llvm::Function* function, llvm::SectionMemoryManager* memory) :
+    memory_(memory),
     ee_(ee),
     module_(module),
-    function_(ee->getPointerToFunction(function)) {
+    function_(ee->getPointerToFunction(function)),
+    codesize_(0) {
+}
+
+llvm::RTDyldMemoryManager* Engine::CreateMemoryManager(
+        llvm::SectionMemoryManager& memory) {
+    return new ForwardingMemoryManager(memory);
+}
+
+void Engine::ReleaseIR() {
+    if (!memory_)
+        return;
+    ee_.reset();
+    module_ = nullptr;
+}
+
+bool Engine::HasIR() {
+    return module_ != nullptr;
 }
 
 void* Engine::GetFunction() {
     return function_;
 }
 
+void Engine::SetCodeSize(uint64_t codesize) {
+    codesize_ = codesize;
+}
+
+uint64_t Engine::GetCodeSize() {
+    return codesize_;
+}
+
 void Engine::Dump() {
-    module_->dump();
+    if (module_)
+        module_->dump();
+    else
+        std::cerr << "Engine::Dump: The IR wasn't retained\n";
 }
 
 void Engine::Write(const std::string& path) {
+    if (!module_) {
+        std::cerr << "Engine::Write: The IR wasn't retained\n";
+        return;
+    }
     std::string module_str;
     llvm::raw_string_ostream module_os(module_str);
     module_->print(module_os, nullptr);
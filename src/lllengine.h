@@ -10,30 +10,54 @@
 #ifndef LLLENGINE_H
 #define LLLENGINE_H
 
+#include <cstdint>
 #include <memory>
 
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
 
 namespace lll {
 
 class Engine {
 public:
+    // Constructor, $memory is the memory of the native code given to $ee by
+    // CreateMemoryManager (null if $ee owns the code)
     Engine(llvm::ExecutionEngine* ee, llvm::Module* module,
-            llvm::Function* function);
+            llvm::Function* function,
+            llvm::SectionMemoryManager* memory = nullptr);
+
+    // Creates the memory manager of an ExecutionEngine that allocates the
+    // native code in $memory, so the code can outlive the ExecutionEngine
+    static llvm::RTDyldMemoryManager* CreateMemoryManager(
+            llvm::SectionMemoryManager& memory);
+
+    // Frees the ExecutionEngine and the IR, keeping only the native code
+    // (only if the engine owns the memory of the code)
+    void ReleaseIR();
+
+    // Returns whether the IR is retained
+    bool HasIR();
 
     // Gets the compiled function
     void* GetFunction();
 
-    // Dumps the compiled modules
+    // Sets/gets the size of the native code
+    void SetCodeSize(uint64_t codesize);
+    uint64_t GetCodeSize();
+
+    // Dumps the compiled modules (only if the IR is retained)
     void Dump();
 
-    // Writes the bytecode and asm files
+    // Writes the bytecode and asm files (only if the IR is retained)
     void Write(const std::string& path);
 
 private:
+    // Declared before $ee_, so the code is freed after the ExecutionEngine
+    std::unique_ptr<llvm::SectionMemoryManager> memory_;
     std::unique_ptr<llvm::ExecutionEngine> ee_;
     llvm::Module* module_;
     void* function_;
+    uint64_t codesize_;
 };
 
 }
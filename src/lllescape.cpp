@@ -0,0 +1,257 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllescape.cpp
+*/
+
+#include <algorithm>
+
+#include "lllbytecode.h"
+#include "lllescape.h"
+
+extern "C" {
+#include "lprefix.h"
+#include "lobject.h"
+#include "lopcodes.h"
+}
+
+namespace lll {
+
+Escape::Escape(Proto* proto) :
+    proto_(proto) {
+    ComputeOpenUpvalues();
+    ComputeLiveness();
+    FindLeaders();
+    FindVirtualTables();
+}
+
+bool Escape::IsLive(int pc, int reg) {
+    return pc < proto_->sizecode && reg < proto_->maxstacksize &&
+           live_[pc][reg];
+}
+
+const Escape::VirtualTable* Escape::GetVirtualTable(int pc) {
+    for (auto& vt : tables_)
+        if (vt.newtable == pc)
+            return &vt;
+    return nullptr;
+}
+
+const Escape::VirtualTable* Escape::GetVirtualTableUse(int pc,
+        const Use** use) {
+    for (auto& vt : tables_) {
+        for (auto& u : vt.uses) {
+            if (u.pc == pc) {
+                *use = &u;
+                return &vt;
+            }
+        }
+    }
+    return nullptr;
+}
+
+std::vector<const Escape::VirtualTable*> Escape::GetEscapes(int pc) {
+    std::vector<const VirtualTable*> escapes;
+    for (auto& vt : tables_)
+        if (vt.escape == pc)
+            escapes.push_back(&vt);
+    return escapes;
+}
+
+void Escape::ComputeOpenUpvalues() {
+    int n = proto_->sizecode;
+    int nregs = proto_->maxstacksize;
+    open_.assign(n, std::vector<bool>(nregs, false));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int pc = 0; pc < n; ++pc) {
+            auto open = open_[pc];
+            Instruction i = proto_->code[pc];
+            if (GET_OPCODE(i) == OP_CLOSURE) {
+                Proto* p = proto_->p[GETARG_Bx(i)];
+                for (int u = 0; u < p->sizeupvalues; ++u)
+                    if (p->upvalues[u].instack && p->upvalues[u].idx < nregs)
+                        open[p->upvalues[u].idx] = true;
+            } else if (GET_OPCODE(i) == OP_JMP && GETARG_A(i) > 0) {
+                for (int r = GETARG_A(i) - 1; r < nregs; ++r)
+                    open[r] = false;
+            }
+            for (int s : Bytecode::GetSuccessors(proto_, pc)) {
+                if (s >= n)
+                    continue;
+                for (int r = 0; r < nregs; ++r) {
+                    if (open[r] && !open_[s][r]) {
+                        open_[s][r] = true;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Escape::ComputeLiveness() {
+    int n = proto_->sizecode;
+    int nregs = proto_->maxstacksize;
+    live_.assign(n, std::vector<bool>(nregs, false));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int pc = n - 1; pc >= 0; --pc) {
+            std::vector<bool> live(nregs, false);
+            for (int s : Bytecode::GetSuccessors(proto_, pc))
+                if (s < n)
+                    for (int r = 0; r < nregs; ++r)
+                        live[r] = live[r] || live_[s][r];
+            int first, last;
+            if (Bytecode::GetKilledRegisters(proto_, pc, &first, &last))
+                for (int r = first; r <= last && r < nregs; ++r)
+                    live[r] = false;
+            for (int r : Bytecode::GetReadRegisters(proto_, pc))
+                if (r < nregs)
+                    live[r] = true;
+            for (int r = 0; r < nregs; ++r)
+                live[r] = live[r] || open_[pc][r];
+            if (live != live_[pc]) {
+                live_[pc] = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+void Escape::FindLeaders() {
+    leaders_.assign(proto_->sizecode, false);
+    for (int pc = 0; pc < proto_->sizecode; ++pc)
+        for (int s : Bytecode::GetSuccessors(proto_, pc))
+            if (s != pc + 1 && s < proto_->sizecode)
+                leaders_[s] = true;
+}
+
+void Escape::FindVirtualTables() {
+    for (int pc = 0; pc < proto_->sizecode; ++pc) {
+        if (GET_OPCODE(proto_->code[pc]) != OP_NEWTABLE)
+            continue;
+        VirtualTable vt;
+        if (FollowTable(pc, &vt) && !vt.uses.empty())
+            tables_.push_back(vt);
+    }
+}
+
+bool Escape::FollowTable(int newtable, VirtualTable* vt) {
+    vt->newtable = newtable;
+    vt->reg = GETARG_A(proto_->code[newtable]);
+    vt->escape = -1;
+    for (int pc = newtable + 1; pc < proto_->sizecode; ++pc) {
+        if (!IsLive(pc, vt->reg))
+            return true;
+
+        // A closure may read the register of the table at any call
+        if (open_[pc][vt->reg])
+            return false;
+
+        // The table can only be created in a block that isn't reached by
+        // other paths
+        if (leaders_[pc])
+            return false;
+
+        // The table dies at an access that overwrites its register
+        Use use;
+        if (GetFieldAccess(pc, vt, &use)) {
+            vt->uses.push_back(use);
+            if (IsWritten(pc, vt->reg))
+                return true;
+            continue;
+        }
+
+        auto reads = Bytecode::GetReadRegisters(proto_, pc);
+        auto successors = Bytecode::GetSuccessors(proto_, pc);
+        bool isread = std::find(reads.begin(), reads.end(), vt->reg) !=
+                      reads.end();
+        bool isjump = successors.size() != 1 || successors[0] != pc + 1;
+        if (isread || isjump) {
+            vt->escape = pc;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Escape::IsWritten(int pc, int reg) {
+    int first, last;
+    return Bytecode::GetKilledRegisters(proto_, pc, &first, &last) &&
+           reg >= first && reg <= last;
+}
+
+bool Escape::GetFieldAccess(int pc, VirtualTable* vt, Use* use) {
+    Instruction i = proto_->code[pc];
+    int field;
+    use->pc = pc;
+    switch (GET_OPCODE(i)) {
+        case OP_GETTABLE:
+            if (GETARG_B(i) != vt->reg || !GetField(vt, GETARG_C(i), &field))
+                return false;
+            use->fields.push_back(field);
+            return true;
+        case OP_SETTABLE: {
+            int c = GETARG_C(i);
+            if (GETARG_A(i) != vt->reg || (!ISK(c) && c == vt->reg) ||
+                !GetField(vt, GETARG_B(i), &field))
+                return false;
+            use->fields.push_back(field);
+            return true;
+        }
+        case OP_SETLIST: {
+            int b = GETARG_B(i);
+            int c = GETARG_C(i);
+            if (GETARG_A(i) != vt->reg || b == 0)
+                return false;
+            if (c == 0)
+                c = GETARG_Ax(proto_->code[pc + 1]);
+            for (int j = 1; j <= b; ++j) {
+                lua_Integer key = (c - 1) * LFIELDS_PER_FLUSH + j;
+                use->fields.push_back(GetIntField(vt, key));
+            }
+            return true;
+        }
+        default:
+            break;
+    }
+    return false;
+}
+
+bool Escape::GetField(VirtualTable* vt, int karg, int* field) {
+    if (!ISK(karg))
+        return false;
+    int k = INDEXK(karg);
+    TValue* o = &proto_->k[k];
+    if (ttisinteger(o)) {
+        *field = GetIntField(vt, ivalue(o));
+        return true;
+    } else if (ttisstring(o)) {
+        for (size_t f = 0; f < vt->keys.size(); ++f) {
+            if (!vt->keys[f].isint && vt->keys[f].k == k) {
+                *field = f;
+                return true;
+            }
+        }
+        vt->keys.push_back({false, 0, k});
+        *field = vt->keys.size() - 1;
+        return true;
+    }
+    return false;
+}
+
+int Escape::GetIntField(VirtualTable* vt, lua_Integer i) {
+    for (size_t f = 0; f < vt->keys.size(); ++f)
+        if (vt->keys[f].isint && vt->keys[f].i == i)
+            return f;
+    vt->keys.push_back({true, i, -1});
+    return vt->keys.size() - 1;
+}
+
+}
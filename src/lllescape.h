@@ -0,0 +1,108 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllescape.h
+** Escape analysis of the tables created by a proto. A table that is only
+** accessed with constant keys before it dies or escapes is kept in scalar
+** values (virtual table) and it is only created when it escapes.
+*/
+
+#ifndef LLLESCAPE_H
+#define LLLESCAPE_H
+
+#include <vector>
+
+extern "C" {
+#include "lua.h"
+struct Proto;
+}
+
+namespace lll {
+
+class Escape {
+public:
+    // Constant key of a virtual table field
+    struct Key {
+        bool isint;
+        lua_Integer i;  // Integer key
+        int k;          // Index of the string constant
+    };
+
+    // Instruction that accesses the fields of a virtual table
+    struct Use {
+        int pc;
+        std::vector<int> fields;
+    };
+
+    // Table created by the NEWTABLE at $newtable and stored at $reg; $escape
+    // is the instruction that requires the real table (-1 if the table dies
+    // before escaping)
+    struct VirtualTable {
+        int newtable;
+        int reg;
+        std::vector<Key> keys;
+        std::vector<Use> uses;
+        int escape;
+    };
+
+    // Constructor, analyses $proto
+    Escape(Proto* proto);
+
+    // Returns whether $reg may be read before being written from $pc on
+    bool IsLive(int pc, int reg);
+
+    // Obtains the virtual table created at $pc (nullptr if there is none)
+    const VirtualTable* GetVirtualTable(int pc);
+
+    // Obtains the virtual table accessed at $pc (nullptr if there is none)
+    const VirtualTable* GetVirtualTableUse(int pc, const Use** use);
+
+    // Obtains the virtual tables that must be created before $pc
+    std::vector<const VirtualTable*> GetEscapes(int pc);
+
+private:
+    // Computes the registers captured by open upvalues at each instruction
+    // (from the CLOSURE that captures them to the JMP that closes them)
+    void ComputeOpenUpvalues();
+
+    // Computes the live registers at each instruction; a register captured
+    // by an open upvalue is live, since the closure may read it at any call
+    void ComputeLiveness();
+
+    // Finds the instructions that are jump targets
+    void FindLeaders();
+
+    // Finds the tables that can be kept virtual
+    void FindVirtualTables();
+
+    // Follows the table created at $newtable until it dies or escapes;
+    // returns false if it can't be virtual
+    bool FollowTable(int newtable, VirtualTable* vt);
+
+    // Returns whether the instruction at $pc accesses the table only with
+    // constant keys and obtains the accessed fields
+    bool GetFieldAccess(int pc, VirtualTable* vt, Use* use);
+
+    // Returns whether the instruction at $pc writes $reg
+    bool IsWritten(int pc, int reg);
+
+    // Obtains the field of the constant key $karg, adding it if necessary
+    bool GetField(VirtualTable* vt, int karg, int* field);
+
+    // Obtains the field of the integer key $i, adding it if necessary
+    int GetIntField(VirtualTable* vt, lua_Integer i);
+
+    Proto* proto_;
+    std::vector<std::vector<bool>> open_;
+    std::vector<std::vector<bool>> live_;
+    std::vector<bool> leaders_;
+    std::vector<VirtualTable> tables_;
+};
+
+}
+
+#endif
+
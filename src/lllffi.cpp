@@ -0,0 +1,362 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllffi.cpp
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <dlfcn.h>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+
+#define LLL_USE_MCJIT
+#ifdef LLL_USE_MCJIT
+#include <llvm/ExecutionEngine/MCJIT.h>
+#else
+#include <llvm/ExecutionEngine/JIT.h>
+#endif
+
+#include "lllengine.h"
+#include "lllffi.h"
+#include "lllperf.h"
+#include "lllruntime.h"
+
+namespace {
+
+// Declarations indexed by library and prototype
+std::map<std::string, std::unique_ptr<lll::FFI::Function>> declarations_;
+
+// Declarations indexed by thunk
+std::map<lua_CFunction, lll::FFI::Function*> thunks_;
+
+// Guards the declarations (shared by the states of all threads)
+std::mutex mutex_;
+
+std::string Trim(const std::string& s) {
+    auto begin = s.find_first_not_of(" \t\n");
+    if (begin == std::string::npos)
+        return "";
+    auto end = s.find_last_not_of(" \t\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+bool IsIdentifier(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+}
+
+namespace lll {
+
+lua_CFunction FFI::Declare(Runtime& rt, const std::string& decl,
+        const char* lib, std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = std::string(lib ? lib : "") + ":" + decl;
+    auto declaration = declarations_.find(key);
+    if (declaration != declarations_.end())
+        return declaration->second->thunk;
+
+    std::unique_ptr<Function> function(new Function());
+    if (!Parse(decl, *function, error))
+        return nullptr;
+
+    // Libraries are never closed since the declarations are never freed
+    void* handle = dlopen(lib, RTLD_NOW | RTLD_GLOBAL);
+    if (!handle) {
+        error = dlerror();
+        return nullptr;
+    }
+    function->address = dlsym(handle, function->name.c_str());
+    if (!function->address) {
+        error = "symbol '" + function->name + "' not found";
+        return nullptr;
+    }
+
+    if (!CreateThunk(rt, *function, error))
+        return nullptr;
+    auto thunk = function->thunk;
+    thunks_[thunk] = function.get();
+    declarations_[key] = std::move(function);
+    return thunk;
+}
+
+const FFI::Function* FFI::Find(lua_CFunction thunk) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto function = thunks_.find(thunk);
+    return function != thunks_.end() ? function->second : nullptr;
+}
+
+bool FFI::IsUnsigned(Type type) {
+    return type == UINT || type == ULONG;
+}
+
+llvm::Type* FFI::GetLLVMType(Runtime& rt, Type type) {
+    auto& context = rt.GetContext();
+    switch (type) {
+        case VOID: return llvm::Type::getVoidTy(context);
+        case INT: case UINT: return rt.MakeIntT(sizeof(int));
+        case LONG: case ULONG: return rt.MakeIntT(sizeof(int64_t));
+        case FLOAT: return llvm::Type::getFloatTy(context);
+        case DOUBLE: return llvm::Type::getDoubleTy(context);
+        case STRING: case POINTER: break;
+    }
+    return llvm::PointerType::get(rt.MakeIntT(sizeof(char)), 0);
+}
+
+llvm::FunctionType* FFI::GetLLVMFunctionType(Runtime& rt,
+        const Function& function) {
+    std::vector<llvm::Type*> args;
+    for (auto arg : function.args)
+        args.push_back(GetLLVMType(rt, arg));
+    return llvm::FunctionType::get(GetLLVMType(rt, function.ret), args,
+            false);
+}
+
+bool FFI::Parse(const std::string& decl, Function& function,
+        std::string& error) {
+    auto open = decl.find('(');
+    auto close = decl.rfind(')');
+    if (open == std::string::npos || close == std::string::npos ||
+        close < open || !Trim(decl.substr(close + 1)).empty()) {
+        error = "malformed declaration '" + decl + "'";
+        return false;
+    }
+
+    auto head = Trim(decl.substr(0, open));
+    size_t namebegin = head.size();
+    while (namebegin > 0 && IsIdentifier(head[namebegin - 1]))
+        --namebegin;
+    function.name = head.substr(namebegin);
+    if (function.name.empty() || isdigit(function.name[0])) {
+        error = "missing function name in '" + decl + "'";
+        return false;
+    }
+    auto ret = head.substr(0, namebegin);
+    if (!ParseType(ret, function.ret)) {
+        error = "unknown type '" + Trim(ret) + "'";
+        return false;
+    }
+
+    auto params = Trim(decl.substr(open + 1, close - open - 1));
+    if (params.empty() || params == "void")
+        return true;
+    std::stringstream ss(params);
+    std::string param;
+    while (std::getline(ss, param, ',')) {
+        Type type;
+        if (!ParseType(param, type) || type == VOID) {
+            error = "invalid parameter type '" + Trim(param) + "'";
+            return false;
+        }
+        function.args.push_back(type);
+    }
+    return true;
+}
+
+bool FFI::ParseType(const std::string& name, Type& type) {
+    static const std::map<std::string, Type> types = {
+        {"void", VOID},
+        {"int", INT},
+        {"unsigned", UINT},
+        {"unsigned int", UINT},
+        {"long", LONG},
+        {"unsigned long", ULONG},
+        {"long long", LONG},
+        {"unsigned long long", ULONG},
+        {"size_t", ULONG},
+        {"int64_t", LONG},
+        {"uint64_t", ULONG},
+        {"float", FLOAT},
+        {"double", DOUBLE},
+    };
+
+    std::string base;
+    int pointers = 0;
+    std::string word;
+    std::stringstream ss(name);
+    while (ss >> word) {
+        for (auto c : word)
+            pointers += c == '*';
+        word.erase(std::remove(word.begin(), word.end(), '*'), word.end());
+        if (word.empty() || word == "const")
+            continue;
+        base += (base.empty() ? "" : " ") + word;
+    }
+
+    if (pointers > 0) {
+        type = (pointers == 1 && base == "char") ? STRING : POINTER;
+        return !base.empty();
+    }
+    auto t = types.find(base);
+    if (t == types.end())
+        return false;
+    type = t->second;
+    return true;
+}
+
+bool FFI::CreateThunk(Runtime& rt, Function& function, std::string& error) {
+    Runtime::InitializeTarget();
+    auto& context = rt.GetContext();
+    std::unique_ptr<llvm::Module> module(new llvm::Module("lll_ffi", context));
+    module->setTargetTriple(llvm::sys::getDefaultTargetTriple());
+    auto tint = rt.MakeIntT(sizeof(int));
+    auto type = llvm::FunctionType::get(tint, {rt.GetType("lua_State")},
+            false);
+    auto thunk = llvm::Function::Create(type, llvm::Function::ExternalLinkage,
+            "lllffi_" + function.name, module.get());
+    llvm::IRBuilder<> B(llvm::BasicBlock::Create(context, "entry", thunk));
+    auto state = &thunk->getArgumentList().front();
+    state->setName("state");
+
+    // Converts the arguments with the auxiliary library, so the errors are
+    // the same of the C functions
+    std::vector<llvm::Value*> args;
+    for (size_t i = 0; i < function.args.size(); ++i) {
+        auto index = llvm::ConstantInt::get(tint, i + 1);
+        auto argtype = GetLLVMType(rt, function.args[i]);
+        llvm::Value* arg = nullptr;
+        switch (function.args[i]) {
+            case INT: case UINT: case LONG: case ULONG: {
+                auto f = rt.GetFunction(module.get(), "luaL_checkinteger");
+                arg = B.CreateIntCast(B.CreateCall(f, {state, index}),
+                        argtype, !IsUnsigned(function.args[i]));
+                break;
+            }
+            case FLOAT: case DOUBLE: {
+                auto f = rt.GetFunction(module.get(), "luaL_checknumber");
+                arg = B.CreateFPCast(B.CreateCall(f, {state, index}),
+                        argtype);
+                break;
+            }
+            case STRING: {
+                auto f = rt.GetFunction(module.get(), "luaL_checklstring");
+                auto tlen = llvm::PointerType::get(rt.MakeIntT(sizeof(size_t)),
+                        0);
+                auto nolen = llvm::ConstantPointerNull::get(tlen);
+                arg = B.CreateCall(f, {state, index, nolen});
+                break;
+            }
+            case POINTER: {
+                auto f = rt.GetFunction(module.get(), "lua_touserdata");
+                arg = B.CreateCall(f, {state, index});
+                break;
+            }
+            case VOID:
+                break;
+        }
+        args.push_back(arg);
+    }
+
+    auto address = llvm::ConstantInt::get(rt.MakeIntT(sizeof(void*)),
+            reinterpret_cast<uintptr_t>(function.address));
+    auto callee = B.CreateIntToPtr(address,
+            llvm::PointerType::get(GetLLVMFunctionType(rt, function), 0));
+    auto result = B.CreateCall(callee, args);
+
+    int nresults = 1;
+    switch (function.ret) {
+        case VOID:
+            nresults = 0;
+            break;
+        case INT: case UINT: case LONG: {
+            auto f = rt.GetFunction(module.get(), "lua_pushinteger");
+            B.CreateCall(f, {state, B.CreateIntCast(result,
+                    rt.GetType("lua_Integer"), function.ret == INT ||
+                    function.ret == LONG)});
+            break;
+        }
+        case ULONG: {
+            // Values above the maximum integer are pushed as floats
+            auto pushint = llvm::BasicBlock::Create(context, "pushint", thunk);
+            auto pushfloat = llvm::BasicBlock::Create(context, "pushfloat",
+                    thunk);
+            auto pushed = llvm::BasicBlock::Create(context, "pushed", thunk);
+            auto zero = llvm::ConstantInt::get(result->getType(), 0);
+            B.CreateCondBr(B.CreateICmpSGE(result, zero), pushint, pushfloat);
+            B.SetInsertPoint(pushint);
+            B.CreateCall(rt.GetFunction(module.get(), "lua_pushinteger"),
+                    {state, result});
+            B.CreateBr(pushed);
+            B.SetInsertPoint(pushfloat);
+            B.CreateCall(rt.GetFunction(module.get(), "lua_pushnumber"),
+                    {state, B.CreateUIToFP(result, rt.GetType("lua_Number"))});
+            B.CreateBr(pushed);
+            B.SetInsertPoint(pushed);
+            break;
+        }
+        case FLOAT: case DOUBLE: {
+            auto f = rt.GetFunction(module.get(), "lua_pushnumber");
+            B.CreateCall(f, {state, B.CreateFPCast(result,
+                    rt.GetType("lua_Number"))});
+            break;
+        }
+        case STRING: {
+            auto f = rt.GetFunction(module.get(), "lua_pushstring");
+            B.CreateCall(f, {state, result});
+            break;
+        }
+        case POINTER: {
+            auto f = rt.GetFunction(module.get(), "lua_pushlightuserdata");
+            B.CreateCall(f, {state, result});
+            break;
+        }
+    }
+    B.CreateRet(llvm::ConstantInt::get(tint, nresults));
+
+    llvm::raw_string_ostream error_os(error);
+    if (llvm::verifyModule(*module, &error_os)) {
+        error_os.flush();
+        return false;
+    }
+
+    auto modulep = module.get();
+#ifdef LLL_USE_MCJIT
+    std::unique_ptr<llvm::SectionMemoryManager> memory(
+            new llvm::SectionMemoryManager());
+#else
+    std::unique_ptr<llvm::SectionMemoryManager> memory;
+#endif
+    auto engine = llvm::EngineBuilder(module.release())
+            .setErrorStr(&error)
+            .setEngineKind(llvm::EngineKind::JIT)
+#ifdef LLL_USE_MCJIT
+            .setUseMCJIT(true)
+            .setMCJITMemoryManager(Engine::CreateMemoryManager(*memory))
+#else
+            .setUseMCJIT(false)
+#endif
+            .create();
+    if (!engine)
+        return false;
+    PerfListener perf("lllffi:" + function.name);
+    bool announce = PerfListener::IsEnabled();
+    if (announce)
+        engine->RegisterJITEventListener(&perf);
+    engine->finalizeObject();
+    if (announce)
+        engine->UnregisterJITEventListener(&perf);
+    function.engine.reset(new Engine(engine, modulep, thunk,
+            memory.release()));
+    function.thunk = reinterpret_cast<lua_CFunction>(
+            function.engine->GetFunction());
+    function.engine->ReleaseIR();
+    return true;
+}
+
+}
+
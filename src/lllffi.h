@@ -0,0 +1,97 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllffi.h
+** Native functions declared from Lua with typed signatures
+*/
+
+#ifndef LLLFFI_H
+#define LLLFFI_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "lua.h"
+}
+
+namespace llvm {
+class FunctionType;
+class Type;
+}
+
+namespace lll {
+
+class Engine;
+class Runtime;
+
+class FFI {
+public:
+    // Types accepted in the declarations
+    enum Type {
+        VOID,       // void (return only)
+        INT,        // int
+        UINT,       // unsigned, unsigned int
+        LONG,       // long, long long, int64_t
+        ULONG,      // unsigned long, unsigned long long, size_t, uint64_t
+        FLOAT,      // float
+        DOUBLE,     // double
+        STRING,     // char*, const char*
+        POINTER     // any other pointer, passed as (light) userdata
+    };
+
+    // A declared native function
+    struct Function {
+        std::string name;
+        void* address;
+        Type ret;
+        std::vector<Type> args;
+
+        // Jitted lua_CFunction that converts the arguments and calls the
+        // native function (used by the interpreter and as fallback)
+        lua_CFunction thunk;
+        std::unique_ptr<Engine> engine;
+    };
+
+    // Declares a native function, $decl is a C prototype such as
+    // "double f(double, int)" and the symbol is searched in the library
+    // $lib (or in the process if $lib is null)
+    // Returns the thunk or null and sets $error if it fails
+    // Declarations are never freed and are shared by all states, so compiled
+    // code can keep the address of the thunk and the same declaration always
+    // returns the same thunk ($rt is used only to create the thunk)
+    static lua_CFunction Declare(Runtime& rt, const std::string& decl,
+                                 const char* lib, std::string& error);
+
+    // Obtains the function of a thunk (null if $thunk isn't one)
+    static const Function* Find(lua_CFunction thunk);
+
+    // Returns whether the integer type is unsigned
+    static bool IsUnsigned(Type type);
+
+    // Obtains the llvm types of a native function
+    static llvm::Type* GetLLVMType(Runtime& rt, Type type);
+    static llvm::FunctionType* GetLLVMFunctionType(Runtime& rt,
+                                                   const Function& function);
+
+private:
+    // Parses the declaration; returns false if it is malformed
+    static bool Parse(const std::string& decl, Function& function,
+                      std::string& error);
+
+    // Parses a type name
+    static bool ParseType(const std::string& name, Type& type);
+
+    // Creates the thunk of the function
+    static bool CreateThunk(Runtime& rt, Function& function,
+                            std::string& error);
+};
+
+}
+
+#endif
+
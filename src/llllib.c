@@ -14,7 +14,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "lllarray.h"
 #include "lllcore.h"
+#include "lllprofile.h"
 
 #include "lauxlib.h"
 #include "lobject.h"
@@ -47,31 +49,206 @@ static int lll_compile (lua_State *L) {
 
 static int lll_setautocompileenable (lua_State *L) {
     luaL_checktype(L, 1, LUA_TBOOLEAN);
-    LLLSetAutoCompileEnable(lua_toboolean(L, 1));
+    LLLSetAutoCompileEnable(L, lua_toboolean(L, 1));
     return 0;
 }
 
 static int lll_isautocompileenable (lua_State *L) {
-    lua_pushboolean(L, LLLIsAutoCompileEnable());
+    lua_pushboolean(L, LLLIsAutoCompileEnable(L));
     return 1;
 }
 
 static int lll_setcallstocompile (lua_State *L) {
     luaL_checktype(L, 1, LUA_TNUMBER);
-    LLLSetCallsToCompile(lua_tointeger(L, 1));
+    LLLSetCallsToCompile(L, lua_tointeger(L, 1));
     return 0;
 }
 
 static int lll_getcallstocompile (lua_State *L) {
-    lua_pushinteger(L, LLLGetCallsToCompile());
+    lua_pushinteger(L, LLLGetCallsToCompile(L));
     return 1;
 }
 
+static int lll_setcompilesizescale (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TNUMBER);
+    LLLSetCompileSizeScale(L, lua_tointeger(L, 1));
+    return 0;
+}
+
+static int lll_getcompilesizescale (lua_State *L) {
+    lua_pushinteger(L, LLLGetCompileSizeScale(L));
+    return 1;
+}
+
+static int lll_setmaxcompilesize (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TNUMBER);
+    LLLSetMaxCompileSize(L, lua_tointeger(L, 1));
+    return 0;
+}
+
+static int lll_getmaxcompilesize (lua_State *L) {
+    lua_pushinteger(L, LLLGetMaxCompileSize(L));
+    return 1;
+}
+
+static int lll_setmaxcompilefailures (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TNUMBER);
+    LLLSetMaxCompileFailures(L, lua_tointeger(L, 1));
+    return 0;
+}
+
+static int lll_getmaxcompilefailures (lua_State *L) {
+    lua_pushinteger(L, LLLGetMaxCompileFailures(L));
+    return 1;
+}
+
+static int lll_setcompilebudget (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TNUMBER);
+    LLLSetCompileBudget(L, lua_tointeger(L, 1));
+    return 0;
+}
+
+static int lll_getcompilebudget (lua_State *L) {
+    lua_pushinteger(L, LLLGetCompileBudget(L));
+    return 1;
+}
+
+static int lll_setcodememorylimit (lua_State *L) {
+    lua_Integer bytes = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, bytes >= 0, 1, "negative limit");
+    LLLSetCodeMemoryLimit(L, (size_t)bytes);
+    return 0;
+}
+
+static int lll_getcodememorylimit (lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)LLLGetCodeMemoryLimit(L));
+    return 1;
+}
+
+static int lll_getcodememory (lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)LLLGetCodeMemory(L));
+    return 1;
+}
+
+static int lll_setmaxclones (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TNUMBER);
+    LLLSetMaxClones(L, lua_tointeger(L, 1));
+    return 0;
+}
+
+static int lll_getmaxclones (lua_State *L) {
+    lua_pushinteger(L, LLLGetMaxClones(L));
+    return 1;
+}
+
+static int lll_setvectorizeenable (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    LLLSetVectorizeEnable(L, lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lll_isvectorizeenable (lua_State *L) {
+    lua_pushboolean(L, LLLIsVectorizeEnable(L));
+    return 1;
+}
+
+static int lll_settraceenable (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    LLLSetTraceEnable(L, lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lll_istraceenable (lua_State *L) {
+    lua_pushboolean(L, LLLIsTraceEnable(L));
+    return 1;
+}
+
+static int lll_setiterationstotrace (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TNUMBER);
+    LLLSetIterationsToTrace(L, lua_tointeger(L, 1));
+    return 0;
+}
+
+static int lll_getiterationstotrace (lua_State *L) {
+    lua_pushinteger(L, LLLGetIterationsToTrace(L));
+    return 1;
+}
+
+static int lll_setdebuginfoenable (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    LLLSetDebugInfoEnable(L, lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lll_isdebuginfoenable (lua_State *L) {
+    lua_pushboolean(L, LLLIsDebugInfoEnable(L));
+    return 1;
+}
+
+static int lll_setretainirenable (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    LLLSetRetainIREnable(L, lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lll_isretainirenable (lua_State *L) {
+    lua_pushboolean(L, LLLIsRetainIREnable(L));
+    return 1;
+}
+
+static int lll_setperfmapenable (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    LLLSetPerfMapEnable(lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lll_isperfmapenable (lua_State *L) {
+    lua_pushboolean(L, LLLIsPerfMapEnable());
+    return 1;
+}
+
+static int lll_setjitdumpenable (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    LLLSetJitDumpEnable(lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lll_isjitdumpenable (lua_State *L) {
+    lua_pushboolean(L, LLLIsJitDumpEnable());
+    return 1;
+}
+
+static int lll_ffi (lua_State *L) {
+    const char *decl = luaL_checkstring(L, 1);
+    const char *lib = luaL_optstring(L, 2, NULL);
+    char *errmsg = NULL;
+    lua_CFunction f = LLLDeclareFFI(L, decl, lib, &errmsg);
+    if (!f) {
+        lua_pushnil(L);
+        lua_pushstring(L, errmsg);
+        luaM_freearray(L, errmsg, strlen(errmsg) + 1);
+        return 2;
+    } else {
+        lua_pushcfunction(L, f);
+        return 1;
+    }
+}
+
 static int lll_iscompiled (lua_State *L) {
     lua_pushboolean(L, LLLIsCompiled(getclosure(L)->p));
     return 1;
 }
 
+static int lll_isblacklisted (lua_State *L) {
+    lua_pushboolean(L, LLLIsBlacklisted(L, getclosure(L)->p));
+    return 1;
+}
+
+static int lll_stats (lua_State *L) {
+    LLLPushStats(L);
+    return 1;
+}
+
 static int lll_dump (lua_State *L) {
     (void)L;
     LLLDump(getclosure(L)->p);
@@ -87,19 +264,53 @@ static int lll_write (lua_State *L) {
 }
 
 static const luaL_Reg lib_f[] = {
+    {"array", lllarray_new},
     {"compile", lll_compile},
     {"setAutoCompileEnable", lll_setautocompileenable},
     {"isAutoCompileEnable", lll_isautocompileenable},
     {"setCallsToCompile", lll_setcallstocompile},
     {"getCallsToCompile", lll_getcallstocompile},
+    {"setCompileSizeScale", lll_setcompilesizescale},
+    {"getCompileSizeScale", lll_getcompilesizescale},
+    {"setMaxCompileSize", lll_setmaxcompilesize},
+    {"getMaxCompileSize", lll_getmaxcompilesize},
+    {"setMaxCompileFailures", lll_setmaxcompilefailures},
+    {"getMaxCompileFailures", lll_getmaxcompilefailures},
+    {"setCompileBudget", lll_setcompilebudget},
+    {"getCompileBudget", lll_getcompilebudget},
+    {"setCodeMemoryLimit", lll_setcodememorylimit},
+    {"getCodeMemoryLimit", lll_getcodememorylimit},
+    {"getCodeMemory", lll_getcodememory},
+    {"setMaxClones", lll_setmaxclones},
+    {"getMaxClones", lll_getmaxclones},
+    {"setVectorizeEnable", lll_setvectorizeenable},
+    {"isVectorizeEnable", lll_isvectorizeenable},
+    {"setTraceEnable", lll_settraceenable},
+    {"isTraceEnable", lll_istraceenable},
+    {"setIterationsToTrace", lll_setiterationstotrace},
+    {"getIterationsToTrace", lll_getiterationstotrace},
+    {"setDebugInfoEnable", lll_setdebuginfoenable},
+    {"isDebugInfoEnable", lll_isdebuginfoenable},
+    {"setRetainIREnable", lll_setretainirenable},
+    {"isRetainIREnable", lll_isretainirenable},
+    {"setPerfMapEnable", lll_setperfmapenable},
+    {"isPerfMapEnable", lll_isperfmapenable},
+    {"setJitDumpEnable", lll_setjitdumpenable},
+    {"isJitDumpEnable", lll_isjitdumpenable},
+    {"ffi", lll_ffi},
     {"isCompiled", lll_iscompiled},
+    {"isBlacklisted", lll_isblacklisted},
+    {"stats", lll_stats},
     {"dump", lll_dump},
     {"write", lll_write},
     {NULL, NULL}
 };
 
 LUAMOD_API int luaopen_lll (lua_State *L) {
+    lllarray_init(L);
     luaL_newlib(L, lib_f);
+    lllprofile_open(L);
+    lua_setfield(L, -2, "profile");
     return 1;
 }
 
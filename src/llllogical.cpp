@@ -25,7 +25,7 @@ Logical::Logical(CompilerState& cs, Stack& stack) :
     ra_(stack.GetR(GETARG_A(cs.instr_))),
     rkb_(stack.GetRK(GETARG_B(cs.instr_))),
     rkc_(stack.GetRK(GETARG_C(cs.instr_))),
-    trytm_(cs.CreateSubBlock("trytm")) {
+    trytm_(cs.CreateColdBlock("trytm")) {
     
     assert(GET_OPCODE(cs.instr_) == OP_BAND ||
            GET_OPCODE(cs.instr_) == OP_BOR ||
@@ -0,0 +1,229 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllloops.cpp
+*/
+
+#include <algorithm>
+
+#include "lllbytecode.h"
+#include "lllloops.h"
+
+extern "C" {
+#include "lprefix.h"
+#include "lobject.h"
+#include "lopcodes.h"
+}
+
+// Maximum absolute constant added to the control variable of an index
+static const int MAX_OFFSET = 1 << 16;
+
+namespace lll {
+
+Loops::Loops(Proto* proto) :
+    proto_(proto) {
+    for (int pc = 0; pc < proto->sizecode; ++pc) {
+        Instruction i = proto->code[pc];
+        if (GET_OPCODE(i) == OP_FORPREP) {
+            int forloop = pc + 1 + GETARG_sBx(i);
+            loops_.push_back({pc, forloop, GetInnermost(pc)});
+        }
+    }
+}
+
+const Loops::Loop& Loops::Get(int loop) {
+    return loops_[loop];
+}
+
+int Loops::GetInnermost(int pc) {
+    // Loops are sorted by prep, so the last one that contains pc is the
+    // innermost
+    int innermost = -1;
+    for (size_t l = 0; l < loops_.size(); ++l)
+        if (loops_[l].prep < pc && pc <= loops_[l].forloop)
+            innermost = l;
+    return innermost;
+}
+
+bool Loops::IsInvariant(int loop, int reg) {
+    auto& l = loops_[loop];
+    for (int pc = l.prep + 1; pc <= l.forloop; ++pc)
+        if (Bytecode::WritesRegister(proto_, pc, reg))
+            return false;
+    return true;
+}
+
+bool Loops::IsControlVariable(int loop, int reg) {
+    auto& l = loops_[loop];
+    if (reg != GETARG_A(proto_->code[l.prep]) + 3)
+        return false;
+    for (int pc = l.prep + 1; pc < l.forloop; ++pc)
+        if (Bytecode::WritesRegister(proto_, pc, reg))
+            return false;
+    return true;
+}
+
+bool Loops::IsUpvalueInvariant(int loop, int upval) {
+    auto& l = loops_[loop];
+    for (int pc = l.prep + 1; pc <= l.forloop; ++pc) {
+        Instruction i = proto_->code[pc];
+        if (GET_OPCODE(i) == OP_SETUPVAL && GETARG_B(i) == upval)
+            return false;
+    }
+    return true;
+}
+
+bool Loops::HasTableStores(int loop) {
+    auto& l = loops_[loop];
+    for (int pc = l.prep + 1; pc <= l.forloop; ++pc) {
+        switch (GET_OPCODE(proto_->code[pc])) {
+            case OP_SETTABLE: case OP_SETTABUP: case OP_SETLIST:
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+int Loops::GetHoistingLoop(int pc) {
+    int hoisting = -1;
+    for (int l = GetInnermost(pc); l != -1; l = loops_[l].parent) {
+        if (!IsLoadInvariant(l, pc))
+            break;
+        hoisting = l;
+    }
+    return hoisting;
+}
+
+int Loops::GetArrayLoop(int pc, int* offset) {
+    int table, key;
+    if (!GetTableAccess(pc, &table, &key) || ISK(key))
+        return -1;
+    int loop = GetInnermost(pc);
+    if (loop == -1 || !IsInvariant(loop, table))
+        return -1;
+    int c = 0;
+    if (!IsControlVariable(loop, key) && !IsControlOffset(loop, pc, key, &c))
+        return -1;
+    if (offset)
+        *offset = c;
+    return loop;
+}
+
+std::vector<Loops::ArrayAccess> Loops::GetArrayTables(int loop) {
+    std::vector<ArrayAccess> tables;
+    auto& l = loops_[loop];
+    for (int pc = l.prep + 1; pc < l.forloop; ++pc) {
+        int table, key, offset;
+        if (GetArrayLoop(pc, &offset) != loop ||
+            !GetTableAccess(pc, &table, &key))
+            continue;
+        auto access = std::find_if(tables.begin(), tables.end(),
+                [table](const ArrayAccess& a) { return a.table == table; });
+        if (access == tables.end()) {
+            tables.push_back({table, offset, offset});
+        } else {
+            access->minoffset = std::min(access->minoffset, offset);
+            access->maxoffset = std::max(access->maxoffset, offset);
+        }
+    }
+    return tables;
+}
+
+bool Loops::IsControlOffset(int loop, int pc, int reg, int* offset) {
+    auto& l = loops_[loop];
+    int control = GETARG_A(proto_->code[l.prep]) + 3;
+    if (!IsControlVariable(loop, control))
+        return false;
+    int def = -1;
+    for (int p = l.prep + 1; p < l.forloop; ++p) {
+        if (Bytecode::WritesRegister(proto_, p, reg)) {
+            if (def != -1)
+                return false;
+            def = p;
+        }
+    }
+    if (def == -1 || !Dominates(loop, def, pc))
+        return false;
+
+    // The offset is small, so the checks of the bounds can't overflow
+    Instruction i = proto_->code[def];
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    int k;
+    if (GET_OPCODE(i) == OP_ADD && b == control && ISK(c))
+        k = c;
+    else if (GET_OPCODE(i) == OP_ADD && c == control && ISK(b))
+        k = b;
+    else if (GET_OPCODE(i) == OP_SUB && b == control && ISK(c))
+        k = c;
+    else
+        return false;
+    TValue* constant = proto_->k + INDEXK(k);
+    if (!ttisinteger(constant) || ivalue(constant) < -MAX_OFFSET ||
+        ivalue(constant) > MAX_OFFSET)
+        return false;
+    *offset = static_cast<int>(ivalue(constant));
+    if (GET_OPCODE(i) == OP_SUB)
+        *offset = -*offset;
+    return true;
+}
+
+bool Loops::Dominates(int loop, int def, int pc) {
+    auto& l = loops_[loop];
+    std::vector<bool> visited(proto_->sizecode, false);
+    std::vector<int> pending = {l.prep + 1};
+    while (!pending.empty()) {
+        int p = pending.back();
+        pending.pop_back();
+        if (p == pc)
+            return false;
+        if (p == def || p <= l.prep || p >= l.forloop || visited[p])
+            continue;
+        visited[p] = true;
+        for (int s : Bytecode::GetSuccessors(proto_, p))
+            pending.push_back(s);
+    }
+    return true;
+}
+
+bool Loops::IsLoadInvariant(int loop, int pc) {
+    Instruction i = proto_->code[pc];
+    int key = GETARG_C(i);
+    if (!ISK(key) && !IsInvariant(loop, key))
+        return false;
+    if (HasTableStores(loop))
+        return false;
+    switch (GET_OPCODE(i)) {
+        case OP_GETTABLE:
+            return IsInvariant(loop, GETARG_B(i));
+        case OP_GETTABUP:
+            return IsUpvalueInvariant(loop, GETARG_B(i));
+        default:
+            break;
+    }
+    return false;
+}
+
+bool Loops::GetTableAccess(int pc, int* table, int* key) {
+    Instruction i = proto_->code[pc];
+    switch (GET_OPCODE(i)) {
+        case OP_GETTABLE:
+            *table = GETARG_B(i);
+            *key = GETARG_C(i);
+            return true;
+        case OP_SETTABLE:
+            *table = GETARG_A(i);
+            *key = GETARG_B(i);
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+}
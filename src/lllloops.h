@@ -0,0 +1,102 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllloops.h
+** Finds the numeric for loops of a proto, the table loads that can be
+** hoisted out of them and the table accesses indexed by the loop variable
+** The range of the indices is known from the range of the control variable:
+** a key computed as control variable + constant inside the body is in
+** [lowest + constant, highest + constant], so a single check of the array
+** sizes before the loop covers every iteration
+*/
+
+#ifndef LLLLOOPS_H
+#define LLLLOOPS_H
+
+#include <vector>
+
+extern "C" {
+struct Proto;
+}
+
+namespace lll {
+
+class Loops {
+public:
+    // Numeric for loop, the body goes from prep + 1 to forloop
+    struct Loop {
+        int prep;
+        int forloop;
+        int parent;
+    };
+
+    // Table indexed by the control variable of a loop, the keys go from
+    // control variable + $minoffset to control variable + $maxoffset
+    struct ArrayAccess {
+        int table;
+        int minoffset;
+        int maxoffset;
+    };
+
+    // Constructor, finds the loops of $proto
+    Loops(Proto* proto);
+
+    // Obtains a loop
+    const Loop& Get(int loop);
+
+    // Returns the innermost loop that contains $pc (-1 if there is none)
+    int GetInnermost(int pc);
+
+    // Returns whether the register isn't written inside the loop
+    bool IsInvariant(int loop, int reg);
+
+    // Returns whether $reg is the control variable of the loop and isn't
+    // written inside the loop body
+    bool IsControlVariable(int loop, int reg);
+
+    // Returns whether the upvalue isn't written inside the loop
+    bool IsUpvalueInvariant(int loop, int upval);
+
+    // Returns whether the loop stores into tables without a function call
+    bool HasTableStores(int loop);
+
+    // Returns the outermost loop that the GETTABLE/GETTABUP at $pc can be
+    // hoisted to (-1 if it must be performed at each iteration)
+    int GetHoistingLoop(int pc);
+
+    // Returns the innermost loop whose control variable (plus a constant
+    // $offset) is the key of the GETTABLE/SETTABLE at $pc while the table is
+    // invariant (-1 if none)
+    int GetArrayLoop(int pc, int* offset = nullptr);
+
+    // Returns the tables accessed by the control variable of $loop
+    std::vector<ArrayAccess> GetArrayTables(int loop);
+
+private:
+    // Returns whether $reg always holds control variable + $offset at $pc:
+    // it is written only once inside the loop body, by an ADD/SUB of the
+    // control variable and an integer constant that runs before $pc in every
+    // iteration
+    bool IsControlOffset(int loop, int pc, int reg, int* offset);
+
+    // Returns whether every path from the start of the loop body to $pc
+    // passes through $def
+    bool Dominates(int loop, int def, int pc);
+
+    // Returns whether the table load at $pc is invariant in $loop
+    bool IsLoadInvariant(int loop, int pc);
+
+    // Obtains the table and the key of a GETTABLE/SETTABLE
+    bool GetTableAccess(int pc, int* table, int* key);
+
+    Proto* proto_;
+    std::vector<Loop> loops_;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,230 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllperf.cpp
+*/
+
+#include <cstdio>
+#include <ctime>
+#include <elf.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <llvm/DebugInfo/DIContext.h>
+#include <llvm/ExecutionEngine/ObjectImage.h>
+#include <llvm/Object/ObjectFile.h>
+
+#include "lllperf.h"
+
+extern "C" {
+#include "lprefix.h"
+#include "lllcore.h"
+}
+
+namespace {
+
+// jitdump format (tools/perf/Documentation/jitdump-specification.txt)
+const uint32_t JITDUMP_MAGIC = 0x4A695444;
+const uint32_t JITDUMP_VERSION = 1;
+const uint32_t JIT_CODE_LOAD = 0;
+
+struct JitDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JitDumpCodeLoad {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+// Published line tables
+std::map<Proto*, lll::PerfListener::Lines> lines_;
+
+// Guards the line tables and the files (shared by the states of all threads)
+std::mutex mutex_;
+
+FILE* perfmap_ = nullptr;
+FILE* jitdump_ = nullptr;
+uint64_t codeindex_ = 0;
+
+// perf uses the monotonic clock for the jitdump records
+uint64_t Timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+FILE* OpenPerfMap() {
+    if (!perfmap_) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        perfmap_ = fopen(path, "a");
+    }
+    return perfmap_;
+}
+
+FILE* OpenJitDump() {
+    if (jitdump_)
+        return jitdump_;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+    jitdump_ = fopen(path, "w+");
+    if (!jitdump_)
+        return nullptr;
+
+    // perf finds the file through the mmap of it by the process
+    void* marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+            MAP_PRIVATE, fileno(jitdump_), 0);
+    if (marker == MAP_FAILED) {
+        fclose(jitdump_);
+        jitdump_ = nullptr;
+        return nullptr;
+    }
+
+    JitDumpHeader header;
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+#if defined(__x86_64__)
+    header.elf_mach = EM_X86_64;
+#elif defined(__i386__)
+    header.elf_mach = EM_386;
+#elif defined(__aarch64__)
+    header.elf_mach = EM_AARCH64;
+#elif defined(__arm__)
+    header.elf_mach = EM_ARM;
+#else
+    header.elf_mach = EM_NONE;
+#endif
+    header.pad1 = 0;
+    header.pid = getpid();
+    header.timestamp = Timestamp();
+    header.flags = 0;
+    fwrite(&header, sizeof(header), 1, jitdump_);
+    return jitdump_;
+}
+
+}
+
+namespace lll {
+
+PerfListener::PerfListener(const std::string& name, Proto* proto) :
+    name_(name),
+    proto_(proto) {
+}
+
+bool PerfListener::IsEnabled() {
+    return LLLIsPerfMapEnable() || LLLIsJitDumpEnable();
+}
+
+std::string PerfListener::GetName(Proto* proto) {
+    char source[LUA_IDSIZE];
+    if (proto->source)
+        luaO_chunkid(source, getstr(proto->source), LUA_IDSIZE);
+    else
+        snprintf(source, LUA_IDSIZE, "?");
+    return std::string("lua:") + source + ":" +
+           std::to_string(proto->linedefined);
+}
+
+int PerfListener::GetLine(Proto* proto, uintptr_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto function = lines_.find(proto);
+    if (function == lines_.end())
+        return -1;
+    auto& f = function->second;
+    if (address < f.begin || address >= f.end)
+        return -1;
+    auto line = f.lines.upper_bound(address);
+    if (line == f.lines.begin())
+        return -1;
+    return (--line)->second;
+}
+
+void PerfListener::Unpublish(Proto* proto) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lines_.erase(proto);
+}
+
+void PerfListener::NotifyObjectEmitted(const llvm::ObjectImage& object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<llvm::DIContext> context;
+    if (proto_)
+        context.reset(llvm::DIContext::getDWARFContext(
+                object.getObjectFile()));
+
+    for (auto i = object.begin_symbols(), e = object.end_symbols(); i != e;
+         ++i) {
+        llvm::object::SymbolRef::Type type;
+        uint64_t address, size;
+        if (i->getType(type) || type != llvm::object::SymbolRef::ST_Function ||
+            i->getAddress(address) || i->getSize(size) || size == 0)
+            continue;
+        if (LLLIsPerfMapEnable())
+            WritePerfMap(address, size, name_);
+        if (LLLIsJitDumpEnable())
+            WriteJitDump(address, size, name_);
+        if (context) {
+            auto& lines = lines_[proto_];
+            lines.begin = address;
+            lines.end = address + size;
+            lines.lines.clear();
+            for (auto& line : context->getLineInfoForAddressRange(address,
+                    size))
+                lines.lines[line.first] = line.second.Line;
+        }
+    }
+}
+
+void PerfListener::WritePerfMap(uint64_t address, uint64_t size,
+        const std::string& name) {
+    auto f = OpenPerfMap();
+    if (!f)
+        return;
+    fprintf(f, "%llx %llx %s\n", static_cast<unsigned long long>(address),
+            static_cast<unsigned long long>(size), name.c_str());
+    fflush(f);
+}
+
+void PerfListener::WriteJitDump(uint64_t address, uint64_t size,
+        const std::string& name) {
+    auto f = OpenJitDump();
+    if (!f)
+        return;
+    JitDumpCodeLoad record;
+    record.id = JIT_CODE_LOAD;
+    record.total_size = sizeof(record) + name.size() + 1 + size;
+    record.timestamp = Timestamp();
+    record.pid = getpid();
+    record.tid = syscall(SYS_gettid);
+    record.vma = address;
+    record.code_addr = address;
+    record.code_size = size;
+    record.code_index = codeindex_++;
+    fwrite(&record, sizeof(record), 1, f);
+    fwrite(name.c_str(), name.size() + 1, 1, f);
+    fwrite(reinterpret_cast<void*>(address), size, 1, f);
+    fflush(f);
+}
+
+}
+
@@ -0,0 +1,73 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllperf.h
+** Announces the jitted code to Linux perf, with a perf map
+** (/tmp/perf-<pid>.map) and/or a jitdump file (/tmp/jit-<pid>.dump, used with
+** perf inject --jit)
+** When the debug info is enabled, the native address to line tables of the
+** compiled functions are also published for the sampling profiler.
+*/
+
+#ifndef LLLPERF_H
+#define LLLPERF_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+extern "C" {
+#include "lobject.h"
+}
+
+namespace lll {
+
+class PerfListener : public llvm::JITEventListener {
+public:
+    // Native address to line table of a compiled function
+    struct Lines {
+        uintptr_t begin;
+        uintptr_t end;
+        std::map<uintptr_t, int> lines;
+    };
+
+    // Constructor, the functions of the emitted objects are named $name; the
+    // lines are published only if $proto is provided
+    PerfListener(const std::string& name, Proto* proto = nullptr);
+
+    // Returns whether any of the perf outputs is enable
+    static bool IsEnabled();
+
+    // Obtains the name of a compiled function (chunk and line defined)
+    static std::string GetName(Proto* proto);
+
+    // Obtains the line of the native $address inside the compiled function of
+    // $proto; returns -1 if it is unknown
+    static int GetLine(Proto* proto, uintptr_t address);
+
+    // Removes the published lines of $proto (its engine was destroyed)
+    static void Unpublish(Proto* proto);
+
+    // Writes the entries of the function symbols of the object
+    virtual void NotifyObjectEmitted(const llvm::ObjectImage& object);
+
+private:
+    // Writes an entry in each enabled output
+    static void WritePerfMap(uint64_t address, uint64_t size,
+                             const std::string& name);
+    static void WriteJitDump(uint64_t address, uint64_t size,
+                             const std::string& name);
+
+    std::string name_;
+    Proto* proto_;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,483 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllprofile.c
+** A timer of the CPU time of the profiling thread sends SIGPROF to it. The
+** signal handler doesn't touch the Lua stack: it only counts the tick and
+** sets a hook; the hook copies the call stack (protos and lines) of the
+** profiled thread to preallocated buffers at its next call, return or
+** instruction, with the weight of the ticks since the last sample. The
+** report is built when the profiler stops. Compiled functions don't update
+** their saved pc, so the line of the innermost compiled frame is found from
+** the interrupted native pc (with debug info) if the frame is still the
+** same, and the other compiled frames use the line where the function is
+** defined.
+** There is one profiler in the process (the signal handler is global); the
+** Lua state that starts it owns it until it stops or the state is closed,
+** so the states of other threads can't start it meanwhile.
+*/
+
+#define lllprofile_c
+#define LUA_CORE
+
+/* REG_RIP and the other registers of ucontext */
+#define _GNU_SOURCE
+
+#include "lprefix.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "ldebug.h"
+#include "lllcore.h"
+#include "lllprofile.h"
+#include "lobject.h"
+#include "lstate.h"
+
+#define MAXDEPTH    64          /* frames of a sample */
+#define MAXSAMPLES  (1 << 16)   /* samples of a profile */
+#define MAXFRAMES   (1 << 18)   /* frames of all samples */
+
+/* older glibc versions don't name the thread of SIGEV_THREAD_ID */
+#if !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* frames of C functions have no proto */
+typedef struct Frame {
+  Proto *p;
+  int line;  /* -1 if unknown */
+} Frame;
+
+typedef struct Sample {
+  int first;  /* index of the innermost frame */
+  int depth;
+  int weight;  /* ticks of the sample */
+  void *nativepc;  /* interrupted pc, used by compiled frames (or NULL) */
+} Sample;
+
+typedef struct Profiler {
+  global_State *owner;  /* state that owns the profiler (NULL if none) */
+  lua_State *L;  /* profiled thread (NULL if not running) */
+  int ref;  /* anchors the profiled thread in the registry */
+  timer_t timer;
+  Sample *samples;
+  Frame *frames;
+  int nsamples;
+  int nframes;
+  int total;  /* ticks of the samples */
+  int dropped;  /* ticks without room for their sample */
+  volatile sig_atomic_t ticks;  /* ticks since the last sample */
+  void *nativepc;  /* interrupted pc and frame of the first of these ticks */
+  CallInfo *ci;
+  struct sigaction oldaction;
+} Profiler;
+
+static Profiler profiler;
+
+/* guards the owner of the profiler; the other fields belong to the owner */
+static pthread_mutex_t ownerlock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void *interruptedpc (void *context) {
+  ucontext_t *uc = (ucontext_t *)context;
+#if defined(__x86_64__)
+  return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+  return (void *)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+  return (void *)uc->uc_mcontext.pc;
+#else
+  (void)uc;
+  return NULL;
+#endif
+}
+
+
+static int interpretedline (Proto *p, CallInfo *ci) {
+  int pc = pcRel(ci->u.l.savedpc, p);
+  if (p->lineinfo == NULL || pc < 0 || pc >= p->sizelineinfo)
+    return -1;
+  return p->lineinfo[pc];
+}
+
+
+/* hook set by the signal handler, runs at a safe point of the thread */
+static void sample (lua_State *L, lua_Debug *ar) {
+  Sample *s;
+  CallInfo *ci;
+  int ticks;
+  (void)ar;
+  lua_sethook(L, NULL, 0, 0);
+  ticks = profiler.ticks;
+  profiler.ticks = 0;
+  if (ticks == 0)
+    return;
+  if (profiler.nsamples == MAXSAMPLES ||
+      profiler.nframes + MAXDEPTH > MAXFRAMES) {
+    profiler.dropped += ticks;
+    return;
+  }
+  s = &profiler.samples[profiler.nsamples];
+  s->first = profiler.nframes;
+  s->depth = 0;
+  s->weight = ticks;
+  s->nativepc = (L->ci == profiler.ci) ? profiler.nativepc : NULL;
+  for (ci = L->ci; ci != &L->base_ci && s->depth < MAXDEPTH;
+       ci = ci->previous) {
+    Frame *f = &profiler.frames[s->first + s->depth];
+    f->p = NULL;
+    f->line = -1;
+    if (isLua(ci) && ttisLclosure(ci->func)) {
+      f->p = clLvalue(ci->func)->p;
+      if (f->p->lllfunction == NULL)
+        f->line = interpretedline(f->p, ci);
+    }
+    s->depth++;
+  }
+  profiler.nframes += s->depth;
+  profiler.nsamples++;
+  profiler.total += ticks;
+}
+
+
+/*
+** The signal is only sent to the profiling thread; the stack may be in an
+** inconsistent state, so it is sampled later by the hook
+*/
+static void tick (int sig, siginfo_t *info, void *context) {
+  lua_State *L = profiler.L;
+  (void)sig; (void)info;
+  if (L == NULL)
+    return;
+  if (profiler.ticks++ == 0) {
+    profiler.nativepc = interruptedpc(context);
+    profiler.ci = L->ci;
+    lua_sethook(L, sample, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+  }
+}
+
+
+/* creates the timer of the CPU time of the calling thread */
+static int starttimer (int hz) {
+  struct sigevent event;
+  struct itimerspec spec;
+  long interval = 1000000000L / hz;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &profiler.timer) != 0)
+    return -1;
+  spec.it_interval.tv_sec = interval / 1000000000L;
+  spec.it_interval.tv_nsec = interval % 1000000000L;
+  spec.it_value = spec.it_interval;
+  if (timer_settime(profiler.timer, 0, &spec, NULL) != 0) {
+    timer_delete(profiler.timer);
+    return -1;
+  }
+  return 0;
+}
+
+
+static void freebuffers (void) {
+  free(profiler.samples);
+  free(profiler.frames);
+  profiler.samples = NULL;
+  profiler.frames = NULL;
+}
+
+
+/* stops the timer and removes the hook (the samples are kept) */
+static void stopprofiler (void) {
+  lua_State *L = profiler.L;
+  timer_delete(profiler.timer);
+  sigaction(SIGPROF, &profiler.oldaction, NULL);
+  profiler.L = NULL;
+  if (lua_gethook(L) == sample)
+    lua_sethook(L, NULL, 0, 0);
+  luaL_unref(L, LUA_REGISTRYINDEX, profiler.ref);
+}
+
+
+/*
+** Takes the profiler for the state of $L; a state keeps it after a stop
+** that failed building the report (the buffers are freed here)
+*/
+static int acquire (lua_State *L) {
+  int ok;
+  pthread_mutex_lock(&ownerlock);
+  ok = profiler.owner == NULL ||
+       (profiler.owner == G(L) && profiler.L == NULL);
+  if (ok)
+    profiler.owner = G(L);
+  pthread_mutex_unlock(&ownerlock);
+  if (ok)
+    freebuffers();
+  return ok;
+}
+
+
+/* returns whether the state of $L owns the profiler */
+static int isowner (lua_State *L) {
+  int owner;
+  pthread_mutex_lock(&ownerlock);
+  owner = profiler.owner == G(L);
+  pthread_mutex_unlock(&ownerlock);
+  return owner;
+}
+
+
+static void release (void) {
+  freebuffers();
+  pthread_mutex_lock(&ownerlock);
+  profiler.owner = NULL;
+  pthread_mutex_unlock(&ownerlock);
+}
+
+
+static int profile_start (lua_State *L) {
+  lua_Integer hz = luaL_optinteger(L, 1, 100);
+  struct sigaction action;
+  luaL_argcheck(L, 0 < hz && hz <= 10000, 1, "invalid frequency");
+  if (lua_gethook(L) != NULL)
+    return luaL_error(L, "thread already has a hook");
+  if (!acquire(L))
+    return luaL_error(L, "profiler already running");
+  profiler.samples = (Sample *)malloc(MAXSAMPLES * sizeof(Sample));
+  profiler.frames = (Frame *)malloc(MAXFRAMES * sizeof(Frame));
+  if (profiler.samples == NULL || profiler.frames == NULL) {
+    release();
+    return luaL_error(L, "not enough memory");
+  }
+  profiler.nsamples = profiler.nframes = 0;
+  profiler.total = profiler.dropped = 0;
+  profiler.ticks = 0;
+  lua_pushthread(L);  /* the thread can't be collected while profiled */
+  profiler.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  profiler.L = L;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = tick;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, &profiler.oldaction);
+  if (starttimer((int)hz) != 0) {
+    sigaction(SIGPROF, &profiler.oldaction, NULL);
+    profiler.L = NULL;
+    luaL_unref(L, LUA_REGISTRYINDEX, profiler.ref);
+    release();
+    return luaL_error(L, "cannot create the timer");
+  }
+  return 0;
+}
+
+
+/*
+** The protos of the samples may have been collected, so only the ones
+** still in the list of objects are used
+*/
+typedef struct Alive {
+  Proto **protos;
+  size_t n;
+} Alive;
+
+
+static int compareprotos (const void *a, const void *b) {
+  Proto *pa = *(Proto *const *)a;
+  Proto *pb = *(Proto *const *)b;
+  return (pa > pb) - (pa < pb);
+}
+
+
+static void collectalive (lua_State *L, Alive *alive) {
+  GCObject *o;
+  size_t n = 0;
+  for (o = G(L)->allgc; o != NULL; o = o->next)
+    n += (o->tt == LUA_TPROTO);
+  alive->protos = (Proto **)malloc((n > 0 ? n : 1) * sizeof(Proto *));
+  alive->n = 0;
+  if (alive->protos == NULL)
+    return;
+  for (o = G(L)->allgc; o != NULL; o = o->next)
+    if (o->tt == LUA_TPROTO)
+      alive->protos[alive->n++] = gco2p(o);
+  qsort(alive->protos, alive->n, sizeof(Proto *), compareprotos);
+}
+
+
+static int isalive (Alive *alive, Proto *p) {
+  return alive->protos != NULL &&
+         bsearch(&p, alive->protos, alive->n, sizeof(Proto *),
+                 compareprotos) != NULL;
+}
+
+
+/* pushes the name of a frame: "chunk:line" */
+static void pushframe (lua_State *L, Alive *alive, Frame *f, void *nativepc,
+                       int leaf) {
+  char source[LUA_IDSIZE];
+  int line = f->line;
+  if (f->p == NULL) {
+    lua_pushliteral(L, "[C]");
+    return;
+  }
+  if (!isalive(alive, f->p)) {
+    lua_pushliteral(L, "?");
+    return;
+  }
+  if (line == -1 && leaf && f->p->lllfunction != NULL)
+    line = LLLGetJitLine(f->p, nativepc);
+  if (line == -1)
+    line = f->p->linedefined;
+  luaO_chunkid(source, f->p->source ? getstr(f->p->source) : "?",
+               LUA_IDSIZE);
+  lua_pushfstring(L, "%s:%d", source, line);
+}
+
+
+/* adds $n to t[key] (the key at the top, t below it) */
+static void count (lua_State *L, int n) {
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
+  n += (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  lua_pushinteger(L, n);
+  lua_rawset(L, -3);
+}
+
+
+/*
+** The samples are aggregated in a table indexed by the leaf frame (flat) or
+** by the whole stack, from the outermost frame (folded, used by the flame
+** graph tools)
+*/
+static void aggregate (lua_State *L, int folded) {
+  Alive alive;
+  int i, j;
+  collectalive(L, &alive);
+  lua_newtable(L);
+  for (i = 0; i < profiler.nsamples; i++) {
+    Sample *s = &profiler.samples[i];
+    Frame *frames = &profiler.frames[s->first];
+    if (s->depth == 0)
+      continue;
+    if (folded) {
+      luaL_Buffer b;
+      luaL_buffinit(L, &b);
+      for (j = s->depth - 1; j >= 0; j--) {
+        pushframe(L, &alive, &frames[j], s->nativepc, j == 0);
+        luaL_addvalue(&b);
+        if (j > 0)
+          luaL_addchar(&b, ';');
+      }
+      luaL_pushresult(&b);
+    }
+    else
+      pushframe(L, &alive, &frames[0], s->nativepc, 1);
+    count(L, s->weight);
+  }
+  free(alive.protos);
+}
+
+
+typedef struct Entry {
+  const char *key;
+  int n;
+} Entry;
+
+
+static int compareentries (const void *a, const void *b) {
+  const Entry *ea = (const Entry *)a;
+  const Entry *eb = (const Entry *)b;
+  if (ea->n != eb->n)
+    return eb->n - ea->n;
+  return strcmp(ea->key, eb->key);
+}
+
+
+/* writes the entries of the table at the top, sorted by the count */
+static void report (lua_State *L, int folded) {
+  int total = profiler.total;
+  int n = 0, i;
+  Entry *entries;
+  luaL_Buffer b;
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    n++;
+    lua_pop(L, 1);
+  }
+  entries = (Entry *)lua_newuserdata(L, (n > 0 ? n : 1) * sizeof(Entry));
+  i = 0;
+  lua_pushnil(L);
+  while (lua_next(L, -3)) {
+    entries[i].key = lua_tostring(L, -2);  /* keys are anchored by the table */
+    entries[i].n = (int)lua_tointeger(L, -1);
+    i++;
+    lua_pop(L, 1);
+  }
+  qsort(entries, n, sizeof(Entry), compareentries);
+  luaL_buffinit(L, &b);
+  for (i = 0; i < n; i++) {
+    if (folded)
+      lua_pushfstring(L, "%s %d\n", entries[i].key, entries[i].n);
+    else {
+      char percent[16];
+      snprintf(percent, sizeof(percent), "%.2f", 100.0 * entries[i].n / total);
+      lua_pushfstring(L, "%d\t%s%%\t%s\n", entries[i].n, percent,
+                      entries[i].key);
+    }
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+}
+
+
+static int profile_stop (lua_State *L) {
+  static const char *const modes[] = {"flat", "folded", NULL};
+  int folded = luaL_checkoption(L, 1, "flat", modes);
+  if (!isowner(L) || profiler.L == NULL)
+    return luaL_error(L, "profiler not running");
+  stopprofiler();
+  lua_settop(L, 0);
+  aggregate(L, folded);
+  report(L, folded);
+  lua_pushinteger(L, profiler.total);
+  lua_pushinteger(L, profiler.dropped);
+  release();
+  return 3;
+}
+
+
+static const luaL_Reg profile_f[] = {
+  {"start", profile_start},
+  {"stop", profile_stop},
+  {NULL, NULL}
+};
+
+
+void lllprofile_open (lua_State *L) {
+  luaL_newlib(L, profile_f);
+}
+
+
+void lllprofile_close (lua_State *L) {
+  if (isowner(L)) {
+    if (profiler.L != NULL)
+      stopprofiler();
+    release();
+  }
+}
+
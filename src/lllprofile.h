@@ -0,0 +1,23 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllprofile.h
+** Sampling profiler (SIGPROF) of the Lua functions, interpreted or compiled
+*/
+
+#ifndef LLLPROFILE_H
+#define LLLPROFILE_H
+
+#include "lua.h"
+
+/* pushes the lll.profile table */
+LUAI_FUNC void lllprofile_open (lua_State *L);
+
+/* stops the profiler if it samples a thread of the state (lua_close) */
+LUAI_FUNC void lllprofile_close (lua_State *L);
+
+#endif
+
@@ -7,13 +7,17 @@
 ** runtime.cpp
 */
 
+#include <mutex>
+
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/TargetSelect.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Module.h>
 
 extern "C" {
 #include "lprefix.h"
+#include "lauxlib.h"
 #include "ldebug.h"
 #include "lfunc.h"
 #include "lgc.h"
@@ -192,20 +196,121 @@ static void lll_checkstack(lua_State* L, int n) {
     luaD_checkstack(L, n);
 }
 
-namespace lll {
+/*
+** Stores the method $key of the __index table of $mt in the inline cache of
+** an OP_SELF; the most recent entry goes first
+*/
+static void lll_fillselfcache(lua_State* L, Table* mt, TString* key,
+        lll::SelfCacheEntry* cache) {
+    const TValue* index = luaH_getshortstr(mt, G(L)->tmname[TM_INDEX]);
+    if (!ttistable(index))
+        return;
+    Table* h = hvalue(index);
+    const TValue* slot = luaH_getshortstr(h, key);
+    if (ttisnil(slot))
+        return;
+    int i = 0;
+    while (i < lll::SELFCACHE_SIZE - 1 && cache[i].metatable != mt)
+        ++i;
+    for (; i > 0; --i)
+        cache[i] = cache[i - 1];
+    /* the value is the first field of the node */
+    cache[0].metatable = mt;
+    cache[0].mtnode = mt->node;
+    cache[0].mtslot = cast(Node*, index);
+    cache[0].mtlsizenode = mt->lsizenode;
+    cache[0].index = h;
+    cache[0].node = h->node;
+    cache[0].slot = cast(Node*, slot);
+    cache[0].lsizenode = h->lsizenode;
+}
+
+/*
+** Position of the key that luaH_next just returned, the node value is the
+** first field of the Node, so both parts can be found through the slot
+*/
+static int tforcursor (Table *t, const TValue *key) {
+  const TValue *slot = luaH_get(t, key);
+  if (slot >= t->array && slot < t->array + t->sizearray)
+    return cast_int(slot - t->array);
+  return cast_int(t->sizearray + (cast(const Node *, slot) - t->node));
+}
+
+/* Verifies if the $cursor still points to the control key */
+static int tforvalidcursor (Table *t, const TValue *control, unsigned int c) {
+  if (c < t->sizearray)
+    return ttisinteger(control) && ivalue(control) == cast(lua_Integer, c) + 1;
+  c -= t->sizearray;
+  if (c < cast(unsigned int, sizenode(t))) {
+    const TValue *key = gkey(gnode(t, c));
+    return luaV_rawequalobj(key, control) ||
+           (ttisdeadkey(key) && iscollectable(control) &&
+            deadvalue(key) == gcvalue(control));
+  }
+  return 0;
+}
 
-Runtime* Runtime::instance_ = nullptr;
+/*
+** Iteration of the builtin 'next' for a generic for; the key/value pair is
+** stored at $ra and the position of the key is kept in $cursor, so there is
+** no need to search for the control key (R(A+2)) at each step
+*/
+static int lll_tfornext(lua_State* L, Table* t, TValue* ra, int* cursor) {
+    TValue* control = ra - 1;
+    unsigned int i;
+    if (ttisnil(control))
+        i = 0;
+    else if (tforvalidcursor(t, control, *cursor))
+        i = *cursor + 1;
+    else {
+        /* unknown position (first step with a key or a rehashed table) */
+        setobj2s(L, ra, control);
+        if (!luaH_next(L, t, ra)) {
+            setnilvalue(ra);
+            return 0;
+        }
+        *cursor = tforcursor(t, ra);
+        return 1;
+    }
+    for (; i < t->sizearray; i++) {
+        if (!ttisnil(&t->array[i])) {
+            setivalue(ra, i + 1);
+            setobj2s(L, ra + 1, &t->array[i]);
+            *cursor = i;
+            return 1;
+        }
+    }
+    for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {
+        Node* n = gnode(t, i);
+        if (!ttisnil(gval(n))) {
+            setobj2s(L, ra, gkey(n));
+            setobj2s(L, ra + 1, gval(n));
+            *cursor = i + t->sizearray;
+            return 1;
+        }
+    }
+    setnilvalue(ra);
+    return 0;
+}
 
-Runtime::Runtime() :
-    context_(llvm::getGlobalContext()) {
+namespace lll {
+
+Runtime::Runtime() {
     InitTypes();
     InitFunctions();
 }
 
-Runtime* Runtime::Instance() {
-    if (!instance_)
-        instance_ = new Runtime();
-    return instance_;
+void Runtime::InitializeTarget() {
+    static std::once_flag init;
+    std::call_once(init, []() {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+    });
+}
+
+llvm::LLVMContext& Runtime::GetContext() {
+    return context_;
 }
 
 llvm::Type* Runtime::GetType(const std::string& name) {
@@ -238,6 +343,7 @@ void Runtime::InitTypes() {
     ADDTYPE(UpVal);
     ADDTYPE(GCObject);
     ADDTYPE(Table);
+    ADDTYPE(Node);
     ADDTYPE(TString);
 
     std::vector<llvm::Type*> ttvaluefields = {
@@ -280,6 +386,9 @@ void Runtime::InitFunctions() {
     auto tluaintegerptr = llvm::PointerType::get(tluainteger, 0);
     auto tvoid = llvm::Type::getVoidTy(context_);
     auto tint = MakeIntT(sizeof(int));
+    auto tintptr = llvm::PointerType::get(tint, 0);
+    auto tcharptr = llvm::PointerType::get(MakeIntT(sizeof(char)), 0);
+    auto tsizetptr = llvm::PointerType::get(MakeIntT(sizeof(size_t)), 0);
 
     // LLL
     ADDFUNCTION(LLLNumMod, tluanumber, tluanumber, tluanumber);
@@ -292,13 +401,33 @@ void Runtime::InitFunctions() {
     ADDFUNCTION(lll_setlist, tvoid, tstate, ttvalue, tint, tint);
     ADDFUNCTION(lll_closure, tvoid, tstate, tclosure, ttvalue, ttvalue, tint);
     ADDFUNCTION(lll_checkstack, tvoid, tstate, tint);
+    ADDFUNCTION(lll_tfornext, tint, tstate, ttable, ttvalue, tintptr);
+    ADDFUNCTION(lll_fillselfcache, tvoid, tstate, ttable, ttstring,
+            llvm::PointerType::get(MakeIntT(1), 0));
 
     // math.h
     ADDFUNCTION(l_mathop(floor), tluanumber, tluanumber);
     ADDFUNCTION(l_mathop(pow), tluanumber, tluanumber, tluanumber);
+    ADDFUNCTION(l_mathop(sqrt), tluanumber, tluanumber);
+
+    // lapi.h (native function thunks)
+    ADDFUNCTION(lua_pushinteger, tvoid, tstate, tluainteger);
+    ADDFUNCTION(lua_pushlightuserdata, tvoid, tstate, tcharptr);
+    ADDFUNCTION(lua_pushnumber, tvoid, tstate, tluanumber);
+    ADDFUNCTION(lua_pushstring, tcharptr, tstate, tcharptr);
+    ADDFUNCTION(lua_touserdata, tcharptr, tstate, tint);
+
+    // lauxlib.h (native function thunks)
+    ADDFUNCTION(luaL_checkinteger, tluainteger, tstate, tint);
+    ADDFUNCTION(luaL_checklstring, tcharptr, tstate, tint, tsizetptr);
+    ADDFUNCTION(luaL_checknumber, tluanumber, tstate, tint);
 
     // ldo.h
     ADDFUNCTION(luaD_callnoyield, tvoid, tstate, ttvalue, tint);
+    ADDFUNCTION(luaD_selfprecall, tci, tstate, ttvalue, tint);
+    ADDFUNCTION(luaD_selfposcall, tvoid, tstate, tci, tint);
+    ADDFUNCTION(luaD_cprecall, tci, tstate, ttvalue, tint);
+    ADDFUNCTION(luaD_cposcall, tvoid, tstate, tci, tint);
 
     // lfunc.h
     ADDFUNCTION(luaF_close, tvoid, tstate, ttvalue);
@@ -312,6 +441,8 @@ void Runtime::InitFunctions() {
     ADDFUNCTION(luaH_getstr, ttvalue, ttable, ttstring);
     ADDFUNCTION(luaH_get, ttvalue, ttable, ttvalue);
     ADDFUNCTION(luaH_resize, tvoid, tstate, ttable, tint, tint);
+    ADDFUNCTION(luaH_setint, tvoid, tstate, ttable, tluainteger, ttvalue);
+    ADDFUNCTION(luaH_set, ttvalue, tstate, ttable, ttvalue);
 
     // ltm.h
     ADDFUNCTION(luaT_gettm, ttvalue, ttable, tint, ttstring);
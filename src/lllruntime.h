@@ -5,7 +5,8 @@
 ** Copyright Notice for LLL: see lllcore.h
 **
 ** runtime.h
-** Singleton that manages functions/types used by compiled the function
+** Manages functions/types used by compiled the function
+** Each Lua state has its own runtime and LLVM context (see lllstate.h)
 */
 
 #ifndef LLLRUNTIME_H
@@ -14,18 +15,48 @@
 #include <cstdio>
 #include <map>
 
+#include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
 
 #define STRINGFY(a) #a
 #define STRINGFY2(a) STRINGFY(a)
 
+extern "C" {
+struct Node;
+struct Table;
+}
+
 namespace lll {
 
+// Entry of the inline cache of a method lookup (OP_SELF) that misses the
+// object and is found in the __index table of its metatable. The nodes are
+// reused only while both tables keep the same node part and the keys are
+// still at the cached positions.
+struct SelfCacheEntry {
+    Table* metatable;
+    Node* mtnode;
+    Node* mtslot;
+    Table* index;
+    Node* node;
+    Node* slot;
+    int mtlsizenode;
+    int lsizenode;
+};
+
+// Number of entries of each cache (metatables seen by the same OP_SELF)
+static const int SELFCACHE_SIZE = 4;
+
 class Runtime {
 public:
-    // Gets the unique instance
-    // Creates it when called for the first time
-    static Runtime* Instance();
+    // Constructor, the types are created in its own context
+    Runtime();
+
+    // Initializes the native target of LLVM (only in the first call, it can
+    // be called by many threads)
+    static void InitializeTarget();
+
+    // Obtains the context of the types and functions
+    llvm::LLVMContext& GetContext();
 
     // Obtains the type declaration
     llvm::Type* GetType(const std::string& name);
@@ -37,7 +68,6 @@ public:
     llvm::Type* MakeIntT(int nbytes = sizeof(int));
 
 private:
-    Runtime();
     void InitTypes();
     void InitFunctions();
 
@@ -62,8 +92,7 @@ private:
     #endif
     }
 
-    static Runtime* instance_;
-    llvm::LLVMContext& context_;
+    llvm::LLVMContext context_;
     std::map<std::string, llvm::Type*> types_;
     std::map<std::string, llvm::FunctionType*> functions_;
 };
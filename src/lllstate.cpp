@@ -0,0 +1,53 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllstate.cpp
+*/
+
+#include <cstdlib>
+#include <new>
+
+#include "lllstate.h"
+
+namespace lll {
+
+State::Settings::Settings() :
+    autocompile(1),
+    callstocompile(50),
+    compilesizescale(200),
+    maxcompilesize(10000),
+    maxcompilefailures(3),
+    compilebudget(250),
+    codememorylimit(0),
+    vectorize(0),
+    debuginfo(getenv("LLL_DEBUGINFO") != NULL),
+    retainir(0),
+    iterationstotrace(100),
+    maxclones(0) {
+}
+
+bool State::Open(lua_State* L) {
+    auto g = G(L);
+    State* state;
+    try {
+        state = new State();
+    } catch (std::bad_alloc&) {
+        return false;
+    }
+    g->lllstate = state;
+    g->lllautocompile = state->settings_.autocompile;
+    g->lllcallstocompile = state->settings_.callstocompile;
+    return true;
+}
+
+void State::Close(lua_State* L) {
+    auto g = G(L);
+    delete static_cast<State*>(g->lllstate);
+    g->lllstate = NULL;
+}
+
+}
+
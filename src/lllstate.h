@@ -0,0 +1,110 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllstate.h
+** Data of LLL for each Lua state (global_State): the settings, the runtime
+** (with its LLVM context), the statistics and the compiled functions
+** Since nothing is shared, Lua states in different threads can compile at
+** the same time
+*/
+
+#ifndef LLLSTATE_H
+#define LLLSTATE_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unordered_set>
+
+#include "lllruntime.h"
+#include "lllstats.h"
+#include "llltrace.h"
+
+extern "C" {
+#include "lstate.h"
+}
+
+namespace lll {
+
+class State {
+public:
+    // Compilation settings (see lllcore.h); the ones read at each call are
+    // copied to the global_State
+    struct Settings {
+        Settings();
+
+        int autocompile;
+        int callstocompile;
+        int compilesizescale;
+        int maxcompilesize;
+        int maxcompilefailures;
+        int compilebudget;
+        size_t codememorylimit;
+        int vectorize;
+        int debuginfo;
+        int retainir;
+        int iterationstotrace;
+        int maxclones;
+    };
+
+    // Auto compilation policy of a function
+    struct Policy {
+        bool scaled = false;
+        bool blacklisted = false;
+        int failures = 0;
+    };
+
+    // Numeric for loop run by the interpreter in trace mode
+    struct Loop {
+        int iterations = 0;
+        bool failed = false;
+        std::shared_ptr<Engine> engine;
+    };
+
+    // Creates the state of $L (lua_newstate), returns false if it fails
+    static bool Open(lua_State* L);
+
+    // Obtains the state of $L
+    static State& Get(lua_State* L) {
+        return *static_cast<State*>(G(L)->lllstate);
+    }
+
+    // Obtains the state of $L, or null if it wasn't created (a state that
+    // failed to open frees its objects without it)
+    static State* Find(lua_State* L) {
+        return static_cast<State*>(G(L)->lllstate);
+    }
+
+    // Destroys the state of $L (after all functions were freed)
+    static void Close(lua_State* L);
+
+    Settings settings_;
+    Runtime runtime_;
+    Stats stats_;
+
+    // Policy of the functions that reached the number of calls to compile
+    // and time spent in the current second of the compilation budget
+    std::map<Proto*, Policy> policies_;
+    std::chrono::steady_clock::time_point budgetwindow_;
+    double budgetspent_ = 0;
+
+    // Compiled functions, size of their native code and clock of their uses
+    std::unordered_set<Proto*> engines_;
+    size_t codememory_ = 0;
+    uint64_t clock_ = 0;
+
+    // Loops indexed by the first instruction of their bodies and the trace
+    // being recorded by the thread $recorder_
+    std::map<const Instruction*, Loop> loops_;
+    Trace recording_;
+    lua_State* recorder_ = nullptr;
+};
+
+}
+
+#endif
+
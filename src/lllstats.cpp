@@ -0,0 +1,205 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllstats.cpp
+*/
+
+#include <map>
+#include <string>
+
+#include <llvm/ExecutionEngine/ObjectImage.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Object/ObjectFile.h>
+
+#include "lllstats.h"
+
+extern "C" {
+#include "lprefix.h"
+#include "lua.h"
+}
+
+namespace {
+
+const char* const phasenames_[lll::Stats::NPHASES] = {
+    "build", "verify", "optimize", "codegen"
+};
+
+std::string GetName(Proto* proto) {
+    char source[LUA_IDSIZE];
+    luaO_chunkid(source, proto->source ? getstr(proto->source) : "?",
+            LUA_IDSIZE);
+    return std::string(source) + ":" + std::to_string(proto->linedefined);
+}
+
+void SetInteger(lua_State* L, const char* field, lua_Integer value) {
+    lua_pushinteger(L, value);
+    lua_setfield(L, -2, field);
+}
+
+}
+
+namespace lll {
+
+Stats::Timer::Timer(Stats& stats, Proto* proto, Phase phase) :
+    stats_(stats),
+    proto_(proto),
+    phase_(phase),
+    start_(std::chrono::steady_clock::now()) {
+}
+
+Stats::Timer::~Timer() {
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start_;
+    stats_.time_[phase_] += elapsed.count();
+    stats_.functions_[proto_].time[phase_] += elapsed.count();
+}
+
+Stats::Listener::Listener() :
+    codesize_(0) {
+}
+
+uint64_t Stats::Listener::GetCodeSize() {
+    return codesize_;
+}
+
+void Stats::Listener::NotifyObjectEmitted(const llvm::ObjectImage& object) {
+    for (auto i = object.begin_symbols(), e = object.end_symbols(); i != e;
+         ++i) {
+        llvm::object::SymbolRef::Type type;
+        uint64_t size;
+        if (!i->getType(type) && type == llvm::object::SymbolRef::ST_Function &&
+            !i->getSize(size))
+            codesize_ += size;
+    }
+}
+
+uint64_t Stats::CountInstructions(llvm::Module* module) {
+    uint64_t n = 0;
+    for (auto& function : *module)
+        for (auto& block : function)
+            n += block.size();
+    return n;
+}
+
+void Stats::AddCompiled(Proto* proto, uint64_t codesize, uint64_t irsize) {
+    auto& function = functions_[proto];
+    function.compiled = true;
+    function.codesize = codesize;
+    function.irsize = irsize;
+    compiled_++;
+}
+
+void Stats::AddFailure(Proto* proto) {
+    functions_[proto].failures++;
+    failed_++;
+}
+
+void Stats::AddShared(Proto* proto, uint64_t codesize) {
+    auto& function = functions_[proto];
+    function.compiled = true;
+    function.codesize = codesize;
+    function.irsize = 0;
+    shared_++;
+}
+
+void Stats::AddClone(Proto* proto, uint64_t codesize) {
+    functions_[proto].codesize += codesize;
+    clones_++;
+}
+
+void Stats::AddTrace(uint64_t codesize) {
+    tracecodesize_ += codesize;
+    traces_++;
+}
+
+void Stats::AddTraceFailure() {
+    failedtraces_++;
+}
+
+void Stats::AddEviction(Proto* proto) {
+    auto& function = functions_[proto];
+    function.compiled = false;
+    function.evictions++;
+    function.codesize = 0;
+    function.irsize = 0;
+    evicted_++;
+}
+
+void Stats::AddEntry(bool compiled) {
+    if (compiled)
+        compiledentries_++;
+    else
+        interpretedentries_++;
+}
+
+void Stats::Remove(Proto* proto) {
+    functions_.erase(proto);
+}
+
+void Stats::PushTime(lua_State* L, const double* time) {
+    double total = 0;
+    lua_createtable(L, 0, NPHASES + 1);
+    for (int i = 0; i < NPHASES; ++i) {
+        lua_pushnumber(L, time[i]);
+        lua_setfield(L, -2, phasenames_[i]);
+        total += time[i];
+    }
+    lua_pushnumber(L, total);
+    lua_setfield(L, -2, "total");
+}
+
+void Stats::Push(lua_State* L) {
+    // Functions with the same name (chunk loaded more than once) are merged
+    std::map<std::string, Function> byname;
+    uint64_t codesize = 0, irsize = 0;
+    for (auto& f : functions_) {
+        auto& function = byname[GetName(f.first)];
+        function.compiled |= f.second.compiled;
+        function.failures += f.second.failures;
+        function.evictions += f.second.evictions;
+        for (int i = 0; i < NPHASES; ++i)
+            function.time[i] += f.second.time[i];
+        function.codesize += f.second.codesize;
+        function.irsize += f.second.irsize;
+        codesize += f.second.codesize;
+        irsize += f.second.irsize;
+    }
+
+    lua_newtable(L);
+    SetInteger(L, "compiled", compiled_);
+    SetInteger(L, "failed", failed_);
+    SetInteger(L, "shared", shared_);
+    SetInteger(L, "evicted", evicted_);
+    SetInteger(L, "clones", clones_);
+    SetInteger(L, "traces", traces_);
+    SetInteger(L, "failedtraces", failedtraces_);
+    PushTime(L, time_);
+    lua_setfield(L, -2, "time");
+    SetInteger(L, "codesize", codesize + tracecodesize_);
+    SetInteger(L, "irsize", irsize);
+    lua_createtable(L, 0, 2);
+    SetInteger(L, "compiled", compiledentries_);
+    SetInteger(L, "interpreted", interpretedentries_);
+    lua_setfield(L, -2, "entries");
+
+    lua_createtable(L, 0, byname.size());
+    for (auto& f : byname) {
+        lua_createtable(L, 0, 6);
+        lua_pushboolean(L, f.second.compiled);
+        lua_setfield(L, -2, "compiled");
+        SetInteger(L, "failures", f.second.failures);
+        SetInteger(L, "evictions", f.second.evictions);
+        PushTime(L, f.second.time);
+        lua_setfield(L, -2, "time");
+        SetInteger(L, "codesize", f.second.codesize);
+        SetInteger(L, "irsize", f.second.irsize);
+        lua_setfield(L, -2, f.first.c_str());
+    }
+    lua_setfield(L, -2, "functions");
+}
+
+}
+
@@ -0,0 +1,131 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** lllstats.h
+** Counters of the compiler: compilations, time of each phase, code size and
+** entries into the compiled functions
+*/
+
+#ifndef LLLSTATS_H
+#define LLLSTATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+extern "C" {
+#include "lobject.h"
+}
+
+namespace llvm {
+class Module;
+}
+
+namespace lll {
+
+class Stats {
+public:
+    // Phases of the compilation
+    enum Phase {
+        BUILD,      // IR construction
+        VERIFY,     // module verification
+        OPTIMIZE,   // IR optimization passes
+        CODEGEN,    // native code generation
+        NPHASES
+    };
+
+    // Adds the time of its scope to a phase of the compilation of $proto
+    class Timer {
+    public:
+        Timer(Stats& stats, Proto* proto, Phase phase);
+        ~Timer();
+
+    private:
+        Stats& stats_;
+        Proto* proto_;
+        Phase phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Sums the size of the functions of the emitted objects
+    class Listener : public llvm::JITEventListener {
+    public:
+        Listener();
+
+        // Obtains the total size of the emitted functions
+        uint64_t GetCodeSize();
+
+        virtual void NotifyObjectEmitted(const llvm::ObjectImage& object);
+
+    private:
+        uint64_t codesize_;
+    };
+
+    // Obtains the number of IR instructions of a module
+    static uint64_t CountInstructions(llvm::Module* module);
+
+    // Registers the result of the compilation of $proto
+    void AddCompiled(Proto* proto, uint64_t codesize, uint64_t irsize);
+    void AddFailure(Proto* proto);
+
+    // Registers that $proto uses the code compiled by another state
+    void AddShared(Proto* proto, uint64_t codesize);
+
+    // Registers a clone of $proto (see Compiler)
+    void AddClone(Proto* proto, uint64_t codesize);
+
+    // Registers the result of the compilation of a trace (see llltrace.h)
+    void AddTrace(uint64_t codesize);
+    void AddTraceFailure();
+
+    // Registers that the compiled code of $proto was freed
+    void AddEviction(Proto* proto);
+
+    // Counts a call of a Lua function
+    void AddEntry(bool compiled);
+
+    // Removes the counters of $proto (it was collected)
+    void Remove(Proto* proto);
+
+    // Pushes the table with the counters
+    void Push(lua_State* L);
+
+private:
+    // Counters of a function
+    struct Function {
+        bool compiled = false;
+        int failures = 0;
+        int evictions = 0;
+        double time[NPHASES] = {};
+        uint64_t codesize = 0;
+        uint64_t irsize = 0;
+    };
+
+    // Pushes the table with the time of each phase
+    static void PushTime(lua_State* L, const double* time);
+
+    // Counters of the functions that weren't collected
+    std::map<Proto*, Function> functions_;
+
+    lua_Integer compiled_ = 0;
+    lua_Integer failed_ = 0;
+    lua_Integer shared_ = 0;
+    lua_Integer evicted_ = 0;
+    lua_Integer clones_ = 0;
+    lua_Integer traces_ = 0;
+    lua_Integer failedtraces_ = 0;
+    uint64_t tracecodesize_ = 0;
+    double time_[NPHASES] = {};
+    lua_Integer compiledentries_ = 0;
+    lua_Integer interpretedentries_ = 0;
+};
+
+}
+
+#endif
+
@@ -15,6 +15,7 @@
 extern "C" {
 #include "lprefix.h"
 #include "llimits.h"
+#include "lllarray.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "ltm.h"
@@ -23,37 +24,146 @@ extern "C" {
 namespace lll {
 
 TableGet::TableGet(CompilerState& cs, Stack& stack, Value& table, Value& key,
-        Register& dest) :
+        Register& dest, CompilerState::HoistedLoad* hoisted,
+        llvm::Value* inrange, llvm::Value* selfcache) :
     Opcode(cs, stack),
     table_(table),
     key_(key),
     dest_(dest),
+    hoisted_(hoisted),
+    inrange_(inrange),
+    selfcache_(selfcache),
     tablevalue_(nullptr),
-    switchtag_(cs_.CreateSubBlock("switchtag")),
+    checktable_(hoisted ? cs_.CreateSubBlock("checktable") : entry_),
+    switchtag_(cs_.CreateSubBlock("switchtag", checktable_)),
     getint_(cs_.CreateSubBlock("getint", switchtag_)),
     getshrstr_(cs_.CreateSubBlock("getshrstr", getint_)),
     getlngstr_(cs_.CreateSubBlock("getlngstr", getshrstr_)),
     getany_(cs_.CreateSubBlock("getany", getlngstr_)),
     saveresult_(cs_.CreateSubBlock("saveresult", getany_)),
     searchtm_(cs_.CreateSubBlock("searchtm", saveresult_)),
-    finishget_(cs_.CreateSubBlock("finshget", searchtm_)) {
+    finishget_(cs_.CreateColdBlock("finshget", searchtm_)) {
 }
 
 void TableGet::Compile() {
+    CheckHoisted();
     CheckTable();
     SwithTag();
     PerformGet();
+    SearchSelfCache();
     SearchForTM();
     SaveResult();
     FinishGet();
 }
 
-void TableGet::CheckTable() {
+void TableGet::CheckHoisted() {
+    if (!hoisted_)
+        return;
+
+    auto usehoisted = cs_.CreateSubBlock("usehoisted", entry_);
+
     cs_.B_.SetInsertPoint(entry_);
-    cs_.B_.CreateCondBr(table_.HasTag(ctb(LUA_TTABLE)), switchtag_, finishget_);
+    auto valid = cs_.B_.CreateLoad(hoisted_->valid, "hoisted.valid");
+    cs_.B_.CreateCondBr(cs_.ToBool(valid), usehoisted, checktable_);
+
+    cs_.B_.SetInsertPoint(usehoisted);
+    RTRegister result(cs_, hoisted_->tvalue);
+    dest_.Assign(result);
+    cs_.B_.CreateBr(exit_);
+}
+
+void TableGet::CheckTable() {
+    // The code of the arrays is only created if the lll library is open
+    bool hasarrays = lllarray_metatable(cs_.L_) != nullptr;
+    auto checkarray = hasarrays ?
+            cs_.CreateSubBlock("checkarray", checktable_) : finishget_;
+    cs_.B_.SetInsertPoint(checktable_);
+    cs_.B_.CreateCondBr(table_.HasTag(ctb(LUA_TTABLE)), switchtag_, checkarray);
+    if (hasarrays) {
+        GetArrayElement(checkarray);
+    } else {
+        auto ttvalue = static_cast<llvm::PointerType*>(
+                cs_.rt_.GetType("TValue"));
+        tms_.push_back({llvm::ConstantPointerNull::get(ttvalue), checktable_});
+    }
+}
+
+void TableGet::GetArrayElement(llvm::BasicBlock* checkarray) {
+    auto checkmt = cs_.CreateSubBlock("checkmt", checkarray);
+    auto checkkey = cs_.CreateSubBlock("checkkey", checkmt);
+    auto checkbounds = cs_.CreateSubBlock("checkbounds", checkkey);
+    auto switchtype = cs_.CreateSubBlock("switchtype", checkbounds);
     auto ttvalue = static_cast<llvm::PointerType*>(cs_.rt_.GetType("TValue"));
     auto nulltvalue = llvm::ConstantPointerNull::get(ttvalue);
-    tms_.push_back({nulltvalue, entry_});
+    auto tablet = cs_.rt_.GetType("Table");
+    auto tluainteger = cs_.rt_.GetType("lua_Integer");
+    auto bytet = cs_.rt_.MakeIntT(1);
+
+    // The other values (and out of bounds keys) are handled by luaV_finishget
+    auto CondBrOrFinish = [&](llvm::Value* cond, llvm::BasicBlock* next) {
+        cs_.B_.CreateCondBr(cond, next, finishget_);
+        tms_.push_back({nulltvalue, cs_.B_.GetInsertBlock()});
+    };
+
+    // Typed arrays are the userdata with the metatable of lll.array
+    cs_.B_.SetInsertPoint(checkarray);
+    CondBrOrFinish(table_.HasTag(ctb(LUA_TUSERDATA)), checkmt);
+
+    cs_.B_.SetInsertPoint(checkmt);
+    auto udata = table_.GetGCValue();
+    auto metatable = cs_.LoadField(udata, tablet, offsetof(Udata, metatable),
+            "metatable");
+    auto isarray = cs_.B_.CreateICmpEQ(metatable,
+            cs_.GetArrayMetatable(), "is.array");
+    CondBrOrFinish(isarray, checkkey);
+
+    cs_.B_.SetInsertPoint(checkkey);
+    CondBrOrFinish(key_.HasTag(LUA_TNUMINT), checkbounds);
+
+    cs_.B_.SetInsertPoint(checkbounds);
+    auto array = cs_.GetFieldPtr(udata, bytet, sizeof(UUdata), "array");
+    auto size = cs_.LoadField(array, tluainteger, offsetof(LLLArray, size),
+            "size");
+    auto key = key_.GetInteger();
+    auto idx = cs_.B_.CreateSub(key, cs_.MakeInt(1, key->getType()), "idx");
+    CondBrOrFinish(cs_.B_.CreateICmpULT(idx, size, "inbounds"), switchtype);
+
+    cs_.B_.SetInsertPoint(switchtype);
+    auto type = cs_.LoadField(array, tluainteger, offsetof(LLLArray, type),
+            "type");
+    auto data = cs_.GetFieldPtr(array, bytet, sizeof(LLLArray), "data");
+    auto getuint8 = cs_.CreateSubBlock("getuint8", switchtype);
+    auto s = cs_.B_.CreateSwitch(type, getuint8, 3);
+    auto LoadElement = [&](int arraytype, llvm::Type* elementtype) {
+        auto block = cs_.CreateSubBlock("getelement", switchtype);
+        if (arraytype != LLL_ARRAY_UINT8)
+            s->addCase(static_cast<llvm::ConstantInt*>(
+                    cs_.MakeInt(arraytype, tluainteger)), block);
+        else
+            block = getuint8;
+        cs_.B_.SetInsertPoint(block);
+        auto elements = cs_.B_.CreateBitCast(data,
+                llvm::PointerType::get(elementtype, 0), "elements");
+        return cs_.B_.CreateLoad(cs_.B_.CreateGEP(elements, idx), "element");
+    };
+
+    auto float64 = LoadElement(LLL_ARRAY_FLOAT64,
+            llvm::Type::getDoubleTy(cs_.context_));
+    dest_.SetFloat(cs_.B_.CreateFPCast(float64,
+            cs_.rt_.GetType("lua_Number")));
+    cs_.B_.CreateBr(exit_);
+
+    auto int64 = LoadElement(LLL_ARRAY_INT64, cs_.rt_.MakeIntT(8));
+    dest_.SetInteger(cs_.B_.CreateSExtOrTrunc(int64, tluainteger));
+    cs_.B_.CreateBr(exit_);
+
+    auto int32 = LoadElement(LLL_ARRAY_INT32, cs_.rt_.MakeIntT(4));
+    dest_.SetInteger(cs_.B_.CreateSExt(int32, tluainteger));
+    cs_.B_.CreateBr(exit_);
+
+    auto uint8 = LoadElement(LLL_ARRAY_UINT8, cs_.rt_.MakeIntT(1));
+    dest_.SetInteger(cs_.B_.CreateZExt(uint8, tluainteger));
+    cs_.B_.CreateBr(exit_);
 }
 
 void TableGet::SwithTag() {
@@ -76,15 +186,122 @@ void TableGet::SwithTag() {
 }
 
 void TableGet::PerformGet() {
-    PerformGetCase(getint_, &Value::GetInteger, "int");
+    PerformGetInt();
     PerformGetCase(getshrstr_, &Value::GetTString, "shortstr");
     PerformGetCase(getlngstr_, &Value::GetTString, "str");
     PerformGetCase(getany_, &Value::GetTValue, "");
 }
 
+void TableGet::SearchSelfCache() {
+    if (!selfcache_)
+        return;
+
+    // The regular search continues at a new block
+    auto searchcache = searchtm_;
+    auto fillcache = cs_.CreateColdBlock("fillcache", searchcache);
+    searchtm_ = cs_.CreateSubBlock("searchtm", fillcache);
+
+    auto tablet = cs_.rt_.GetType("Table");
+    auto nodet = cs_.rt_.GetType("Node");
+    auto intt = cs_.rt_.MakeIntT(sizeof(int));
+    auto bytet = cs_.rt_.MakeIntT(sizeof(lu_byte));
+    auto keytag = offsetof(Node, i_key) + offsetof(TValue, tt_);
+    auto keyvalue = offsetof(Node, i_key) + offsetof(TValue, value_);
+    auto valuetag = offsetof(Node, i_val) + offsetof(TValue, tt_);
+
+    cs_.B_.SetInsertPoint(searchcache);
+    auto metatable = cs_.LoadField(tablevalue_, tablet,
+            offsetof(Table, metatable), "metatable");
+    auto next = cs_.CreateSubBlock("checkentry", searchcache);
+    cs_.B_.CreateCondBr(cs_.B_.CreateIsNull(metatable), searchtm_, next);
+
+    // Verifies if $table still has the node part of the entry
+    auto SameNodes = [&](llvm::Value* table, size_t nodeoffset,
+            size_t sizeoffset) {
+        auto node = cs_.LoadField(table, nodet, offsetof(Table, node), "node");
+        auto lsize = cs_.LoadField(table, bytet, offsetof(Table, lsizenode),
+                "lsizenode");
+        auto cnode = cs_.LoadField(selfcache_, nodet, nodeoffset, "cnode");
+        auto clsize = cs_.LoadField(selfcache_, intt, sizeoffset, "clsize");
+        return cs_.B_.CreateAnd(cs_.B_.CreateICmpEQ(node, cnode),
+                cs_.B_.CreateICmpEQ(cs_.B_.CreateZExt(lsize, intt), clsize));
+    };
+
+    // Verifies if the node still has the $key (and a value with $tag)
+    auto SameKey = [&](llvm::Value* node, llvm::Value* key) {
+        auto tag = cs_.LoadField(node, intt, keytag, "keytag");
+        auto value = cs_.LoadField(node, key->getType(), keyvalue, "key");
+        return cs_.B_.CreateAnd(
+                cs_.B_.CreateICmpEQ(tag, cs_.MakeInt(ctb(LUA_TSHRSTR))),
+                cs_.B_.CreateICmpEQ(value, key));
+    };
+
+    auto indexname = cs_.GetTMName(TM_INDEX);
+    for (int i = 0; i < SELFCACHE_SIZE; ++i) {
+        auto entry = next;
+        auto checkmt = cs_.CreateSubBlock("checkmt", entry);
+        auto checkindex = cs_.CreateSubBlock("checkindex", checkmt);
+        auto checkmethod = cs_.CreateSubBlock("checkmethod", checkindex);
+        auto hit = cs_.CreateSubBlock("hit", checkmethod);
+        next = (i + 1 < SELFCACHE_SIZE) ?
+                cs_.CreateSubBlock("checkentry", hit) : fillcache;
+        size_t base = i * sizeof(SelfCacheEntry);
+        #define ENTRY(field) base + offsetof(SelfCacheEntry, field)
+
+        cs_.B_.SetInsertPoint(entry);
+        auto cmetatable = cs_.LoadField(selfcache_, tablet, ENTRY(metatable),
+                "cmetatable");
+        auto ismt = cs_.B_.CreateICmpEQ(metatable, cmetatable);
+        cs_.B_.CreateCondBr(ismt, checkmt, next);
+
+        // metatable.__index is the cached table
+        cs_.B_.SetInsertPoint(checkmt);
+        auto samemtnodes = SameNodes(metatable, ENTRY(mtnode),
+                ENTRY(mtlsizenode));
+        cs_.B_.CreateCondBr(samemtnodes, checkindex, fillcache);
+
+        cs_.B_.SetInsertPoint(checkindex);
+        auto mtslot = cs_.LoadField(selfcache_, nodet, ENTRY(mtslot),
+                "mtslot");
+        auto index = cs_.LoadField(selfcache_, tablet, ENTRY(index), "index");
+        auto indextag = cs_.LoadField(mtslot, intt, valuetag, "indextag");
+        auto indexvalue = cs_.LoadField(mtslot, tablet,
+                offsetof(Node, i_val) + offsetof(TValue, value_),
+                "indexvalue");
+        auto isindex = cs_.B_.CreateAnd(SameKey(mtslot, indexname),
+                cs_.B_.CreateAnd(
+                    cs_.B_.CreateICmpEQ(indextag,
+                            cs_.MakeInt(ctb(LUA_TTABLE))),
+                    cs_.B_.CreateICmpEQ(indexvalue, index)));
+        auto samenodes = SameNodes(index, ENTRY(node), ENTRY(lsizenode));
+        cs_.B_.CreateCondBr(cs_.B_.CreateAnd(isindex, samenodes), checkmethod,
+                fillcache);
+
+        // __index[key] is at the cached node
+        cs_.B_.SetInsertPoint(checkmethod);
+        auto slot = cs_.LoadField(selfcache_, nodet, ENTRY(slot), "slot");
+        auto methodtag = cs_.LoadField(slot, intt, valuetag, "methodtag");
+        auto ismethod = cs_.B_.CreateAnd(SameKey(slot, key_.GetTString()),
+                cs_.B_.CreateICmpNE(methodtag, cs_.MakeInt(LUA_TNIL)));
+        cs_.B_.CreateCondBr(ismethod, hit, fillcache);
+
+        cs_.B_.SetInsertPoint(hit);
+        auto ttvalue = cs_.rt_.GetType("TValue");
+        auto method = cs_.B_.CreateBitCast(slot, ttvalue, "method");
+        cs_.B_.CreateBr(saveresult_);
+        results_.push_back({method, hit});
+        #undef ENTRY
+    }
+
+    cs_.B_.SetInsertPoint(fillcache);
+    auto args = {cs_.values_.state, metatable, key_.GetTString(), selfcache_};
+    cs_.CreateCall("lll_fillselfcache", args);
+    cs_.B_.CreateBr(searchtm_);
+}
+
 void TableGet::SearchForTM() {
     auto checkflags = cs_.CreateSubBlock("checkflags", searchtm_);
-    auto callgettm = cs_.CreateSubBlock("callgettm", checkflags);
+    auto callgettm = cs_.CreateColdBlock("callgettm", checkflags);
     auto tmnotfound = cs_.CreateSubBlock("tmnotfound", callgettm);
 
     // Has metatable?
@@ -105,8 +322,7 @@ void TableGet::SearchForTM() {
     
     // Call luaT_gettm
     cs_.B_.SetInsertPoint(callgettm);
-    auto tstringt = cs_.rt_.GetType("TString");
-    auto tmname = cs_.InjectPointer(tstringt, G(cs_.L_)->tmname[TM_INDEX]);
+    auto tmname = cs_.GetTMName(TM_INDEX);
     auto args = {metatable, cs_.MakeInt(TM_INDEX), tmname};
     auto tm = cs_.CreateCall("luaT_gettm", args, "tm");
     auto istmnull = cs_.B_.CreateIsNull(tm, "is.tm.null");
@@ -125,6 +341,11 @@ void TableGet::SaveResult() {
     auto ttvalue = cs_.rt_.GetType("TValue");
     RTRegister result(cs_, CreatePHI(ttvalue, results_, "resultphi"));
     dest_.Assign(result);
+    if (hoisted_) {
+        RTRegister cache(cs_, hoisted_->tvalue);
+        cache.Assign(result);
+        cs_.B_.CreateStore(cs_.MakeInt(1, cs_.rt_.MakeIntT(1)), hoisted_->valid);
+    }
     cs_.B_.CreateBr(exit_);
 }
 
@@ -144,6 +365,43 @@ void TableGet::FinishGet() {
     cs_.B_.CreateBr(exit_);
 }
 
+void TableGet::PerformGetInt() {
+    auto checksize = cs_.CreateSubBlock("checksize", getint_);
+    auto getarray = cs_.CreateSubBlock("getarray", checksize);
+    auto callgetint = cs_.CreateSubBlock("callgetint", getarray);
+
+    // The key is inside the array part if (unsigned)(key - 1) < sizearray
+    cs_.B_.SetInsertPoint(getint_);
+    auto key = key_.GetInteger();
+    auto idx = cs_.B_.CreateSub(key, cs_.MakeInt(1, key->getType()), "idx");
+    if (inrange_) {
+        auto inrange = cs_.B_.CreateLoad(inrange_, "inrange");
+        cs_.B_.CreateCondBr(cs_.ToBool(inrange), getarray, checksize);
+    } else {
+        cs_.B_.CreateBr(checksize);
+    }
+
+    cs_.B_.SetInsertPoint(checksize);
+    auto sizearray = cs_.LoadField(tablevalue_,
+            cs_.rt_.MakeIntT(sizeof(unsigned int)), offsetof(Table, sizearray),
+            "sizearray");
+    auto size = cs_.B_.CreateZExt(sizearray, idx->getType());
+    auto inarray = cs_.B_.CreateICmpULT(idx, size, "inarray");
+    cs_.B_.CreateCondBr(inarray, getarray, callgetint);
+
+    cs_.B_.SetInsertPoint(getarray);
+    auto array = cs_.LoadField(tablevalue_, cs_.rt_.GetType("TValue"),
+            offsetof(Table, array), "array");
+    auto result = cs_.B_.CreateGEP(array, idx, "result");
+    auto tag = cs_.LoadField(result, cs_.rt_.MakeIntT(sizeof(int)),
+            offsetof(TValue, tt_), "result.tag");
+    auto isnil = cs_.B_.CreateICmpEQ(tag, cs_.MakeInt(LUA_TNIL));
+    cs_.B_.CreateCondBr(isnil, searchtm_, saveresult_);
+    results_.push_back({result, getarray});
+
+    PerformGetCase(callgetint, &Value::GetInteger, "int");
+}
+
 void TableGet::PerformGetCase(llvm::BasicBlock* block, GetMethod getmethod,
         const char* suffix) {
     cs_.B_.SetInsertPoint(block);
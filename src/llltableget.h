@@ -9,11 +9,20 @@
 ** Gets an element from $table with the $key and stores it at $dest.
 ** This class will check for compile-time-known tags and call the appropriate
 ** luaH_get* function.
+** If $hoisted is provided, the result of a previous execution is reused while
+** it is valid.
+** Integer keys inside the array part are read directly; if $inrange is set the
+** bound check has already been done by the loop preheader.
+** If $selfcache is provided (OP_SELF with a constant short string key), the
+** misses on the object are looked up in the inline cache of the metatables
+** before the search for the __index tagged method.
+** The elements of the typed arrays (lll.array) are read directly.
 */
 
 #ifndef LLLTABLEGET_H
 #define LLLTABLEGET_H
 
+#include "lllcompilerstate.h"
 #include "lllopcode.h"
 
 namespace lll {
@@ -25,20 +34,29 @@ class TableGet : public Opcode {
 public:
     // Constructor
     TableGet(CompilerState& cs, Stack& stack, Value& table, Value& key,
-            Register& dest);
+            Register& dest, CompilerState::HoistedLoad* hoisted = nullptr,
+            llvm::Value* inrange = nullptr, llvm::Value* selfcache = nullptr);
 
     // Compiles the opcode
     void Compile();
 
 private:
     // Compilation steps
+    void CheckHoisted();
     void CheckTable();
     void SwithTag();
     void PerformGet();
+    void SearchSelfCache();
     void SearchForTM();
     void SaveResult();
     void FinishGet();
 
+    // Gets an integer key, directly from the array part when possible
+    void PerformGetInt();
+
+    // Reads the element of a typed array (the table is a userdata)
+    void GetArrayElement(llvm::BasicBlock* checkarray);
+
     // Call of a specific luaH_get*
     typedef llvm::Value* (Value::*GetMethod)();
     void PerformGetCase(llvm::BasicBlock* block, GetMethod getmethod,
@@ -47,9 +65,13 @@ private:
     Value& table_;
     Value& key_;
     Register& dest_;
+    CompilerState::HoistedLoad* hoisted_;
+    llvm::Value* inrange_;
+    llvm::Value* selfcache_;
     llvm::Value* tablevalue_;
     IncomingList results_;
     IncomingList tms_;
+    llvm::BasicBlock* checktable_;
     llvm::BasicBlock* switchtag_;
     llvm::BasicBlock* getint_;
     llvm::BasicBlock* getshrstr_;
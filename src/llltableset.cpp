@@ -16,6 +16,7 @@ extern "C" {
 #include "lprefix.h"
 #include "lgc.h"
 #include "llimits.h"
+#include "lllarray.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "ltm.h"
@@ -24,11 +25,12 @@ extern "C" {
 namespace lll {
 
 TableSet::TableSet(CompilerState& cs, Stack& stack, Value& table, Value& key,
-        Value& value) :
+        Value& value, llvm::Value* inrange) :
     Opcode(cs, stack),
     table_(table),
     key_(key),
     value_(value),
+    inrange_(inrange),
     tablevalue_(nullptr),
     slot_(nullptr),
     switchtag_(cs_.CreateSubBlock("switchtag")),
@@ -39,7 +41,7 @@ TableSet::TableSet(CompilerState& cs, Stack& stack, Value& table, Value& key,
     getany_(cs_.CreateSubBlock("getany", getnil_)),
     callgcbarrier_(cs_.CreateSubBlock("callgcbarrier", getany_)),
     fastset_(cs_.CreateSubBlock("fastset", callgcbarrier_)),
-    finishset_(cs_.CreateSubBlock("finishset", fastset_)) {
+    finishset_(cs_.CreateColdBlock("finishset", fastset_)) {
 }
 
 void TableSet::Compile() {
@@ -52,11 +54,117 @@ void TableSet::Compile() {
 }
 
 void TableSet::CheckTable() {
+    // The code of the arrays is only created if the lll library is open
+    bool hasarrays = lllarray_metatable(cs_.L_) != nullptr;
+    auto checkarray = hasarrays ?
+            cs_.CreateSubBlock("checkarray", entry_) : finishset_;
     cs_.B_.SetInsertPoint(entry_);
-    cs_.B_.CreateCondBr(table_.HasTag(ctb(LUA_TTABLE)), switchtag_, finishset_);
+    cs_.B_.CreateCondBr(table_.HasTag(ctb(LUA_TTABLE)), switchtag_, checkarray);
+    if (hasarrays) {
+        SetArrayElement(checkarray);
+    } else {
+        auto ttvalue = static_cast<llvm::PointerType*>(
+                cs_.rt_.GetType("TValue"));
+        oldvals_.push_back({llvm::ConstantPointerNull::get(ttvalue), entry_});
+    }
+}
+
+void TableSet::SetArrayElement(llvm::BasicBlock* checkarray) {
+    auto checkmt = cs_.CreateSubBlock("checkmt", checkarray);
+    auto checkkey = cs_.CreateSubBlock("checkkey", checkmt);
+    auto checkbounds = cs_.CreateSubBlock("checkbounds", checkkey);
+    auto switchtype = cs_.CreateSubBlock("switchtype", checkbounds);
     auto ttvalue = static_cast<llvm::PointerType*>(cs_.rt_.GetType("TValue"));
     auto nulltvalue = llvm::ConstantPointerNull::get(ttvalue);
-    oldvals_.push_back({nulltvalue, entry_});
+    auto tablet = cs_.rt_.GetType("Table");
+    auto tluainteger = cs_.rt_.GetType("lua_Integer");
+    auto tluanumber = cs_.rt_.GetType("lua_Number");
+    auto bytet = cs_.rt_.MakeIntT(1);
+
+    // The other values (and out of bounds keys) are handled by luaV_finishset
+    auto CondBrOrFinish = [&](llvm::Value* cond, llvm::BasicBlock* next) {
+        cs_.B_.CreateCondBr(cond, next, finishset_);
+        oldvals_.push_back({nulltvalue, cs_.B_.GetInsertBlock()});
+    };
+
+    // Typed arrays are the userdata with the metatable of lll.array
+    cs_.B_.SetInsertPoint(checkarray);
+    CondBrOrFinish(table_.HasTag(ctb(LUA_TUSERDATA)), checkmt);
+
+    cs_.B_.SetInsertPoint(checkmt);
+    auto udata = table_.GetGCValue();
+    auto metatable = cs_.LoadField(udata, tablet, offsetof(Udata, metatable),
+            "metatable");
+    auto isarray = cs_.B_.CreateICmpEQ(metatable,
+            cs_.GetArrayMetatable(), "is.array");
+    CondBrOrFinish(isarray, checkkey);
+
+    cs_.B_.SetInsertPoint(checkkey);
+    CondBrOrFinish(key_.HasTag(LUA_TNUMINT), checkbounds);
+
+    cs_.B_.SetInsertPoint(checkbounds);
+    auto array = cs_.GetFieldPtr(udata, bytet, sizeof(UUdata), "array");
+    auto size = cs_.LoadField(array, tluainteger, offsetof(LLLArray, size),
+            "size");
+    auto key = key_.GetInteger();
+    auto idx = cs_.B_.CreateSub(key, cs_.MakeInt(1, key->getType()), "idx");
+    CondBrOrFinish(cs_.B_.CreateICmpULT(idx, size, "inbounds"), switchtype);
+
+    cs_.B_.SetInsertPoint(switchtype);
+    auto type = cs_.LoadField(array, tluainteger, offsetof(LLLArray, type),
+            "type");
+    auto data = cs_.GetFieldPtr(array, bytet, sizeof(LLLArray), "data");
+    auto setuint8 = cs_.CreateSubBlock("setuint8", switchtype);
+    auto s = cs_.B_.CreateSwitch(type, setuint8, 3);
+    auto StoreElement = [&](llvm::Value* element) {
+        auto elements = cs_.B_.CreateBitCast(data,
+                llvm::PointerType::get(element->getType(), 0), "elements");
+        cs_.B_.CreateStore(element, cs_.B_.CreateGEP(elements, idx));
+        cs_.B_.CreateBr(exit_);
+    };
+    auto CaseBlock = [&](int arraytype) {
+        auto block = cs_.CreateSubBlock("setelement", switchtype);
+        s->addCase(static_cast<llvm::ConstantInt*>(
+                cs_.MakeInt(arraytype, tluainteger)), block);
+        return block;
+    };
+
+    // Float arrays accept both floats and integers
+    auto setfloat64 = CaseBlock(LLL_ARRAY_FLOAT64);
+    auto floatvalue = cs_.CreateSubBlock("floatvalue", setfloat64);
+    auto checkint = cs_.CreateSubBlock("checkint", floatvalue);
+    auto intvalue = cs_.CreateSubBlock("intvalue", checkint);
+    auto storefloat64 = cs_.CreateSubBlock("storefloat64", intvalue);
+    cs_.B_.SetInsertPoint(setfloat64);
+    cs_.B_.CreateCondBr(value_.HasTag(LUA_TNUMFLT), floatvalue, checkint);
+    cs_.B_.SetInsertPoint(floatvalue);
+    auto f = value_.GetFloat();
+    cs_.B_.CreateBr(storefloat64);
+    cs_.B_.SetInsertPoint(checkint);
+    CondBrOrFinish(value_.HasTag(LUA_TNUMINT), intvalue);
+    cs_.B_.SetInsertPoint(intvalue);
+    auto i = cs_.B_.CreateSIToFP(value_.GetInteger(), tluanumber);
+    cs_.B_.CreateBr(storefloat64);
+    cs_.B_.SetInsertPoint(storefloat64);
+    auto n = cs_.B_.CreatePHI(tluanumber, 2, "n");
+    n->addIncoming(f, floatvalue);
+    n->addIncoming(i, intvalue);
+    StoreElement(cs_.B_.CreateFPCast(n,
+            llvm::Type::getDoubleTy(cs_.context_)));
+
+    // Integer arrays only accept integers, they are truncated to the size of
+    // the elements
+    auto StoreInteger = [&](llvm::BasicBlock* block, int nbytes) {
+        auto store = cs_.CreateSubBlock("storeint", block);
+        cs_.B_.SetInsertPoint(block);
+        CondBrOrFinish(value_.HasTag(LUA_TNUMINT), store);
+        cs_.B_.SetInsertPoint(store);
+        StoreElement(cs_.B_.CreateTrunc(value_.GetInteger(),
+                cs_.rt_.MakeIntT(nbytes)));
+    };
+    StoreInteger(CaseBlock(LLL_ARRAY_INT64), 8);
+    StoreInteger(CaseBlock(LLL_ARRAY_INT32), 4);
+    StoreInteger(setuint8, 1);
 }
 
 void TableSet::SwithTag() {
@@ -73,16 +181,16 @@ void TableSet::SwithTag() {
 }
 
 void TableSet::PerformGet() {
-    PerformGetCase(getint_, &Value::GetInteger, "int");
-    PerformGetCase(getshrstr_, &Value::GetTString, "shortstr");
-    PerformGetCase(getlngstr_, &Value::GetTString, "str");
-    PerformGetCase(getany_, &Value::GetTValue, "");
+    PerformGetInt();
+    PerformGetCase(getshrstr_, &Value::GetTString, "shortstr", finishset_,
+            oldvals_);
+    PerformGetCase(getlngstr_, &Value::GetTString, "str", finishset_,
+            oldvals_);
+    PerformGetCase(getany_, &Value::GetTValue, "", finishset_, oldvals_);
 
     // A nil key will always return a nil value
     cs_.B_.SetInsertPoint(getnil_);
-    auto ttvalue = cs_.rt_.GetType("TValue");
-    auto nilobj = cs_.InjectPointer(ttvalue,
-            const_cast<TValue*>(luaO_nilobject));
+    auto nilobj = cs_.GetNilObject();
     cs_.B_.CreateBr(finishset_);
     oldvals_.push_back({nilobj, getnil_});
 }
@@ -92,7 +200,7 @@ void TableSet::CallGCBarrier() {
             callgcbarrier_);
     auto checkvaluewhite = cs_.CreateSubBlock("checkvaluewhite",
             checktableblack);
-    auto callbarrierback = cs_.CreateSubBlock("callbarrierback",
+    auto callbarrierback = cs_.CreateColdBlock("callbarrierback",
             checkvaluewhite);
 
     // iscollectable(v)?
@@ -151,8 +259,57 @@ void TableSet::FinishSet() {
     cs_.B_.CreateBr(exit_);
 }
 
+void TableSet::PerformGetInt() {
+    auto checksize = cs_.CreateSubBlock("checksize", getint_);
+    auto getarray = cs_.CreateSubBlock("getarray", checksize);
+    auto callgetint = cs_.CreateSubBlock("callgetint", getarray);
+
+    // A nil slot of an integer key is the common append (t[#t + 1] = v), so
+    // it reaches the cold finishset block through a normal block
+    auto append = cs_.CreateSubBlock("append", callgetint);
+    IncomingList appendvals;
+
+    // The key is inside the array part if (unsigned)(key - 1) < sizearray
+    cs_.B_.SetInsertPoint(getint_);
+    auto key = key_.GetInteger();
+    auto idx = cs_.B_.CreateSub(key, cs_.MakeInt(1, key->getType()), "idx");
+    if (inrange_) {
+        auto inrange = cs_.B_.CreateLoad(inrange_, "inrange");
+        cs_.B_.CreateCondBr(cs_.ToBool(inrange), getarray, checksize);
+    } else {
+        cs_.B_.CreateBr(checksize);
+    }
+
+    cs_.B_.SetInsertPoint(checksize);
+    auto sizearray = cs_.LoadField(tablevalue_,
+            cs_.rt_.MakeIntT(sizeof(unsigned int)), offsetof(Table, sizearray),
+            "sizearray");
+    auto size = cs_.B_.CreateZExt(sizearray, idx->getType());
+    auto inarray = cs_.B_.CreateICmpULT(idx, size, "inarray");
+    cs_.B_.CreateCondBr(inarray, getarray, callgetint);
+
+    cs_.B_.SetInsertPoint(getarray);
+    auto array = cs_.LoadField(tablevalue_, cs_.rt_.GetType("TValue"),
+            offsetof(Table, array), "array");
+    auto result = cs_.B_.CreateGEP(array, idx, "result");
+    auto tag = cs_.LoadField(result, cs_.rt_.MakeIntT(sizeof(int)),
+            offsetof(TValue, tt_), "result.tag");
+    auto isnil = cs_.B_.CreateICmpEQ(tag, cs_.MakeInt(LUA_TNIL));
+    cs_.B_.CreateCondBr(isnil, append, callgcbarrier_);
+    appendvals.push_back({result, getarray});
+    slots_.push_back({result, getarray});
+
+    PerformGetCase(callgetint, &Value::GetInteger, "int", append, appendvals);
+
+    cs_.B_.SetInsertPoint(append);
+    auto oldval = CreatePHI(cs_.rt_.GetType("TValue"), appendvals, "oldval");
+    cs_.B_.CreateBr(finishset_);
+    oldvals_.push_back({oldval, append});
+}
+
 void TableSet::PerformGetCase(llvm::BasicBlock* block, GetMethod getmethod,
-        const char* suffix) {
+        const char* suffix, llvm::BasicBlock* nilblock,
+        IncomingList& nilvals) {
     cs_.B_.SetInsertPoint(block);
     auto tableget = std::string("luaH_get") + suffix;
     auto args = {tablevalue_, (key_.*getmethod)()};
@@ -160,8 +317,8 @@ void TableSet::PerformGetCase(llvm::BasicBlock* block, GetMethod getmethod,
     auto tag = cs_.LoadField(result, cs_.rt_.MakeIntT(sizeof(int)),
             offsetof(TValue, tt_), "result.tag");
     auto isnil = cs_.B_.CreateICmpEQ(tag, cs_.MakeInt(LUA_TNIL));
-    cs_.B_.CreateCondBr(isnil, finishset_, callgcbarrier_);
-    oldvals_.push_back({result, block});
+    cs_.B_.CreateCondBr(isnil, nilblock, callgcbarrier_);
+    nilvals.push_back({result, block});
     slots_.push_back({result, block});
 }
 
@@ -7,6 +7,8 @@
 ** llltableset.h
 ** 
 ** Implements the luaV_settable function
+** Integer keys inside the array part are accessed directly; if $inrange is set
+** the bound check has already been done by the loop preheader.
 */
 
 #ifndef LLLTABLESET_H
@@ -22,7 +24,7 @@ class TableSet : public Opcode {
 public:
     // Constructor
     TableSet(CompilerState& cs, Stack& stack, Value& table, Value& key,
-            Value& value);
+            Value& value, llvm::Value* inrange = nullptr);
 
     // Compiles the opcode
     void Compile();
@@ -36,14 +38,24 @@ private:
     void FastSet();
     void FinishSet();
 
-    // Call of a specific luaH_get*
+    // Gets the slot of an integer key, directly from the array part when
+    // possible
+    void PerformGetInt();
+
+    // Writes the element of a typed array (the table is a userdata)
+    void SetArrayElement(llvm::BasicBlock* checkarray);
+
+    // Call of a specific luaH_get*, a nil result goes to $nilblock and is
+    // added to $nilvals
     typedef llvm::Value* (Value::*GetMethod)();
     void PerformGetCase(llvm::BasicBlock* block, GetMethod getmethod,
-            const char* suffix);
+            const char* suffix, llvm::BasicBlock* nilblock,
+            IncomingList& nilvals);
 
     Value& table_;
     Value& key_;
     Value& value_;
+    llvm::Value* inrange_;
     llvm::Value* tablevalue_;
     llvm::Value* slot_;
     IncomingList slots_;
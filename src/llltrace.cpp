@@ -0,0 +1,555 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** llltrace.cpp
+*/
+
+#include <sstream>
+
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Scalar.h>
+
+#define LLL_USE_MCJIT
+#ifdef LLL_USE_MCJIT
+#include <llvm/ExecutionEngine/MCJIT.h>
+#else
+#include <llvm/ExecutionEngine/JIT.h>
+#endif
+
+#include "lllengine.h"
+#include "lllperf.h"
+#include "lllstate.h"
+#include "lllstats.h"
+#include "llltrace.h"
+
+extern "C" {
+#include "lprefix.h"
+#include "ldebug.h"
+#include "lopcodes.h"
+#include "ltable.h"
+}
+
+// Maximum number of instructions of a trace
+static const size_t MAX_STEPS = 500;
+
+// Static branch weights of the trace and the side exits
+static const uint32_t HOT_WEIGHT = 2000;
+static const uint32_t COLD_WEIGHT = 1;
+
+namespace {
+
+bool IsNumber(int tag) {
+    return tag == LUA_TNUMINT || tag == LUA_TNUMFLT;
+}
+
+// Values that can be stored without a GC barrier
+bool IsCollectable(int tag) {
+    return tag & BIT_ISCOLLECTABLE;
+}
+
+int GetTag(Proto* proto, StkId base, int arg) {
+    if (ISK(arg))
+        return INDEXK(arg) < proto->sizek ? rttype(proto->k + INDEXK(arg)) : -1;
+    return arg < proto->maxstacksize ? rttype(base + arg) : -1;
+}
+
+}
+
+namespace lll {
+
+Trace::Trace(Proto* proto, int start) :
+    proto_(proto),
+    start_(start) {
+}
+
+Trace::Status Trace::Record(CallInfo* ci) {
+    if (!isLua(ci) || clLvalue(ci->func)->p != proto_)
+        return ABORTED;
+    int pc = pcRel(ci->u.l.savedpc, proto_);
+    Instruction i = proto_->code[pc];
+    if (pc < start_ || steps_.size() >= MAX_STEPS || !IsSupported(i))
+        return ABORTED;
+
+    // The tests jump with the next instruction, it can't close upvalues
+    auto op = GET_OPCODE(i);
+    if ((op == OP_EQ || op == OP_LT || op == OP_LE || op == OP_TEST) &&
+        GETARG_A(proto_->code[pc + 1]) != 0)
+        return ABORTED;
+
+    auto base = ci->u.l.base;
+    Step step;
+    step.pc = pc;
+    step.tags[0] = GETARG_A(i) < proto_->maxstacksize ?
+            rttype(base + GETARG_A(i)) : -1;
+    step.tags[1] = GetTag(proto_, base, GETARG_B(i));
+    step.tags[2] = GetTag(proto_, base, GETARG_C(i));
+    steps_.push_back(step);
+
+    // Only the innermost loop is traced
+    if (op == OP_FORLOOP)
+        return pc + 1 + GETARG_sBx(i) == start_ ? CLOSED : ABORTED;
+    return CONTINUE;
+}
+
+bool Trace::IsActive() const {
+    return proto_ != nullptr;
+}
+
+bool Trace::IsSupported(Instruction i) {
+    switch (GET_OPCODE(i)) {
+        case OP_MOVE: case OP_LOADK: case OP_LOADBOOL: case OP_LOADNIL:
+        case OP_GETUPVAL: case OP_GETTABUP: case OP_GETTABLE:
+        case OP_SETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_UNM: case OP_EQ: case OP_LT: case OP_LE: case OP_TEST:
+        case OP_FORLOOP:
+            return true;
+        case OP_JMP:
+            return GETARG_A(i) == 0;
+        default:
+            return false;
+    }
+}
+
+TraceCompiler::TraceCompiler(lua_State* L, const Trace& trace) :
+    trace_(trace),
+    state_(State::Get(L)),
+    cs_(L, trace.proto_),
+    stack_(cs_),
+    step_(nullptr) {
+    Runtime::InitializeTarget();
+}
+
+bool TraceCompiler::Compile() {
+    bool ok = RunPhase(Stats::BUILD, &TraceCompiler::CompileSteps) &&
+              RunPhase(Stats::VERIFY, &TraceCompiler::VerifyModule) &&
+              RunPhase(Stats::OPTIMIZE, &TraceCompiler::OptimizeModule) &&
+              RunPhase(Stats::CODEGEN, &TraceCompiler::CreateEngine);
+    if (!ok)
+        state_.stats_.AddTraceFailure();
+    return ok;
+}
+
+const std::string& TraceCompiler::GetErrorMessage() {
+    return error_;
+}
+
+Engine* TraceCompiler::GetEngine() {
+    return engine_.release();
+}
+
+bool TraceCompiler::RunPhase(Stats::Phase phase,
+        bool (TraceCompiler::*step)()) {
+    Stats::Timer timer(state_.stats_, trace_.proto_, phase);
+    return (this->*step)();
+}
+
+bool TraceCompiler::CompileSteps() {
+    // The blocks of the instructions are replaced by the blocks of the steps
+    for (auto block : cs_.blocks_)
+        block->eraseFromParent();
+    cs_.blocks_.clear();
+    for (size_t i = 0; i < trace_.steps_.size(); ++i) {
+#ifdef LLL_IR_NAMES
+        auto instr = cs_.proto_->code[trace_.steps_[i].pc];
+        std::stringstream name;
+        name << "step." << i << "." << luaP_opnames[GET_OPCODE(instr)];
+        cs_.blocks_.push_back(llvm::BasicBlock::Create(cs_.context_,
+                name.str(), cs_.function_));
+#else
+        cs_.blocks_.push_back(llvm::BasicBlock::Create(cs_.context_, "",
+                cs_.function_));
+#endif
+    }
+
+    cs_.InitEntryBlock();
+    stack_.InitValues();
+    cs_.B_.CreateBr(cs_.blocks_[0]);
+
+    int nsteps = trace_.steps_.size();
+    for (cs_.curr_ = 0; cs_.curr_ < nsteps; ++cs_.curr_) {
+        step_ = &trace_.steps_[cs_.curr_];
+        cs_.instr_ = cs_.proto_->code[step_->pc];
+        cs_.B_.SetInsertPoint(cs_.blocks_[cs_.curr_]);
+        int a = GETARG_A(cs_.instr_);
+        int b = GETARG_B(cs_.instr_);
+        int c = GETARG_C(cs_.instr_);
+        bool ok = true;
+        switch (GET_OPCODE(cs_.instr_)) {
+            case OP_MOVE:
+                stack_.GetR(a).Assign(stack_.GetR(b));
+                break;
+            case OP_LOADK:
+                stack_.GetR(a).Assign(stack_.GetK(GETARG_Bx(cs_.instr_)));
+                break;
+            case OP_LOADBOOL:
+                stack_.GetR(a).SetBoolean(cs_.MakeInt(b));
+                break;
+            case OP_LOADNIL:
+                for (int i = a; i <= a + b; ++i)
+                    stack_.GetR(i).SetTagK(LUA_TNIL);
+                break;
+            case OP_GETUPVAL:
+                stack_.GetR(a).Assign(stack_.GetUp(b));
+                break;
+            case OP_GETTABUP: {
+                auto& upval = stack_.GetUp(b);
+                GuardTag(upval, ctb(LUA_TTABLE));
+                ok = CompileGetTable(upval, stack_.GetRK(c), step_->tags[2]);
+                break;
+            }
+            case OP_GETTABLE: {
+                auto& table = stack_.GetR(b);
+                ok = step_->tags[1] == ctb(LUA_TTABLE);
+                if (ok) {
+                    GuardTag(table, step_->tags[1]);
+                    ok = CompileGetTable(table, stack_.GetRK(c),
+                            step_->tags[2]);
+                }
+                break;
+            }
+            case OP_SETTABLE: ok = CompileSetTable(); break;
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+                ok = CompileArith();
+                break;
+            case OP_UNM: ok = CompileUnm(); break;
+            case OP_EQ: case OP_LT: case OP_LE: ok = CompileComparison(); break;
+            case OP_TEST: ok = CompileTest(); break;
+            case OP_FORLOOP: ok = CompileForloop(); break;
+            case OP_JMP: break;
+            default: ok = false; break;
+        }
+        if (!ok) {
+            std::stringstream error;
+            error << "can't specialize " << luaP_opnames[
+                    GET_OPCODE(cs_.instr_)] << " at " << step_->pc + 1;
+            error_ = error.str();
+            return false;
+        }
+
+        // The instructions of the path are executed in sequence
+        if (!cs_.B_.GetInsertBlock()->getTerminator())
+            cs_.B_.CreateBr(cs_.blocks_[cs_.curr_ + 1]);
+    }
+    return true;
+}
+
+bool TraceCompiler::VerifyModule() {
+    llvm::raw_string_ostream error_os(error_);
+    bool err = llvm::verifyModule(*cs_.module_, &error_os);
+    if (err) {
+        cs_.module_->dump();
+    }
+    return !err;
+}
+
+bool TraceCompiler::OptimizeModule() {
+    llvm::FunctionPassManager fpm(cs_.module_.get());
+    fpm.add(llvm::createPromoteMemoryToRegisterPass());
+    fpm.add(llvm::createGVNPass());
+    fpm.add(llvm::createSCCPPass());
+    fpm.add(llvm::createInstructionCombiningPass());
+    fpm.add(llvm::createCFGSimplificationPass());
+    fpm.add(llvm::createLICMPass());
+    fpm.add(llvm::createAggressiveDCEPass());
+    fpm.run(*cs_.function_);
+    return true;
+}
+
+bool TraceCompiler::CreateEngine() {
+    auto module = cs_.module_.get();
+#ifdef LLL_USE_MCJIT
+    std::unique_ptr<llvm::SectionMemoryManager> memory(
+            new llvm::SectionMemoryManager());
+#else
+    std::unique_ptr<llvm::SectionMemoryManager> memory;
+#endif
+    auto engine = llvm::EngineBuilder(cs_.module_.release())
+            .setErrorStr(&error_)
+            .setEngineKind(llvm::EngineKind::JIT)
+#ifdef LLL_USE_MCJIT
+            .setUseMCJIT(true)
+            .setMCJITMemoryManager(Engine::CreateMemoryManager(*memory))
+#else
+            .setUseMCJIT(false)
+#endif
+            .create();
+    if (!engine)
+        return false;
+
+    PerfListener perf("trace:" + PerfListener::GetName(cs_.proto_) + ":" +
+            std::to_string(trace_.start_));
+    Stats::Listener stats;
+    bool announce = PerfListener::IsEnabled();
+    if (announce)
+        engine->RegisterJITEventListener(&perf);
+    engine->RegisterJITEventListener(&stats);
+    engine->finalizeObject();
+    engine->UnregisterJITEventListener(&stats);
+    if (announce)
+        engine->UnregisterJITEventListener(&perf);
+    engine_.reset(new Engine(engine, module, cs_.function_, memory.release()));
+    engine_->SetCodeSize(stats.GetCodeSize());
+    if (!state_.settings_.retainir)
+        engine_->ReleaseIR();
+    state_.stats_.AddTrace(stats.GetCodeSize());
+    return true;
+}
+
+void TraceCompiler::Guard(llvm::Value* cond) {
+    auto guarded = cs_.CreateSubBlock("guarded", cs_.B_.GetInsertBlock());
+    auto exit = cs_.CreateSubBlock("exit", guarded);
+    llvm::MDBuilder mdbuilder(cs_.context_);
+    cs_.B_.CreateCondBr(cond, guarded, exit,
+            mdbuilder.createBranchWeights(HOT_WEIGHT, COLD_WEIGHT));
+    cs_.B_.SetInsertPoint(exit);
+    cs_.B_.CreateRet(cs_.MakeInt(step_->pc));
+    cs_.B_.SetInsertPoint(guarded);
+}
+
+void TraceCompiler::GuardTag(Value& value, int tag) {
+    Guard(value.HasTag(tag));
+}
+
+void TraceCompiler::GuardJump(llvm::Value* jump) {
+    int target = step_->pc + 2 + GETARG_sBx(cs_.proto_->code[step_->pc + 1]);
+    if (target == step_->pc + 2)
+        return;
+    bool jumped = (step_ + 1)->pc == target;
+    Guard(jumped ? jump : cs_.B_.CreateNot(jump));
+}
+
+llvm::Value* TraceCompiler::ToFloat(Value& value, int tag) {
+    if (tag == LUA_TNUMFLT)
+        return value.GetFloat();
+    return cs_.B_.CreateSIToFP(value.GetInteger(),
+            cs_.rt_.GetType("lua_Number"));
+}
+
+bool TraceCompiler::CompileArith() {
+    auto& ra = stack_.GetR(GETARG_A(cs_.instr_));
+    auto& rkb = stack_.GetRK(GETARG_B(cs_.instr_));
+    auto& rkc = stack_.GetRK(GETARG_C(cs_.instr_));
+    int tb = step_->tags[1];
+    int tc = step_->tags[2];
+    if (!IsNumber(tb) || !IsNumber(tc))
+        return false;
+    GuardTag(rkb, tb);
+    GuardTag(rkc, tc);
+
+    auto op = GET_OPCODE(cs_.instr_);
+    if (tb == LUA_TNUMINT && tc == LUA_TNUMINT && op != OP_DIV) {
+        auto x = rkb.GetInteger();
+        auto y = rkc.GetInteger();
+        llvm::Value* result = nullptr;
+        switch (op) {
+            case OP_ADD: result = cs_.B_.CreateAdd(x, y, "add"); break;
+            case OP_SUB: result = cs_.B_.CreateSub(x, y, "sub"); break;
+            default:     result = cs_.B_.CreateMul(x, y, "mul"); break;
+        }
+        ra.SetInteger(result);
+    } else {
+        auto x = ToFloat(rkb, tb);
+        auto y = ToFloat(rkc, tc);
+        llvm::Value* result = nullptr;
+        switch (op) {
+            case OP_ADD: result = cs_.B_.CreateFAdd(x, y, "add"); break;
+            case OP_SUB: result = cs_.B_.CreateFSub(x, y, "sub"); break;
+            case OP_MUL: result = cs_.B_.CreateFMul(x, y, "mul"); break;
+            default:     result = cs_.B_.CreateFDiv(x, y, "div"); break;
+        }
+        ra.SetFloat(result);
+    }
+    return true;
+}
+
+bool TraceCompiler::CompileUnm() {
+    auto& ra = stack_.GetR(GETARG_A(cs_.instr_));
+    auto& rb = stack_.GetR(GETARG_B(cs_.instr_));
+    int tb = step_->tags[1];
+    if (!IsNumber(tb))
+        return false;
+    GuardTag(rb, tb);
+    if (tb == LUA_TNUMINT) {
+        auto zero = cs_.MakeInt(0, cs_.rt_.GetType("lua_Integer"));
+        ra.SetInteger(cs_.B_.CreateSub(zero, rb.GetInteger(), "unm"));
+    } else {
+        ra.SetFloat(cs_.B_.CreateFNeg(rb.GetFloat(), "unm"));
+    }
+    return true;
+}
+
+bool TraceCompiler::CompileComparison() {
+    auto& rkb = stack_.GetRK(GETARG_B(cs_.instr_));
+    auto& rkc = stack_.GetRK(GETARG_C(cs_.instr_));
+    int tb = step_->tags[1];
+    int tc = step_->tags[2];
+    if (!IsNumber(tb) || tb != tc)
+        return false;
+    GuardTag(rkb, tb);
+    GuardTag(rkc, tc);
+
+    llvm::Value* result = nullptr;
+    auto op = GET_OPCODE(cs_.instr_);
+    if (tb == LUA_TNUMINT) {
+        auto x = rkb.GetInteger();
+        auto y = rkc.GetInteger();
+        switch (op) {
+            case OP_EQ: result = cs_.B_.CreateICmpEQ(x, y, "eq"); break;
+            case OP_LT: result = cs_.B_.CreateICmpSLT(x, y, "lt"); break;
+            default:    result = cs_.B_.CreateICmpSLE(x, y, "le"); break;
+        }
+    } else {
+        auto x = rkb.GetFloat();
+        auto y = rkc.GetFloat();
+        switch (op) {
+            case OP_EQ: result = cs_.B_.CreateFCmpOEQ(x, y, "eq"); break;
+            case OP_LT: result = cs_.B_.CreateFCmpOLT(x, y, "lt"); break;
+            default:    result = cs_.B_.CreateFCmpOLE(x, y, "le"); break;
+        }
+    }
+
+    // The next instruction (jump) is executed if the result is equal to A
+    if (!GETARG_A(cs_.instr_))
+        result = cs_.B_.CreateNot(result);
+    GuardJump(result);
+    return true;
+}
+
+bool TraceCompiler::CompileTest() {
+    auto& ra = stack_.GetR(GETARG_A(cs_.instr_));
+    int tag = step_->tags[0];
+    if (tag == -1)
+        return false;
+    GuardTag(ra, tag);
+
+    // The next instruction (jump) is executed if the truth is equal to C
+    llvm::Value* truth = nullptr;
+    if (tag == LUA_TBOOLEAN)
+        truth = cs_.ToBool(ra.GetBoolean());
+    else
+        truth = cs_.B_.getInt1(tag != LUA_TNIL);
+    if (!GETARG_C(cs_.instr_))
+        truth = cs_.B_.CreateNot(truth);
+    GuardJump(truth);
+    return true;
+}
+
+bool TraceCompiler::CompileGetTable(Value& table, Value& key, int keytag) {
+    auto slot = GetSlot(table.GetTable(), key, keytag);
+    if (!slot)
+        return false;
+    RTRegister value(cs_, slot);
+    stack_.GetR(GETARG_A(cs_.instr_)).Assign(value);
+    return true;
+}
+
+bool TraceCompiler::CompileSetTable() {
+    auto& table = stack_.GetR(GETARG_A(cs_.instr_));
+    auto& key = stack_.GetRK(GETARG_B(cs_.instr_));
+    auto& value = stack_.GetRK(GETARG_C(cs_.instr_));
+    int valuetag = step_->tags[2];
+    if (step_->tags[0] != ctb(LUA_TTABLE) || valuetag == -1 ||
+        IsCollectable(valuetag))
+        return false;
+    GuardTag(table, step_->tags[0]);
+    GuardTag(value, valuetag);
+
+    // The slot already has a value, so it doesn't call __newindex
+    auto slot = GetSlot(table.GetTable(), key, step_->tags[1]);
+    if (!slot)
+        return false;
+    RTRegister dest(cs_, slot);
+    dest.Assign(value);
+    return true;
+}
+
+llvm::Value* TraceCompiler::GetSlot(llvm::Value* table, Value& key,
+        int keytag) {
+    int c = GET_OPCODE(cs_.instr_) == OP_SETTABLE ? GETARG_B(cs_.instr_) :
+            GETARG_C(cs_.instr_);
+    llvm::Value* slot = nullptr;
+    if (keytag == LUA_TNUMINT) {
+        GuardTag(key, keytag);
+        auto tluainteger = cs_.rt_.GetType("lua_Integer");
+        auto index = cs_.B_.CreateSub(key.GetInteger(),
+                cs_.MakeInt(1, tluainteger), "index");
+        auto sizearray = cs_.LoadField(table,
+                cs_.rt_.MakeIntT(sizeof(unsigned int)),
+                offsetof(Table, sizearray), "sizearray");
+        auto size = cs_.B_.CreateZExt(sizearray, tluainteger, "size");
+        Guard(cs_.B_.CreateICmpULT(index, size, "inbounds"));
+        auto array = cs_.LoadField(table, cs_.rt_.GetType("TValue"),
+                offsetof(Table, array), "array");
+        slot = cs_.B_.CreateGEP(array, index, "slot");
+    } else if (ISK(c) && ttisshrstring(cs_.proto_->k + INDEXK(c))) {
+        auto args = {table, key.GetTString()};
+        slot = cs_.CreateCall("luaH_getshortstr", args, "slot");
+    } else {
+        return nullptr;
+    }
+
+    // The empty slots need the metamethods
+    RTRegister value(cs_, slot);
+    Guard(cs_.B_.CreateNot(value.HasTag(LUA_TNIL)));
+    return slot;
+}
+
+bool TraceCompiler::CompileForloop() {
+    int a = GETARG_A(cs_.instr_);
+    auto& ra = stack_.GetR(a);
+    auto& limit = stack_.GetR(a + 1);
+    auto& step = stack_.GetR(a + 2);
+    auto& var = stack_.GetR(a + 3);
+    int tag = step_->tags[0];
+    if (!IsNumber(tag))
+        return false;
+
+    // The prep converts the three values to the type of the index
+    GuardTag(ra, tag);
+    auto loop = cs_.CreateSubBlock("loop");
+    auto exit = cs_.CreateSubBlock("exit", loop);
+    llvm::Value* cont = nullptr;
+    llvm::Value* idx = nullptr;
+    if (tag == LUA_TNUMINT) {
+        auto stepv = step.GetInteger();
+        auto limitv = limit.GetInteger();
+        idx = cs_.B_.CreateAdd(ra.GetInteger(), stepv, "idx");
+        auto zero = cs_.MakeInt(0, cs_.rt_.GetType("lua_Integer"));
+        cont = cs_.B_.CreateSelect(cs_.B_.CreateICmpSGT(stepv, zero),
+                cs_.B_.CreateICmpSLE(idx, limitv),
+                cs_.B_.CreateICmpSLE(limitv, idx), "cont");
+    } else {
+        auto stepv = step.GetFloat();
+        auto limitv = limit.GetFloat();
+        idx = cs_.B_.CreateFAdd(ra.GetFloat(), stepv, "idx");
+        auto zero = llvm::ConstantFP::get(cs_.rt_.GetType("lua_Number"), 0);
+        cont = cs_.B_.CreateSelect(cs_.B_.CreateFCmpOLT(zero, stepv),
+                cs_.B_.CreateFCmpOLE(idx, limitv),
+                cs_.B_.CreateFCmpOLE(limitv, idx), "cont");
+    }
+    cs_.B_.CreateCondBr(cont, loop, exit);
+
+    cs_.B_.SetInsertPoint(loop);
+    if (tag == LUA_TNUMINT) {
+        ra.SetInteger(idx);
+        var.SetInteger(idx);
+    } else {
+        ra.SetFloat(idx);
+        var.SetFloat(idx);
+    }
+    cs_.B_.CreateBr(cs_.blocks_[0]);
+
+    // The loop is over, the interpreter continues after the FORLOOP
+    cs_.B_.SetInsertPoint(exit);
+    cs_.B_.CreateRet(cs_.MakeInt(step_->pc + 1));
+    return true;
+}
+
+}
+
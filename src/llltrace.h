@@ -0,0 +1,132 @@
+/*
+** LLL - Lua Low Level
+** September, 2015
+** Author: Gabriel de Quadros Ligneul
+** Copyright Notice for LLL: see lllcore.h
+**
+** llltrace.h
+** Trace mode: the interpreter records the path of an iteration of a hot
+** numeric for loop and the types of its operands; the trace is compiled to a
+** linear function specialized to these types. A guard that fails leaves the
+** trace (side exit) and the interpreter resumes at the guarded instruction.
+*/
+
+#ifndef LLLTRACE_H
+#define LLLTRACE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lllcompilerstate.h"
+#include "lllstats.h"
+#include "lllvalue.h"
+
+extern "C" {
+#include "lobject.h"
+}
+
+namespace lll {
+
+class Engine;
+class State;
+
+// Path of an iteration of a loop
+class Trace {
+public:
+    // Recording result of an instruction
+    enum Status {
+        CONTINUE,   // the instruction was recorded
+        CLOSED,     // the FORLOOP of the loop was recorded
+        ABORTED     // the path can't be traced
+    };
+
+    // Instruction of the path and the tags of its operands before it runs:
+    // R(A), RK(B) and RK(C) (-1 if the operand isn't a value)
+    struct Step {
+        int pc;
+        int tags[3];
+    };
+
+    // Constructor, the path starts at the first instruction of the body
+    Trace(Proto* proto = nullptr, int start = 0);
+
+    // Records the instruction fetched by the interpreter at $ci
+    Status Record(CallInfo* ci);
+
+    // Returns whether a trace is being recorded
+    bool IsActive() const;
+
+    Proto* proto_;
+    int start_;
+    std::vector<Step> steps_;
+
+private:
+    // Returns whether the instruction can be compiled in a trace
+    static bool IsSupported(Instruction i);
+};
+
+class TraceCompiler {
+public:
+    // Constructor, receives the closed trace
+    TraceCompiler(lua_State* L, const Trace& trace);
+
+    // Compiles the trace, returns false if it fails
+    bool Compile();
+
+    // Gets the compilation error message
+    const std::string& GetErrorMessage();
+
+    // Gets the engine (only if compilation succeeds)
+    Engine* GetEngine();
+
+private:
+    // Runs a step of the compilation and adds its time to $phase
+    bool RunPhase(Stats::Phase phase, bool (TraceCompiler::*step)());
+
+    // Compiles each step, the last one (FORLOOP) jumps back to the first
+    bool CompileSteps();
+    bool VerifyModule();
+    bool OptimizeModule();
+    bool CreateEngine();
+
+    // Leaves the trace if $cond is false, resuming the interpreter at the
+    // current instruction
+    void Guard(llvm::Value* cond);
+
+    // Guards the tag of a value with the recorded one
+    void GuardTag(Value& value, int tag);
+
+    // Guards the direction taken by the jump of a test in the trace, $jump
+    // is true if the interpreter performs the jump
+    void GuardJump(llvm::Value* jump);
+
+    // Obtains a number operand as float (the tag was guarded)
+    llvm::Value* ToFloat(Value& value, int tag);
+
+    // Specialized instructions
+    bool CompileArith();
+    bool CompileUnm();
+    bool CompileComparison();
+    bool CompileTest();
+    bool CompileGetTable(Value& table, Value& key, int keytag);
+    bool CompileSetTable();
+    bool CompileForloop();
+
+    // Obtains the slot of an integer key in the array part or of a short
+    // string key; leaves the trace if the slot is empty
+    llvm::Value* GetSlot(llvm::Value* table, Value& key, int keytag);
+
+    const Trace& trace_;
+    State& state_;
+    CompilerState cs_;
+    Stack stack_;
+    const Trace::Step* step_;
+    std::unique_ptr<Engine> engine_;
+    std::string error_;
+};
+
+}
+
+#endif
+
@@ -30,6 +30,7 @@ llvm::Value* Value::HasTag(int tag) {
 
 Constant::Constant(CompilerState& cs, int arg) :
     Value(cs),
+    arg_(arg),
     tvalue_(cs.proto_->k + arg) {
 }
 
@@ -38,8 +39,8 @@ llvm::Value* Constant::GetTag() {
 }
 
 llvm::Value* Constant::GetTValue() {
-    auto ttvalue = cs_.rt_.GetType("TValue");
-    return cs_.InjectPointer(ttvalue, tvalue_);
+    return cs_.B_.CreateGEP(cs_.values_.k, cs_.MakeInt(arg_),
+            "k" + std::to_string(arg_) + "_");
 }
 
 llvm::Value* Constant::GetBoolean() {
@@ -56,19 +57,20 @@ llvm::Value* Constant::GetFloat() {
     return llvm::ConstantFP::get(tluanumber, nvalue(tvalue_));
 }
 
+// The collectable values are loaded, since each state has its own objects
 llvm::Value* Constant::GetTString() {
-    auto ttstring = cs_.rt_.GetType("TString");
-    return cs_.InjectPointer(ttstring, tsvalue(tvalue_));
+    return cs_.LoadField(GetTValue(), cs_.rt_.GetType("TString"),
+            offsetof(TValue, value_), "strvalue");
 }
 
 llvm::Value* Constant::GetTable() {
-    auto ttable = cs_.rt_.GetType("Table");
-    return cs_.InjectPointer(ttable, hvalue(tvalue_));
+    return cs_.LoadField(GetTValue(), cs_.rt_.GetType("Table"),
+            offsetof(TValue, value_), "hvalue");
 }
 
 llvm::Value* Constant::GetGCValue() {
-    auto tgcobject = cs_.rt_.GetType("GCObject");
-    return cs_.InjectPointer(tgcobject, gcvalue(tvalue_));
+    return cs_.LoadField(GetTValue(), cs_.rt_.GetType("GCObject"),
+            offsetof(TValue, value_), "gcvalue");
 }
 
 MutableValue::MutableValue(CompilerState& cs) :
@@ -191,10 +193,26 @@ llvm::Value* RTRegister::GetTValue() {
 Upvalue::Upvalue(CompilerState& cs, int arg) :
     MutableValue(cs),
     arg_(arg),
+    readonly_(false),
     upval_(nullptr) {
 }
 
+void Upvalue::Init() {
+    if (!cs_.proto_->upvalues[arg_].readonly)
+        return;
+    ReloadTValue();
+    auto ttvalue = cs_.rt_.GetType("TValue");
+    auto tvaluet = static_cast<llvm::PointerType*>(ttvalue)->getElementType();
+    auto name = "upval" + std::to_string(arg_) + "_";
+    RTRegister snapshot(cs_, cs_.B_.CreateAlloca(tvaluet, nullptr, name));
+    snapshot.Assign(*this);
+    tvalue_ = snapshot.GetTValue();
+    readonly_ = true;
+}
+
 void Upvalue::ReloadTValue() {
+    if (readonly_)
+        return;
     auto upvalptr = cs_.B_.CreateGEP(cs_.values_.upvals, cs_.MakeInt(arg_),
             "upval.ptr");
     upval_ = cs_.B_.CreateLoad(upvalptr, "upval");
@@ -250,9 +268,12 @@ Upvalue& Stack::GetUp(int arg) {
 void Stack::InitValues() {
     for (auto& r : r_)
         r.Init();
+    for (auto& u : u_)
+        u.Init();
 }
 
 void Stack::Update() {
+    cs_.InvalidateLoopCaches();
     cs_.UpdateBase();
     for (auto& r : r_)
         r.ReloadTValue();
@@ -71,6 +71,7 @@ public:
     llvm::Value* GetGCValue();
 
 private:
+    int arg_;
     struct lua_TValue* tvalue_;
 };
 
@@ -161,7 +162,11 @@ public:
     // Constructor
     Upvalue(CompilerState& cs, int arg);
 
-    // Reloads the tvalue
+    // Initializes the upvalue; readonly upvalues are copied once to a local
+    // TValue; should be called at the entry block
+    void Init();
+
+    // Reloads the tvalue (does nothing for readonly upvalues)
     void ReloadTValue();
 
     // Obtains the pointer to UpVal structure
@@ -172,6 +177,7 @@ public:
 
 private:
     int arg_;
+    bool readonly_;
     llvm::Value* upval_;
     llvm::Value* tvalue_;
 };
@@ -102,7 +102,7 @@ static void pushnumint (lua_State *L, lua_Number d) {
 }
 
 
-static int math_floor (lua_State *L) {
+LUAI_FUNC int math_floor (lua_State *L) {
   if (lua_isinteger(L, 1))
     lua_settop(L, 1);  /* integer is its own floor */
   else {
@@ -163,7 +163,7 @@ static int math_modf (lua_State *L) {
 }
 
 
-static int math_sqrt (lua_State *L) {
+LUAI_FUNC int math_sqrt (lua_State *L) {
   lua_pushnumber(L, l_mathop(sqrt)(luaL_checknumber(L, 1)));
   return 1;
 }
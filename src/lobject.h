@@ -387,6 +387,7 @@ typedef struct Upvaldesc {
   TString *name;  /* upvalue name (for debug information) */
   lu_byte instack;  /* whether it is in stack (register) */
   lu_byte idx;  /* index of upvalue (in stack or in outer function's list) */
+  lu_byte readonly;  /* whether it is never assigned after its creation */
 } Upvaldesc;
 
 
@@ -437,6 +438,7 @@ typedef struct Proto {
   int ncalls;
   LLLFunction lllfunction;
   void *llldata;
+  void *lllcache;  /* inline caches of the compiled code */
 } Proto;
 
 
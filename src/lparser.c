@@ -179,6 +179,7 @@ static void new_localvar (LexState *ls, TString *name) {
                   MAXVARS, "local variables");
   luaM_growvector(ls->L, dyd->actvar.arr, dyd->actvar.n + 1,
                   dyd->actvar.size, Vardesc, MAX_INT, "local variables");
+  dyd->actvar.arr[dyd->actvar.n].written = 0;
   dyd->actvar.arr[dyd->actvar.n++].idx = cast(short, reg);
 }
 
@@ -191,6 +192,11 @@ static void new_localvarliteral_ (LexState *ls, const char *name, size_t sz) {
 	new_localvarliteral_(ls, "" v, (sizeof(v)/sizeof(char))-1)
 
 
+static Vardesc *getvardesc (FuncState *fs, int i) {
+  return &fs->ls->dyd->actvar.arr[fs->firstlocal + i];
+}
+
+
 static LocVar *getlocvar (FuncState *fs, int i) {
   int idx = fs->ls->dyd->actvar.arr[fs->firstlocal + i].idx;
   lua_assert(idx < fs->nlocvars);
@@ -233,12 +239,65 @@ static int newupvalue (FuncState *fs, TString *name, expdesc *v) {
   while (oldsize < f->sizeupvalues) f->upvalues[oldsize++].name = NULL;
   f->upvalues[fs->nups].instack = (v->k == VLOCAL);
   f->upvalues[fs->nups].idx = cast_byte(v->u.info);
+  if (fs->prev == NULL)  /* environment of the main function? */
+    f->upvalues[fs->nups].readonly = 1;
+  else if (v->k == VLOCAL)
+    f->upvalues[fs->nups].readonly = !getvardesc(fs->prev, v->u.info)->written;
+  else
+    f->upvalues[fs->nups].readonly =
+        fs->prev->f->upvalues[v->u.info].readonly;
   f->upvalues[fs->nups].name = name;
   luaC_objbarrier(fs->ls->L, f, name);
   return fs->nups++;
 }
 
 
+/*
+** Clear the 'readonly' flag of the upvalues of the nested functions of 'f'
+** that refer to its local 'idx' (instack) or to its upvalue 'idx'. The
+** registers are reused by other variables, so the marking may be too
+** conservative, but never too optimistic.
+*/
+static void markcaptures (Proto *f, int instack, int idx) {
+  int i, j;
+  for (i = 0; i < f->sizep; i++) {
+    Proto *c = f->p[i];
+    if (c == NULL) continue;
+    for (j = 0; j < c->sizeupvalues; j++) {
+      Upvaldesc *up = &c->upvalues[j];
+      if (up->name != NULL && up->instack == instack && up->idx == idx) {
+        up->readonly = 0;
+        markcaptures(c, 0, j);
+      }
+    }
+  }
+}
+
+
+/*
+** Variable 'v' (a local or an upvalue) is the target of an assignment.
+*/
+static void markwritten (FuncState *fs, expdesc *v) {
+  expkind k = v->k;
+  int idx = v->u.info;
+  while (k == VUPVAL) {  /* go up to the function that declares it */
+    Upvaldesc *up = &fs->f->upvalues[idx];
+    up->readonly = 0;
+    if (fs->prev == NULL) {  /* environment of the main function */
+      markcaptures(fs->f, 0, idx);
+      return;
+    }
+    k = up->instack ? VLOCAL : VUPVAL;
+    idx = up->idx;
+    fs = fs->prev;
+  }
+  if (k == VLOCAL) {
+    getvardesc(fs, idx)->written = 1;
+    markcaptures(fs->f, 1, idx);
+  }
+}
+
+
 static int searchvar (FuncState *fs, TString *n) {
   int i;
   for (i = cast_int(fs->nactvar) - 1; i >= 0; i--) {
@@ -1163,11 +1222,13 @@ static void assignment (LexState *ls, struct LHS_assign *lh, int nvars) {
     }
     else {
       luaK_setoneret(ls->fs, &e);  /* close last expression */
+      markwritten(ls->fs, &lh->v);
       luaK_storevar(ls->fs, &lh->v, &e);
       return;  /* avoid default */
     }
   }
   init_exp(&e, VNONRELOC, ls->fs->freereg-1);  /* default assignment */
+  markwritten(ls->fs, &lh->v);
   luaK_storevar(ls->fs, &lh->v, &e);
 }
 
@@ -1478,6 +1539,7 @@ static void funcstat (LexState *ls, int line) {
   luaX_next(ls);  /* skip FUNCTION */
   ismethod = funcname(ls, &v);
   body(ls, &b, ismethod, line);
+  markwritten(ls->fs, &v);
   luaK_storevar(ls->fs, &v, &b);
   luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
 }
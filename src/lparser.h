@@ -58,6 +58,7 @@ typedef struct expdesc {
 /* description of active local variable */
 typedef struct Vardesc {
   short idx;  /* variable index in stack */
+  lu_byte written;  /* whether it is assigned after its declaration */
 } Vardesc;
 
 
@@ -21,6 +21,8 @@
 #include "lfunc.h"
 #include "lgc.h"
 #include "llex.h"
+#include "lllcore.h"
+#include "lllprofile.h"
 #include "lmem.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -208,6 +210,8 @@ static void f_luaopen (lua_State *L, void *ud) {
   luaS_init(L);
   luaT_init(L);
   luaX_init(L);
+  if (LLLOpenState(L))  /* LLL: create the compiler data */
+    luaD_throw(L, LUA_ERRMEM);
   g->gcrunning = 1;  /* allow gc */
   g->version = lua_version(NULL);
   luai_userstateopen(L);
@@ -241,8 +245,10 @@ static void preinit_thread (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  lllprofile_close(L);  /* LLL: the profiled thread is about to be freed */
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeallobjects(L);  /* collect all objects */
+  LLLCloseState(L);
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
@@ -326,6 +332,12 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
+  g->lllstate = NULL;
+  g->lllarraymt = NULL;
+  setnilvalue(&g->lllnilvalue);
+  g->llltrace = 0;
+  g->lllautocompile = 0;
+  g->lllcallstocompile = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
@@ -141,6 +141,12 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  void *lllstate;  /* LLL data of the state (see lllstate.h) */
+  struct Table *lllarraymt;  /* metatable of the arrays (see lllarray.c) */
+  TValue lllnilvalue;  /* nil read by the compiled code */
+  lu_byte llltrace;  /* trace mode enabled (see llltrace.h) */
+  lu_byte lllautocompile;  /* auto compilation enabled (read at each call) */
+  int lllcallstocompile;  /* calls to auto compile a function */
 } global_State;
 
 
@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "lllcore.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -774,8 +775,12 @@ void luaV_execute (lua_State *L) {
   for (;;) {
     Instruction i = *(ci->u.l.savedpc++);
     StkId ra;
-    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
-      Protect(luaG_traceexec(L));
+    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT | LLL_MASKRECORD)) {
+      if (L->hookmask & LLL_MASKRECORD)  /* LLL: recording a trace? */
+        LLLRecordTrace(L, ci);
+      if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
+        Protect(luaG_traceexec(L));
+    }
     /* WARNING: several calls may realloc the stack and invalidate 'ra' */
     ra = RA(i);
     lua_assert(base == ci->u.l.base);
@@ -1177,6 +1182,8 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            if (G(L)->llltrace)  /* LLL: trace mode? */
+              Protect(LLLTraceLoop(L, ci));
           }
         }
         else {  /* floating loop */
@@ -1188,6 +1195,8 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            if (G(L)->llltrace)  /* LLL: trace mode? */
+              Protect(LLLTraceLoop(L, ci));
           }
         }
         vmbreak;
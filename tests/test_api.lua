@@ -46,3 +46,208 @@ assert(lll.isCompiled(h) == true)
 -- Execute compiled functions
 assert(f() == 123 and g() == 'abc' and h() == 'qwe')
 
+
+-- Perf map of the compiled functions (the pid is read from /proc)
+local stat = io.open('/proc/self/stat')
+if stat then
+    local pid = stat:read('n')
+    stat:close()
+    lll.setPerfMapEnable(true)
+    assert(lll.isPerfMapEnable() == true)
+    local function perf() return 'perf' end
+    assert(lll.compile(perf))
+    lll.setPerfMapEnable(false)
+    assert(lll.isPerfMapEnable() == false)
+    local map = assert(io.open('/tmp/perf-' .. math.tointeger(pid) .. '.map'))
+    local entries = map:read('a')
+    map:close()
+    local line = debug.getinfo(perf, 'S').linedefined
+    assert(entries:find('lua:[^\n]*test_api%.lua:' .. line))
+end
+
+-- Compilation with debug info
+lll.setDebugInfoEnable(true)
+assert(lll.isDebugInfoEnable() == true)
+local function dbg(a, b)
+    local t = {}
+    for i = 1, a do t[i] = i * b end
+    return #t
+end
+assert(lll.compile(dbg))
+lll.setDebugInfoEnable(false)
+assert(lll.isDebugInfoEnable() == false)
+assert(dbg(10, 2) == 10)
+
+-- Sampling profiler, with interpreted and compiled frames
+local function busy(n)
+    local s = 0
+    for i = 1, n do s = s + i % 7 end
+    return s
+end
+lll.setDebugInfoEnable(true)
+assert(lll.compile(busy))
+lll.setDebugInfoEnable(false)
+lll.profile.start(1000)
+local clock = os.clock()
+while os.clock() - clock < 0.2 do busy(10000) end
+local flat, samples, dropped = lll.profile.stop()
+assert(type(flat) == 'string' and samples >= 0 and dropped == 0)
+assert(samples == 0 or flat:find('test_api%.lua:%d+'))
+lll.profile.start()
+busy(10000)
+local folded = lll.profile.stop('folded')
+assert(type(folded) == 'string')
+assert(not pcall(lll.profile.stop))
+debug.sethook(function() end, '', 1000)
+assert(not pcall(lll.profile.start))
+debug.sethook()
+
+-- Compiler statistics
+local before = lll.stats()
+local function counted(a) return a + 1 end
+assert(lll.compile(counted))
+for i = 1, 10 do counted(i) end
+local stats = lll.stats()
+assert(stats.compiled == before.compiled + 1)
+assert(stats.entries.compiled >= before.entries.compiled + 10)
+assert(stats.time.total >= stats.time.codegen and stats.time.codegen > 0)
+local name = 'test_api%.lua:' .. debug.getinfo(counted, 'S').linedefined .. '$'
+local found
+for k, f in pairs(stats.functions) do
+    if k:find(name) then found = f end
+end
+assert(found and found.compiled and found.failures == 0)
+assert(found.codesize > 0 and found.irsize == 0)  -- the IR isn't retained
+
+-- Compilation policy
+assert(lll.getCompileSizeScale() == 200)
+assert(lll.getMaxCompileSize() == 10000)
+assert(lll.getMaxCompileFailures() == 3)
+assert(lll.getCompileBudget() == 250)
+lll.setAutoCompileEnable(true)
+lll.setCallsToCompile(10)
+lll.setMaxCompileSize(2)
+assert(lll.getMaxCompileSize() == 2)
+local function big(a) local b = a * 2; return a + b end
+for i = 1, 20 do big(i) end
+assert(lll.isCompiled(big) == false and lll.isBlacklisted(big) == true)
+lll.setMaxCompileSize(10000)
+for i = 1, 20 do big(i) end
+assert(lll.isCompiled(big) == false)
+assert(lll.compile(big))
+local function small(a) return a end
+for i = 1, 10 do small(i) end
+assert(lll.isCompiled(small) == true and lll.isBlacklisted(small) == false)
+lll.setCompileSizeScale(1)
+local function scaled(a) return a end
+for i = 1, 10 do scaled(i) end
+assert(lll.isCompiled(scaled) == false)
+for i = 1, 10 * #string.dump(scaled) do scaled(i) end
+assert(lll.isCompiled(scaled) == true)
+lll.setCompileSizeScale(200)
+lll.setCallsToCompile(50)
+
+-- Code memory limit (least recently used functions are uncompiled)
+assert(lll.getCodeMemoryLimit() == 0)
+local evicted = lll.stats().evicted
+local function cold() return 'cold' end
+local function hot() return 'hot' end
+assert(lll.compile(cold) and lll.compile(hot))
+assert(hot() == 'hot')
+lll.setCodeMemoryLimit(lll.getCodeMemory() - 1)
+local function newer() return 'newer' end
+assert(lll.compile(newer))
+assert(lll.isCompiled(newer) and lll.isCompiled(hot))
+assert(lll.getCodeMemory() <= lll.getCodeMemoryLimit())
+assert(lll.stats().evicted > evicted)
+assert(cold() == 'cold' and hot() == 'hot' and newer() == 'newer')
+lll.setCodeMemoryLimit(0)
+
+-- Retention of the IR (only the native code is kept by default)
+assert(lll.isRetainIREnable() == false)
+local function noir(a) return a * 2 end
+assert(lll.compile(noir))
+assert(noir(21) == 42)
+lll.setRetainIREnable(true)
+assert(lll.isRetainIREnable() == true)
+local function withir(a) return a * 3 end
+assert(lll.compile(withir))
+assert(withir(14) == 42)
+lll.setRetainIREnable(false)
+local functions = lll.stats().functions
+for k, f in pairs(functions) do
+    if k:find('test_api%.lua:' .. debug.getinfo(noir, 'S').linedefined .. '$') then
+        assert(f.irsize == 0)
+    elseif k:find('test_api%.lua:' .. debug.getinfo(withir, 'S').linedefined .. '$') then
+        assert(f.irsize > 0)
+    end
+end
+
+-- Shared code (a chunk loaded again reuses the compiled functions)
+local chunk = [[
+    local obj = ...
+    return obj:get('k') .. 'v'
+]]
+local first, second = load(chunk), load(chunk)
+local shared = lll.stats().shared
+assert(lll.compile(first) and lll.compile(second))
+assert(lll.stats().shared == shared + 1)
+local A = {get = function(self, s) return 'a' .. s end}
+local B = {get = function(self, s) return 'b' .. s end}
+local a, b = setmetatable({}, {__index = A}), setmetatable({}, {__index = B})
+for i = 1, 3 do
+    assert(first(a) == 'akv' and second(b) == 'bkv')
+    assert(first(b) == 'bkv' and second(a) == 'akv')
+end
+
+-- Trace mode (the hot loops of interpreted functions are compiled)
+assert(lll.isTraceEnable() == false)
+assert(lll.getIterationsToTrace() == 100)
+lll.setAutoCompileEnable(false)
+lll.setTraceEnable(true)
+lll.setIterationsToTrace(10)
+local traces = lll.stats().traces
+local function traced(t, n)
+    local s, f = 0, 0.0
+    for i = 1, n do
+        local v = t[i]
+        if v < 500 then
+            s = s + v * 2
+        else
+            s = s - 1
+        end
+        f = f + v / 2
+        t[i] = v + 1
+    end
+    return s, f
+end
+local t = {}
+for i = 1, 1000 do t[i] = i end
+local s, f = traced(t, 1000)
+assert(s == 249500 - 501 and f == 250250.0)
+assert(t[1] == 2 and t[1000] == 1001)
+t[700] = 'x'  -- side exit to the interpreter (arith on a string)
+assert(not pcall(traced, t, 1000))
+assert(lll.stats().traces > traces)
+lll.setTraceEnable(false)
+lll.setIterationsToTrace(100)
+lll.setAutoCompileEnable(true)
+
+-- Function cloning (specialized to the tags of the arguments)
+assert(lll.getMaxClones() == 0)
+lll.setMaxClones(2)
+local clones = lll.stats().clones
+local function dist(x1, y1, x2, y2)
+    local dx, dy = x2 - x1, y2 - y1
+    return dx * dx + dy * dy
+end
+assert(lll.compile(dist))
+for i = 1, lll.getCallsToCompile() + 1 do
+    assert(dist(1.5, 2.5, 4.5, 6.5) == 25.0)
+end
+assert(lll.stats().clones == clones + 1)
+assert(math.type(dist(1, 2, 4, 6)) == 'integer' and dist(1, 2, 4, 6) == 25)
+assert(dist(1.5, 2, 4.5, 6) == 25.0)
+local V = setmetatable({}, {__sub = function() return 3 end})
+assert(dist(V, 0, V, 0) == 9)
+lll.setMaxClones(0)
@@ -0,0 +1,113 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_array.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '3', '5', '-1', '2.5', '"4"', '{}', '{1, 2, 3}',
+        '{1.5, 2.5, 3.5, 4.5, 5.5}', '{1, nil, 3}', '{n = 3}',
+        'setmetatable({}, {__index = function(t, k) return k end})'}
+
+-- The functions that change the table work on a copy of it
+local copy = [[
+    if type(a) == 'table' then
+        local b = setmetatable({}, getmetatable(a))
+        for k, v in pairs(a) do rawset(b, k, v) end
+        a = b
+    end
+]]
+
+local fs = {
+[[function(a, n)
+    local sum = 0
+    for i = 1, n do
+        sum = sum + a[i]
+    end
+    return sum
+end]],
+[[function(a, n)
+    local sum = 0
+    for i = n, 1, -1 do
+        sum = sum * 2 + a[i]
+    end
+    return sum
+end]],
+[[function(a, n)
+    local sum = 0
+    for i = 1.0, n do
+        sum = sum + a[i]
+    end
+    return sum
+end]],
+[[function(a, n)
+    local sum = 0
+    for i = 2, n, 2 do
+        sum = sum + a[i] * a[i - 1]
+    end
+    return sum
+end]],
+[[function(a, n)
+]] .. copy .. [[
+    for i = 1, n do
+        a[i] = a[i] * 2 + 1
+    end
+    return a
+end]],
+[[function(a, n)
+]] .. copy .. [[
+    local b = {}
+    for i = 1, n do
+        b[i] = a[i]
+    end
+    return b
+end]],
+[[function(a, n)
+]] .. copy .. [[
+    local sum = 0
+    for i = 1, n do
+        sum = sum + (a[i] or 0)
+        if i == 2 then
+            for k = 1, 10 do a[k] = nil end
+            for k = 1, 100 do a['k' .. k] = k end
+            collectgarbage()
+        end
+    end
+    return sum
+end]],
+[[function(a, n)
+    local sum = 0
+    for i = 1, #a - 1 do
+        sum = sum + a[i + 1] - a[i]
+    end
+    return sum
+end]],
+[[function(a, n)
+    local sum = 0
+    for i = 0, n do
+        local k
+        if i > 1 then k = 1 + i else k = 2 end
+        sum = sum + a[k] + a[i - 1 + 2]
+    end
+    return sum
+end]],
+[[function(a, n)
+]] .. copy .. [[
+    for i = 2, n do
+        local k = i - 1
+        a[k] = a[i]
+    end
+    return a
+end]],
+}
+
+local vectorize = lll.isVectorizeEnable()
+lll.setVectorizeEnable(true)
+executetests(fs, generateargs(2, values))
+lll.setVectorizeEnable(false)
+executetests(fs, generateargs(2, values))
+lll.setVectorizeEnable(vectorize)
@@ -0,0 +1,51 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_ccall.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '1', '-1', '3', '2.5', '"x"', '"abc"', '{}'}
+
+local fs = {
+[[function(a, b)
+    local s = tostring(a) .. tostring(b)
+    return string.sub(s, 2, 4)
+end]],
+[[function(a, b)
+    local x, y, z = select(2, a, b)
+    return tostring(x) .. tostring(y) .. tostring(z)
+end]],
+[[function(a, b)
+    local x, y = math.type(a), type(b)
+    return tostring(x) .. y
+end]],
+[[function(a, b)
+    local t = {select('#', a, b, nil)}
+    return t[1]
+end]],
+[[function(a, b)
+    local x, y = pcall(string.rep, a, b)
+    return tostring(x) .. tostring(y)
+end]],
+[[function(a, b)
+    local f = string.gmatch(tostring(a) .. ' ' .. tostring(b), '%S+')
+    local x = f()
+    local y = f()
+    local z = f()
+    return tostring(x) .. tostring(y) .. tostring(z)
+end]],
+[[function(a, b)
+    local sum = 0
+    for i = 1, 10 do
+        sum = sum + math.max(i, 5) + select('#', a, b)
+    end
+    return sum
+end]],
+}
+
+executetests(fs, generateargs(2, values))
@@ -0,0 +1,102 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_escape.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', 'true', '1', '2.5', '"x"', '{}', 'function() end'}
+
+local fs = {
+[[function(a, b)
+    local v = {a, b}
+    return v[1] + v[2]
+end]],
+[[function(a, b)
+    local v = {x = a, y = b}
+    v.z = 3
+    return v.x * v.y + v.z
+end]],
+[[function(a, b)
+    local v = {a, b}
+    v.n = 2
+    return v
+end]],
+[[function(a, b)
+    local v = {x = a}
+    v.y = b
+    v[1] = 'one'
+    setmetatable(v, {})
+    return v.x, v.y, v[1]
+end]],
+[[function(a, b)
+    local v = {a}
+    if b then v[2] = b end
+    return #v
+end]],
+[[function(a, b)
+    local v = {{a}, {b}}
+    return v[1][1], v[2][1]
+end]],
+[[function(a, b)
+    local v = {}
+    v.s = tostring(a) .. tostring(b)
+    collectgarbage()
+    local s = v.s
+    return s
+end]],
+[[function(a, b)
+    local v = {a, b, a, b}
+    v[1] = nil
+    return v[1], v[4], v[5], #v
+end]],
+[[function(a, b)
+    local t = {a}
+    local f = function() return a end
+    return b
+end]],
+[[function(a, b)
+    local s = 0
+    for i = 1, 3 do
+        local p = {i, a}
+        s = s + p[1] * p[2]
+    end
+    return s
+end]],
+[[function(a, b)
+    local t = {a, b}
+    t = t[1]
+    return t, b
+end]],
+[[function(a, b)
+    local t = {x = a}
+    t = t.x
+    t = {t, b}
+    return t[1], t[2]
+end]],
+[[function(a, b)
+    local t
+    local function g() return t end
+    t = {a, b}
+    return g()
+end]],
+[[function(a, b)
+    local f
+    local function g() return f() end
+    f = function() return a end
+    return g()
+end]],
+[[function(a, b)
+    local t
+    local function g() return t[1] end
+    t = {a}
+    local x = g()
+    return x, t[1], b
+end]],
+}
+
+executetests(fs, generateargs(2, values))
@@ -0,0 +1,72 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_ffi.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '1', '-7', '100', '2.5', '-0.5', '"x"', '"abc"'}
+
+local fs = {
+[[(function()
+    local cos = lll.ffi('double cos(double)')
+    return function(a) return cos(a) end
+end)()]],
+[[(function()
+    local ldexp = lll.ffi('double ldexp(double, int)')
+    return function(a, b) return ldexp(a, b) end
+end)()]],
+[[(function()
+    local fabsf = lll.ffi('float fabsf(float)')
+    return function(a, b) return fabsf(a) + fabsf(b) end
+end)()]],
+[[(function()
+    local labs = lll.ffi('long labs(long)')
+    return function(a, b)
+        local x = labs(a)
+        return x + labs(b)
+    end
+end)()]],
+[[(function()
+    local strlen = lll.ffi('size_t strlen(const char*)')
+    return function(a, b) return strlen(a) + strlen(tostring(b)) end
+end)()]],
+[[(function()
+    local free = lll.ffi('void free(void*)')
+    return function(a)
+        local x = free(nil)
+        free(nil)
+        return x
+    end
+end)()]],
+[[(function()
+    local atoi = lll.ffi('int atoi(const char*)')
+    return function(a, b)
+        local sum = 0
+        for i = 1, 10 do sum = sum + atoi(tostring(i)) end
+        return sum + atoi(a)
+    end
+end)()]],
+[[(function()
+    local strtoul = lll.ffi('unsigned long strtoul(const char*, void*, int)')
+    local strtou32 = lll.ffi('unsigned strtoul(const char*, void*, int)')
+    return function(a, b)
+        local x = strtoul('18446744073709551615', nil, 10)
+        local y = strtou32('4294967295', nil, 10)
+        return x, y, strtoul(a, nil, 10)
+    end
+end)()]],
+}
+
+executetests(fs, generateargs(2, values))
+
+-- Invalid declarations
+assert(lll.ffi('double lll_ffi_not_found(double)') == nil)
+assert(lll.ffi('double cos(double') == nil)
+assert(lll.ffi('unknown cos(double)') == nil)
+assert(lll.ffi('double cos(void, void)') == nil)
+assert(lll.ffi('double cos(double)') == lll.ffi('double cos(double)'))
@@ -0,0 +1,88 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_forin.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'{}', '{1, 2, 3}', '{1, nil, 3}', '{x = 1, y = 2, 10, 20}',
+        '{[1] = 5, [2] = 6, [4] = 8}', '{1.5, x = 2.5, [3.5] = 3}',
+        'setmetatable({1, 2}, {__index = function(t, k) ' ..
+                'if k < 5 then return k * 10 end end})',
+        'setmetatable({a = 1}, {__pairs = function(t) ' ..
+                'return function(_, k) if not k then return 1, 2 end end, ' ..
+                't, nil end})'}
+
+local fs = {
+[[function(t)
+    local n, sum = 0, 0
+    for k, v in pairs(t) do
+        n = n + 1
+        if type(k) == 'number' then sum = sum + k end
+        if type(v) == 'number' then sum = sum + v end
+    end
+    return n * 1000 + sum
+end]],
+[[function(t)
+    local n, sum = 0, 0
+    for i, v in ipairs(t) do
+        n = n + 1
+        sum = sum + i * v
+    end
+    return n * 1000 + sum
+end]],
+[[function(t)
+    local n = 0
+    for k in next, t do
+        n = n + 1
+    end
+    return n
+end]],
+[[function(t)
+    local n = 0
+    for k, v, extra in pairs(t) do
+        if extra ~= nil then return 'error' end
+        n = n + 1
+    end
+    return n
+end]],
+[[function(t)
+    local n = 0
+    for k, v in pairs(t) do
+        t[k] = nil
+        n = n + 1
+    end
+    return n + (next(t) == nil and 0 or 1000)
+end]],
+[[function(t)
+    local n = 0
+    for k, v in pairs(t) do
+        if type(v) == 'number' then t[k] = v + 1 end
+        n = n + 1
+    end
+    return n
+end]],
+[[function(t)
+    local n = 0
+    local k = next(t)
+    for k2, v in next, t, k do
+        n = n + 1
+    end
+    return n
+end]],
+[[function(t)
+    local n = 0
+    for i, v in ipairs(t) do
+        for j, w in ipairs(t) do
+            n = n + 1
+        end
+    end
+    return n
+end]],
+}
+
+executetests(fs, generateargs(1, values))
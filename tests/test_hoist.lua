@@ -0,0 +1,61 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_hoist.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '3', '"x"', '{}', '{x = 1, y = 2}',
+        '{x = 1.5, [3] = {x = 2}}',
+        'setmetatable({}, {__index = function(t, k) return #k end})'}
+
+local fs = {
+[[function(t, k)
+    local sum = 0
+    for i = 1, 5 do
+        sum = sum + t[k]
+    end
+    return sum
+end]],
+[[function(t, k)
+    local sum = 0
+    for i = 1, 3 do
+        for j = 1, 3 do
+            sum = sum + t.x * i + j
+        end
+    end
+    return sum
+end]],
+[[function(t, k)
+    local sum = 0
+    for i = 1, 5 do
+        sum = sum + t.x
+        rawset(t, 'x', i)
+    end
+    return sum
+end]],
+[[function(t, k)
+    local n = 0
+    local mt = {__index = function(t, k) n = n + 1; return n end}
+    local p = setmetatable({}, mt)
+    local sum = 0
+    for i = 1, 5 do
+        sum = sum + p[k]
+    end
+    return sum
+end]],
+[[function(t, k)
+    local sum = 0
+    for i = 1, 5 do
+        sum = sum + t[k]
+        t = t[3] or t
+    end
+    return sum
+end]],
+}
+
+executetests(fs, generateargs(2, values))
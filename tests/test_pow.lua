@@ -0,0 +1,25 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_pow.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '-0.0', '2', '-3', '0.5', '1.5', '-2.25', '1e300',
+        '1/0', '-1/0', '0/0', '"4"', '"abc"'}
+local exponents = {'0', '1', '2', '3', '-1', '-2', '0.5', '2.0', '-0.5',
+        '1e300', '"2"'}
+
+local fs = {}
+for _, e in ipairs(exponents) do
+    table.insert(fs, 'function(a) return a ^ ' .. e .. ' end')
+    table.insert(fs, 'function(a) return 1 / (a ^ ' .. e .. ') end')
+end
+table.insert(fs, 'function(a, b) return a ^ b end')
+table.insert(fs, 'function(a, b) return 1 / (a ^ b) end')
+
+executetests(fs, generateargs(2, values))
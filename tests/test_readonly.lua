@@ -0,0 +1,68 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_readonly.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '-7', '2.5', '-2.5', '1e100', '16', '"9"', '{}'}
+
+local fs = {
+[[(function()
+    local floor = math.floor
+    return function(x)
+        local y = floor(x)
+        return math.type(y) .. ' ' .. tostring(y)
+    end
+end)()]],
+[[(function()
+    local sqrt = math.sqrt
+    return function(x) return sqrt(x) end
+end)()]],
+[[(function()
+    local floor, sqrt = math.floor, math.sqrt
+    return function(x)
+        local y = floor(x)
+        return sqrt(y) + floor(x / 2)
+    end
+end)()]],
+[[(function()
+    local floor = math.floor
+    local function set(f) floor = f end
+    set(math.sqrt)
+    return function(x) return floor(x) end
+end)()]],
+[[(function()
+    local k = 10
+    local f = function(x) return x + k end
+    k = 20
+    return f
+end)()]],
+[[(function()
+    local k = 10
+    local function inc() k = k + 1 end
+    return function(x)
+        local before = k
+        inc()
+        return x + k - before
+    end
+end)()]],
+[[(function()
+    local t = {n = 1}
+    return function(x)
+        t.n = t.n + 1
+        return t.n
+    end
+end)()]],
+[[(function()
+    local f = function(x) return tostring(x) end
+    _ENV = setmetatable({tostring = type}, {__index = _ENV})
+    return f
+end)()]],
+}
+
+executetests(fs, generateargs(1, values))
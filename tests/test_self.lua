@@ -29,3 +29,68 @@ assert(obj.n == nil and get(obj) == nil)
 set(obj, 'abc')
 assert(obj.n == 'abc' and get(obj) == 'abc')
 
+
+-- Methods found in the __index table of the metatable
+local function class(name)
+    local c = {}
+    c.__index = c
+    c.name = function(o) return name end
+    return c
+end
+
+local function new(c) return setmetatable({}, c) end
+
+local function getname(o) return o:name() end
+assert(lll.compile(getname))
+
+local classes = {}
+for i = 1, 6 do
+    classes[i] = class('c' .. i)
+end
+for _ = 1, 3 do
+    for i, c in ipairs(classes) do
+        assert(getname(new(c)) == 'c' .. i)
+    end
+end
+
+-- Method redefined in the class
+local a = classes[1]
+local o = new(a)
+assert(getname(o) == 'c1')
+a.name = function(o) return 'redefined' end
+assert(getname(o) == 'redefined')
+
+-- Class table rehashed
+for i = 1, 100 do
+    a['m' .. i] = i
+end
+assert(getname(o) == 'redefined')
+
+-- Method removed from the class
+a.name = nil
+assert(not pcall(getname, o))
+a.name = function(o) return 'back' end
+assert(getname(o) == 'back')
+
+-- Method defined in the object
+o.name = function(o) return 'own' end
+assert(getname(o) == 'own')
+o.name = nil
+assert(getname(o) == 'back')
+
+-- __index replaced
+getmetatable(o).__index = classes[2]
+assert(getname(o) == 'c2')
+getmetatable(o).__index = function(t, k)
+    return function() return 'function' end
+end
+assert(getname(o) == 'function')
+
+-- Inheritance
+local base = class('base')
+local derived = setmetatable({}, base)
+derived.__index = derived
+local d = new(derived)
+assert(getname(d) == 'base')
+derived.name = function(o) return 'derived' end
+assert(getname(d) == 'derived')
@@ -0,0 +1,73 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_selfcall.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '1', '10', '20', '100000', '2.5', '"x"'}
+
+local fs = {
+[[(function()
+    local function fib(n)
+        if n > 20 then n = 20 end
+        if n < 2 then return n end
+        return fib(n - 1) + fib(n - 2)
+    end
+    return fib
+end)()]],
+[[(function()
+    local function sum(n, acc)
+        acc = acc or 0
+        if n <= 0 then return acc end
+        return sum(n - 1, acc + n)
+    end
+    return sum
+end)()]],
+[[(function()
+    local function count(n, acc, extra)
+        if extra ~= nil then return 'error' end
+        if n <= 0 then return acc end
+        return count(n - 1, (acc or 0) + 1)
+    end
+    return count
+end)()]],
+[[(function()
+    local function closures(n, fs)
+        if n > 100 then n = 100 end
+        fs = fs or {}
+        if n <= 0 then
+            local sum = 0
+            for _, f in ipairs(fs) do sum = sum + f() end
+            return sum
+        end
+        fs[#fs + 1] = function() return n end
+        return closures(n - 1, fs)
+    end
+    return closures
+end)()]],
+[[(function()
+    local other
+    local function f(n)
+        if n <= 0 then return 0 end
+        return other(n - 1) + 1
+    end
+    other = function(n) return n * 2 end
+    return f
+end)()]],
+[[(function()
+    local function depth(n)
+        if n > 150 then n = 150 end
+        if n <= 0 then return 0 end
+        local a, b = depth(n - 1)
+        return a + 1, b
+    end
+    return depth
+end)()]],
+}
+
+executetests(fs, generateargs(1, values))
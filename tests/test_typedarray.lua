@@ -0,0 +1,70 @@
+#!src/lua
+-- LLL - Lua Low Level
+-- September, 2015
+-- Author: Gabriel de Quadros Ligneul
+-- Copyright Notice for LLL: see lllcore.h
+--
+-- test_typedarray.lua
+
+local executetests = require 'tests/executetests' 
+local generateargs = require 'tests/generateargs'
+
+local values = {'nil', '0', '1', '-3', '2.5', '4.0', '255', '256', '2^40',
+        '"x"', '"3"'}
+
+local fs = {
+[[function(a, b)
+    local x = lll.array('float64', 4)
+    x[1] = a
+    x[2] = b
+    return x[1] + x[2] + x[3] + #x
+end]],
+[[function(a, b)
+    local x = lll.array('int32', 2)
+    x[1] = a
+    x[2] = b
+    return x[1] * 1000 + x[2]
+end]],
+[[function(a, b)
+    local x = lll.array('uint8', 3)
+    x[2] = a
+    x[3] = b
+    return x[2] + x[3]
+end]],
+[[function(a, b)
+    local x = lll.array('int64', 10)
+    for i = 1, #x do x[i] = i * a end
+    local sum = 0
+    for i = 1, #x do sum = sum + x[i] end
+    return sum
+end]],
+[[function(a, b)
+    local x = lll.array('float64', 3)
+    x[3] = 1.5
+    return tostring(x[a]) .. tostring(x[b])
+end]],
+[[function(a, b)
+    local x = lll.array('int32', 3)
+    x[a] = b
+    return x[1] + x[2] + x[3]
+end]],
+[[function(a, b)
+    local x = lll.array('float64', 8)
+    local y = {}
+    for i = 1, #x do
+        x[i] = i / 2
+        y[i] = x[i] * b
+    end
+    return y[#y] + x[a]
+end]],
+}
+
+executetests(fs, generateargs(2, values))
+
+-- Invalid arrays
+assert(not pcall(lll.array, 'float32', 1))
+assert(not pcall(lll.array, 'int64', -1))
+
+-- The metatable is locked
+local x = lll.array('int32', 1)
+assert(type(getmetatable(x)) == 'string')